@@ -10,10 +10,297 @@
 #include "common.h"
 #include "utils.h"
 
+/***************************************************************************
+ *                       SIMD CTR FOR 128 BIT BLOCKS                       *
+ ***************************************************************************/
+/*
+  The CTR loops below only ever change the last byte of the counter,
+  byteAdd adds 1 to byte 15 and drops the carry. Keystream block b is
+  therefore the nonce with byte 15 xored by b mod 256, encrypted. The
+  kernels here encrypt up to 8 such blocks at once for the Speck and
+  Simon variants with 64 bit words, one block per 64 bit lane: two per
+  SSE2 register, four per AVX2 register. The kernel is picked at run
+  time and the byte loops stay as the fallback. Define
+  MAVLINK_NO_CTR_SIMD to always use the byte loops.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(MAVLINK_NO_CTR_SIMD)
+#define MAVLINK_CTR_SIMD
+#include <immintrin.h>
+
+#define CTR_SIMD_BLOCKS 8
+
+/*
+  first nonce word of block b, and the keystream bytes of a run of blocks
+ */
+#define CTR_X(n, b) ((long long)((n)[1] ^ ((uint64_t)((b) & 0xFF) << 56)))
+
+static inline void _ctr128_store(const uint64_t x[], const uint64_t y[], int blocks, uint8_t *ks)
+{
+    int b;
+    for (b = 0; b < blocks; b++)
+    {
+        // Words64ToBytes of {y, x}, x86 is little endian
+        memcpy(&ks[16 * b], &y[b], 8);
+        memcpy(&ks[16 * b + 8], &x[b], 8);
+    }
+}
+
+#define CTR_SSE2_ROL(v, r) _mm_or_si128(_mm_slli_epi64(v, r), _mm_srli_epi64(v, 64 - (r)))
+#define CTR_SSE2_SIMON_F(v) _mm_xor_si128(_mm_and_si128(CTR_SSE2_ROL(v, 1), CTR_SSE2_ROL(v, 8)), CTR_SSE2_ROL(v, 2))
+
+__attribute__((target("sse2"))) static inline void _ctr128_speck_sse2(const uint64_t rk[], int rounds, const uint64_t n[2],
+                                                                      int first, int blocks, uint8_t *ks)
+{
+    __m128i x[CTR_SIMD_BLOCKS / 2], y[CTR_SIMD_BLOCKS / 2];
+    uint64_t xs[CTR_SIMD_BLOCKS], ys[CTR_SIMD_BLOCKS];
+    int vecs = (blocks + 1) / 2, i, v;
+
+    for (v = 0; v < vecs; v++)
+    {
+        x[v] = _mm_set_epi64x(CTR_X(n, first + 2 * v + 1), CTR_X(n, first + 2 * v));
+        y[v] = _mm_set1_epi64x((long long)n[0]);
+    }
+    for (i = 0; i < rounds; i++)
+    {
+        const __m128i k = _mm_set1_epi64x((long long)rk[i]);
+        for (v = 0; v < vecs; v++)
+        {
+            // ER64
+            x[v] = _mm_xor_si128(_mm_add_epi64(CTR_SSE2_ROL(x[v], 56), y[v]), k);
+            y[v] = _mm_xor_si128(CTR_SSE2_ROL(y[v], 3), x[v]);
+        }
+    }
+    for (v = 0; v < vecs; v++)
+    {
+        _mm_storeu_si128((__m128i *)&xs[2 * v], x[v]);
+        _mm_storeu_si128((__m128i *)&ys[2 * v], y[v]);
+    }
+    _ctr128_store(xs, ys, blocks, ks);
+}
+
+__attribute__((target("sse2"))) static inline void _ctr128_simon_sse2(const uint64_t rk[], int rounds, const uint64_t n[2],
+                                                                      int first, int blocks, uint8_t *ks)
+{
+    __m128i x[CTR_SIMD_BLOCKS / 2], y[CTR_SIMD_BLOCKS / 2];
+    uint64_t xs[CTR_SIMD_BLOCKS], ys[CTR_SIMD_BLOCKS];
+    int vecs = (blocks + 1) / 2, i, v;
+
+    for (v = 0; v < vecs; v++)
+    {
+        x[v] = _mm_set_epi64x(CTR_X(n, first + 2 * v + 1), CTR_X(n, first + 2 * v));
+        y[v] = _mm_set1_epi64x((long long)n[0]);
+    }
+    for (i = 0; i + 1 < rounds; i += 2)
+    {
+        const __m128i k1 = _mm_set1_epi64x((long long)rk[i]);
+        const __m128i k2 = _mm_set1_epi64x((long long)rk[i + 1]);
+        for (v = 0; v < vecs; v++)
+        {
+            // R64x2
+            y[v] = _mm_xor_si128(y[v], _mm_xor_si128(CTR_SSE2_SIMON_F(x[v]), k1));
+            x[v] = _mm_xor_si128(x[v], _mm_xor_si128(CTR_SSE2_SIMON_F(y[v]), k2));
+        }
+    }
+    if (rounds & 1)
+    {
+        // the single last round of Simon128192
+        const __m128i k = _mm_set1_epi64x((long long)rk[rounds - 1]);
+        for (v = 0; v < vecs; v++)
+        {
+            __m128i t = x[v];
+            x[v] = _mm_xor_si128(y[v], _mm_xor_si128(CTR_SSE2_SIMON_F(x[v]), k));
+            y[v] = t;
+        }
+    }
+    for (v = 0; v < vecs; v++)
+    {
+        _mm_storeu_si128((__m128i *)&xs[2 * v], x[v]);
+        _mm_storeu_si128((__m128i *)&ys[2 * v], y[v]);
+    }
+    _ctr128_store(xs, ys, blocks, ks);
+}
+
+// rotations by a whole byte are a byte shuffle within each 64 bit lane
+#define CTR_AVX2_ROR8 _mm256_set_epi8(8, 15, 14, 13, 12, 11, 10, 9, 0, 7, 6, 5, 4, 3, 2, 1, \
+                                      8, 15, 14, 13, 12, 11, 10, 9, 0, 7, 6, 5, 4, 3, 2, 1)
+#define CTR_AVX2_ROL8 _mm256_set_epi8(14, 13, 12, 11, 10, 9, 8, 15, 6, 5, 4, 3, 2, 1, 0, 7, \
+                                      14, 13, 12, 11, 10, 9, 8, 15, 6, 5, 4, 3, 2, 1, 0, 7)
+#define CTR_AVX2_ROL(v, r) _mm256_or_si256(_mm256_slli_epi64(v, r), _mm256_srli_epi64(v, 64 - (r)))
+#define CTR_AVX2_SIMON_F(v, rol8) \
+    _mm256_xor_si256(_mm256_and_si256(CTR_AVX2_ROL(v, 1), _mm256_shuffle_epi8(v, rol8)), CTR_AVX2_ROL(v, 2))
+
+__attribute__((target("avx2"))) static inline void _ctr128_speck_avx2(const uint64_t rk[], int rounds, const uint64_t n[2],
+                                                                      int first, int blocks, uint8_t *ks)
+{
+    const __m256i ror8 = CTR_AVX2_ROR8;
+    __m256i x[CTR_SIMD_BLOCKS / 4], y[CTR_SIMD_BLOCKS / 4];
+    uint64_t xs[CTR_SIMD_BLOCKS], ys[CTR_SIMD_BLOCKS];
+    int vecs = (blocks + 3) / 4, i, v;
+
+    for (v = 0; v < vecs; v++)
+    {
+        x[v] = _mm256_set_epi64x(CTR_X(n, first + 4 * v + 3), CTR_X(n, first + 4 * v + 2),
+                                 CTR_X(n, first + 4 * v + 1), CTR_X(n, first + 4 * v));
+        y[v] = _mm256_set1_epi64x((long long)n[0]);
+    }
+    for (i = 0; i < rounds; i++)
+    {
+        const __m256i k = _mm256_set1_epi64x((long long)rk[i]);
+        for (v = 0; v < vecs; v++)
+        {
+            // ER64
+            x[v] = _mm256_xor_si256(_mm256_add_epi64(_mm256_shuffle_epi8(x[v], ror8), y[v]), k);
+            y[v] = _mm256_xor_si256(CTR_AVX2_ROL(y[v], 3), x[v]);
+        }
+    }
+    for (v = 0; v < vecs; v++)
+    {
+        _mm256_storeu_si256((__m256i *)&xs[4 * v], x[v]);
+        _mm256_storeu_si256((__m256i *)&ys[4 * v], y[v]);
+    }
+    _ctr128_store(xs, ys, blocks, ks);
+}
+
+__attribute__((target("avx2"))) static inline void _ctr128_simon_avx2(const uint64_t rk[], int rounds, const uint64_t n[2],
+                                                                      int first, int blocks, uint8_t *ks)
+{
+    const __m256i rol8 = CTR_AVX2_ROL8;
+    __m256i x[CTR_SIMD_BLOCKS / 4], y[CTR_SIMD_BLOCKS / 4];
+    uint64_t xs[CTR_SIMD_BLOCKS], ys[CTR_SIMD_BLOCKS];
+    int vecs = (blocks + 3) / 4, i, v;
+
+    for (v = 0; v < vecs; v++)
+    {
+        x[v] = _mm256_set_epi64x(CTR_X(n, first + 4 * v + 3), CTR_X(n, first + 4 * v + 2),
+                                 CTR_X(n, first + 4 * v + 1), CTR_X(n, first + 4 * v));
+        y[v] = _mm256_set1_epi64x((long long)n[0]);
+    }
+    for (i = 0; i + 1 < rounds; i += 2)
+    {
+        const __m256i k1 = _mm256_set1_epi64x((long long)rk[i]);
+        const __m256i k2 = _mm256_set1_epi64x((long long)rk[i + 1]);
+        for (v = 0; v < vecs; v++)
+        {
+            // R64x2
+            y[v] = _mm256_xor_si256(y[v], _mm256_xor_si256(CTR_AVX2_SIMON_F(x[v], rol8), k1));
+            x[v] = _mm256_xor_si256(x[v], _mm256_xor_si256(CTR_AVX2_SIMON_F(y[v], rol8), k2));
+        }
+    }
+    if (rounds & 1)
+    {
+        // the single last round of Simon128192
+        const __m256i k = _mm256_set1_epi64x((long long)rk[rounds - 1]);
+        for (v = 0; v < vecs; v++)
+        {
+            __m256i t = x[v];
+            x[v] = _mm256_xor_si256(y[v], _mm256_xor_si256(CTR_AVX2_SIMON_F(x[v], rol8), k));
+            y[v] = t;
+        }
+    }
+    for (v = 0; v < vecs; v++)
+    {
+        _mm256_storeu_si256((__m256i *)&xs[4 * v], x[v]);
+        _mm256_storeu_si256((__m256i *)&ys[4 * v], y[v]);
+    }
+    _ctr128_store(xs, ys, blocks, ks);
+}
+
+typedef void (*ctr128_kernel_t)(const uint64_t rk[], int rounds, const uint64_t n[2], int first, int blocks, uint8_t *ks);
+
+/*
+  kernel in use: 0 until the CPU is probed, then 1 for none, 2 for SSE2
+  and 3 for AVX2
+ */
+static int _ctr128_level;
+
+static inline int _ctr128_probe(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? 3 : __builtin_cpu_supports("sse2") ? 2 : 1;
+}
+
+/*
+  use at most the kernel of the given level, so that tests can run the
+  narrower kernels and the byte loops on a CPU that has AVX2
+
+  @return the level in use, lower than asked when the CPU lacks it
+ */
+static inline int _ctr128_force_level(int level)
+{
+    int max = _ctr128_probe();
+    if (level > max)
+    {
+        level = max;
+    }
+    __atomic_store_n(&_ctr128_level, level, __ATOMIC_RELAXED);
+    return level;
+}
+
+/*
+  the widest kernel this CPU runs, NULL if there is none. The CPU is
+  probed on the first call only, threads that race on it store the same
+  answer
+ */
+static inline ctr128_kernel_t _ctr128_kernel(int simon)
+{
+    int l = __atomic_load_n(&_ctr128_level, __ATOMIC_RELAXED);
+    if (l == 0)
+    {
+        l = _ctr128_probe();
+        __atomic_store_n(&_ctr128_level, l, __ATOMIC_RELAXED);
+    }
+    if (l == 3)
+    {
+        return simon ? _ctr128_simon_avx2 : _ctr128_speck_avx2;
+    }
+    if (l == 2)
+    {
+        return simon ? _ctr128_simon_sse2 : _ctr128_speck_sse2;
+    }
+    return NULL;
+}
+
+/*
+  xor length bytes with the CTR keystream of a Speck (simon 0) or Simon
+  (simon 1) variant with 128 bit blocks
+
+  @return 0 if there is no kernel for this CPU and nothing was done
+ */
+static inline int _ctr128_simd(int simon, const uint8_t *nonce, const uint64_t rk[], int rounds,
+                               uint8_t *plaintext, int length)
+{
+    ctr128_kernel_t kernel = _ctr128_kernel(simon);
+    uint8_t ks[CTR_SIMD_BLOCKS * 16];
+    uint64_t n[2];
+    int block, i;
+
+    if (kernel == NULL)
+    {
+        return 0;
+    }
+    // BytesToWords64, x86 is little endian
+    memcpy(n, nonce, 16);
+    for (block = 0; 16 * block < length; block += CTR_SIMD_BLOCKS)
+    {
+        int bytes = length - 16 * block;
+        if (bytes > (int)sizeof(ks))
+        {
+            bytes = sizeof(ks);
+        }
+        kernel(rk, rounds, n, block, (bytes + 15) / 16, ks);
+        for (i = 0; i < bytes; i++)
+        {
+            plaintext[16 * block + i] ^= ks[i];
+        }
+    }
+    return 1;
+}
+#endif // MAVLINK_CTR_SIMD
+
 /***************************************************************************
  *                              SPECK128192                                *
  ***************************************************************************/
-void inline Speck128192KeySchedule(uint64_t K[], uint64_t rk[])
+static inline void Speck128192KeySchedule(uint64_t K[], uint64_t rk[])
 {
     uint64_t i, C = K[2], B = K[1], A = K[0];
     for (i = 0; i < 32;)
@@ -25,7 +312,7 @@ void inline Speck128192KeySchedule(uint64_t K[], uint64_t rk[])
     }
     rk[i] = A;
 }
-void inline Speck128192Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
+static inline void Speck128192Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
 {
     uint64_t i;
     Ct[0] = Pt[0];
@@ -34,6 +321,8 @@ void inline Speck128192Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
         ER64(Ct[1], Ct[0], rk[i++]);
 }
 
+#define SPECK128192_KEY_ROUNDS 33
+
 /**
  * For every block:
  * 1. Concat/xor/add nonce  with counter (random nonce)
@@ -41,18 +330,16 @@ void inline Speck128192Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
  * 3. XOR between encrypted nonce and plain
  * 4. Increment counter
  */
-MAVLINK_HELPER void Speck128192(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+MAVLINK_HELPER void Speck128192CTR(uint8_t *nonce, uint64_t rk[], uint8_t *plaintext, int length)
 {
     const int BLOCK_SIZE = 16;
-    const int KEY_LEN = 24;
-    const int KEY = 3;
-    const int KEY_ROUND = 33;
-
-    uint64_t K[KEY];
-    uint64_t rk[KEY_ROUND];
 
-    BytesToWords64(key, K, KEY_LEN);
-    Speck128192KeySchedule(K, rk);
+#ifdef MAVLINK_CTR_SIMD
+    if (length > BLOCK_SIZE && _ctr128_simd(0, nonce, rk, SPECK128192_KEY_ROUNDS, plaintext, length))
+    {
+        return;
+    }
+#endif
 
     int block = 0;
     int last_block;
@@ -101,6 +388,28 @@ MAVLINK_HELPER void Speck128192(uint8_t *nonce, uint8_t *key, uint8_t *plaintext
     xored(ct, &plaintext[block], length - block);
 }
 
+/**
+ * Expand a key into the round keys Speck128192CTR() takes
+ */
+MAVLINK_HELPER void Speck128192ExpandKey(uint8_t *key, uint64_t rk[SPECK128192_KEY_ROUNDS])
+{
+    const int KEY_LEN = 24;
+    const int KEY = 3;
+
+    uint64_t K[KEY];
+
+    BytesToWords64(key, K, KEY_LEN);
+    Speck128192KeySchedule(K, rk);
+}
+
+MAVLINK_HELPER void Speck128192(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+{
+    uint64_t rk[SPECK128192_KEY_ROUNDS];
+
+    Speck128192ExpandKey(key, rk);
+    Speck128192CTR(nonce, rk, plaintext, length);
+}
+
 #ifdef TEST
 /***************************************************************************
  *                              CHACHA20                                   *
@@ -249,11 +558,14 @@ typedef struct
     t_instance work;
 } t_instances;
 
-inline uint32_t _rotl(uint32_t x, int rot) { return (x << rot) | (x >> (32 - rot)); }
+// <immintrin.h> has the same rotation as a macro
+#ifndef _rotl
+static inline uint32_t _rotl(uint32_t x, int rot) { return (x << rot) | (x >> (32 - rot)); }
+#endif
 
 // Square a 32-bit number to obtain the 64-bit result and return
 // the upper 32 bit XOR the lower 32 bit
-inline uint32_t g_func(uint32_t x)
+static inline uint32_t g_func(uint32_t x)
 {
     // Construct high and low argument for squaring
     uint32_t a = x & 0xFFFF;
@@ -266,7 +578,7 @@ inline uint32_t g_func(uint32_t x)
 }
 
 // Calculate the next internal state
-inline void next_state(t_instance *p_instance)
+static inline void next_state(t_instance *p_instance)
 {
     // Temporary data
     uint32_t g[8], c_old[8], i;
@@ -302,7 +614,7 @@ inline void next_state(t_instance *p_instance)
 }
 
 // key_setup
-inline void key_setup(t_instances *instances, const uint8_t *p_key)
+static inline void key_setup(t_instances *instances, const uint8_t *p_key)
 {
     // Temporary data
     uint32_t k0, k1, k2, k3, i;
@@ -353,7 +665,7 @@ inline void key_setup(t_instances *instances, const uint8_t *p_key)
 }
 
 /* IV setup */
-inline void iv_setup(t_instances *instances, const uint8_t *iv)
+static inline void iv_setup(t_instances *instances, const uint8_t *iv)
 {
     /* Temporary variables */
     uint8_t i0, i1, i2, i3, i;
@@ -385,7 +697,7 @@ inline void iv_setup(t_instances *instances, const uint8_t *iv)
 }
 
 // Encrypt or decrypt a block of data
-inline void _cipher_rabbit(t_instance *p_instance, const uint8_t *p_src, uint8_t *p_dest, size_t data_size)
+static inline void _cipher_rabbit(t_instance *p_instance, const uint8_t *p_src, uint8_t *p_dest, size_t data_size)
 {
     uint32_t i;
     for (i = 0; i < data_size; i += 16)
@@ -592,7 +904,7 @@ MAVLINK_HELPER void setup(uint8_t *state, uint8_t *key, uint8_t *iv)
     rotate(State, &t1, &t2, &t3);
 }
 
-inline void _cipher_trivium(uint8_t *state, uint8_t *stream, uint16_t length)
+static inline void _cipher_trivium(uint8_t *state, uint8_t *stream, uint16_t length)
 {
     uint16_t i;
     uint64_t t1, t2, t3;
@@ -621,7 +933,7 @@ MAVLINK_HELPER void trivium(uint8_t *key, uint8_t *iv, uint8_t *stream, uint8_t
 /***************************************************************************
  *                              SIMON6496                                  *
  ***************************************************************************/
-void inline SimonKey6496Schedule(uint32_t K[], uint32_t rk[])
+static inline void SimonKey6496Schedule(uint32_t K[], uint32_t rk[])
 {
     uint32_t i, c = 0xfffffffc;
     uint64_t z = 0x7369f885192c0ef5LL;
@@ -635,7 +947,7 @@ void inline SimonKey6496Schedule(uint32_t K[], uint32_t rk[])
     }
 }
 
-void inline Simon6496Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
+static inline void Simon6496Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
 {
     uint32_t i;
     Ct[1] = Pt[1];
@@ -644,6 +956,8 @@ void inline Simon6496Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
         R32x2(Ct[1], Ct[0], rk[i++], rk[i++]);
 }
 
+#define SIMON6496_KEY_ROUNDS 42
+
 /**
  * For every block:
  * 1. Concat/xor/add nonce  with counter (random nonce)
@@ -651,18 +965,9 @@ void inline Simon6496Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
  * 3. XOR between encrypted nonce and plain
  * 4. Increment counter
  */
-MAVLINK_HELPER void Simon6496(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+MAVLINK_HELPER void Simon6496CTR(uint8_t *nonce, uint32_t rk[], uint8_t *plaintext, int length)
 {
     const int BLOCK_SIZE = 8;
-    const int KEY_LEN = 12;
-    const int KEY = 3;
-    const int KEY_ROUND = 42;
-
-    uint32_t K[KEY];
-    uint32_t rk[KEY_ROUND];
-
-    BytesToWords32(key, K, KEY_LEN);
-    SimonKey6496Schedule(K, rk);
 
     int block = 0;
     int last_block;
@@ -711,11 +1016,33 @@ MAVLINK_HELPER void Simon6496(uint8_t *nonce, uint8_t *key, uint8_t *plaintext,
     xored(ct, &plaintext[block], length - block);
 }
 
+/**
+ * Expand a key into the round keys Simon6496CTR() takes
+ */
+MAVLINK_HELPER void Simon6496ExpandKey(uint8_t *key, uint32_t rk[SIMON6496_KEY_ROUNDS])
+{
+    const int KEY_LEN = 12;
+    const int KEY = 3;
+
+    uint32_t K[KEY];
+
+    BytesToWords32(key, K, KEY_LEN);
+    SimonKey6496Schedule(K, rk);
+}
+
+MAVLINK_HELPER void Simon6496(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+{
+    uint32_t rk[SIMON6496_KEY_ROUNDS];
+
+    Simon6496ExpandKey(key, rk);
+    Simon6496CTR(nonce, rk, plaintext, length);
+}
+
 /***************************************************************************
  *                              SIMON64128                                 *
  ***************************************************************************/
 
-void inline Simon64128KeySchedule(uint32_t K[], uint32_t rk[])
+static inline void Simon64128KeySchedule(uint32_t K[], uint32_t rk[])
 {
     uint32_t i, c = 0xfffffffc;
     uint64_t z = 0xfc2ce51207a635dbLL;
@@ -730,7 +1057,7 @@ void inline Simon64128KeySchedule(uint32_t K[], uint32_t rk[])
     }
 }
 
-void inline Simon64128Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
+static inline void Simon64128Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
 {
     uint32_t i;
     Ct[1] = Pt[1];
@@ -739,6 +1066,8 @@ void inline Simon64128Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
         R32x2(Ct[1], Ct[0], rk[i++], rk[i++]);
 }
 
+#define SIMON64128_KEY_ROUNDS 44
+
 /**
  * For every block:
  * 1. Concat/xor/add nonce  with counter (random nonce)
@@ -746,19 +1075,9 @@ void inline Simon64128Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
  * 3. XOR between encrypted nonce and plain
  * 4. Increment counter
  */
-MAVLINK_HELPER void Simon64128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+MAVLINK_HELPER void Simon64128CTR(uint8_t *nonce, uint32_t rk[], uint8_t *plaintext, int length)
 {
-
     const int BLOCK_SIZE = 8;
-    const int KEY_LEN = 16;
-    const int KEY = 4;
-    const int KEY_ROUND = 44;
-
-    uint32_t K[KEY];
-    uint32_t rk[KEY_ROUND];
-
-    BytesToWords32(key, K, KEY_LEN);
-    Simon64128KeySchedule(K, rk);
 
     int block = 0;
     int last_block;
@@ -807,10 +1126,32 @@ MAVLINK_HELPER void Simon64128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext,
     xored(ct, &plaintext[block], length - block);
 }
 
+/**
+ * Expand a key into the round keys Simon64128CTR() takes
+ */
+MAVLINK_HELPER void Simon64128ExpandKey(uint8_t *key, uint32_t rk[SIMON64128_KEY_ROUNDS])
+{
+    const int KEY_LEN = 16;
+    const int KEY = 4;
+
+    uint32_t K[KEY];
+
+    BytesToWords32(key, K, KEY_LEN);
+    Simon64128KeySchedule(K, rk);
+}
+
+MAVLINK_HELPER void Simon64128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+{
+    uint32_t rk[SIMON64128_KEY_ROUNDS];
+
+    Simon64128ExpandKey(key, rk);
+    Simon64128CTR(nonce, rk, plaintext, length);
+}
+
 /***************************************************************************
  *                              SIMON128128                                *
  ***************************************************************************/
-void inline Simon128128KeySchedule(uint64_t K[], uint64_t rk[])
+static inline void Simon128128KeySchedule(uint64_t K[], uint64_t rk[])
 {
     uint64_t i, B = K[1], A = K[0];
     uint64_t c = 0xfffffffffffffffcLL, z = 0x7369f885192c0ef5LL;
@@ -831,7 +1172,7 @@ void inline Simon128128KeySchedule(uint64_t K[], uint64_t rk[])
     rk[67] = B;
 }
 
-void inline Simon128128Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
+static inline void Simon128128Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
 {
     uint64_t i;
     Ct[0] = Pt[0];
@@ -840,6 +1181,8 @@ void inline Simon128128Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
         R64x2(Ct[1], Ct[0], rk[i], rk[i + 1]);
 }
 
+#define SIMON128128_KEY_ROUNDS 68
+
 /**
  * For every block:
  * 1. Concat/xor/add nonce  with counter (random nonce)
@@ -847,19 +1190,16 @@ void inline Simon128128Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
  * 3. XOR between encrypted nonce and plain
  * 4. Increment counter
  */
-MAVLINK_HELPER void Simon128128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+MAVLINK_HELPER void Simon128128CTR(uint8_t *nonce, uint64_t rk[], uint8_t *plaintext, int length)
 {
-
     const int BLOCK_SIZE = 16;
-    const int KEY_LEN = 16;
-    const int KEY = 2;
-    const int KEY_ROUND = 68;
 
-    uint64_t K[KEY];
-    uint64_t rk[KEY_ROUND];
-
-    BytesToWords64(key, K, KEY_LEN);
-    Simon128128KeySchedule(K, rk);
+#ifdef MAVLINK_CTR_SIMD
+    if (length > BLOCK_SIZE && _ctr128_simd(1, nonce, rk, SIMON128128_KEY_ROUNDS, plaintext, length))
+    {
+        return;
+    }
+#endif
 
     int block = 0;
     int last_block;
@@ -907,10 +1247,32 @@ MAVLINK_HELPER void Simon128128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext
     //STEP3
     xored(ct, &plaintext[block], length - block);
 }
+
+/**
+ * Expand a key into the round keys Simon128128CTR() takes
+ */
+MAVLINK_HELPER void Simon128128ExpandKey(uint8_t *key, uint64_t rk[SIMON128128_KEY_ROUNDS])
+{
+    const int KEY_LEN = 16;
+    const int KEY = 2;
+
+    uint64_t K[KEY];
+
+    BytesToWords64(key, K, KEY_LEN);
+    Simon128128KeySchedule(K, rk);
+}
+
+MAVLINK_HELPER void Simon128128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+{
+    uint64_t rk[SIMON128128_KEY_ROUNDS];
+
+    Simon128128ExpandKey(key, rk);
+    Simon128128CTR(nonce, rk, plaintext, length);
+}
 /***************************************************************************
  *                              SIMON128192                                *
  ***************************************************************************/
-void inline SimonKey128192Schedule(uint64_t K[], uint64_t rk[])
+static inline void SimonKey128192Schedule(uint64_t K[], uint64_t rk[])
 {
     uint64_t i, C = K[2], B = K[1], A = K[0];
     uint64_t c = 0xfffffffffffffffcLL, z = 0xfc2ce51207a635dbLL;
@@ -936,7 +1298,7 @@ void inline SimonKey128192Schedule(uint64_t K[], uint64_t rk[])
     rk[67] = B;
     rk[68] = C;
 }
-void inline Simon128192Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
+static inline void Simon128192Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
 {
     uint64_t i, t;
     Ct[0] = Pt[0];
@@ -948,6 +1310,8 @@ void inline Simon128192Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
     Ct[0] = t;
 }
 
+#define SIMON128192_KEY_ROUNDS 69
+
 /**
  * For every block:
  * 1. Concat/xor/add nonce  with counter (random nonce)
@@ -955,19 +1319,16 @@ void inline Simon128192Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
  * 3. XOR between encrypted nonce and plain
  * 4. Increment counter
  */
-MAVLINK_HELPER void Simon128192(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+MAVLINK_HELPER void Simon128192CTR(uint8_t *nonce, uint64_t rk[], uint8_t *plaintext, int length)
 {
-
     const int BLOCK_SIZE = 16;
-    const int KEY_LEN = 24;
-    const int KEY = 3;
-    const int KEY_ROUND = 69;
-
-    uint64_t K[KEY];
-    uint64_t rk[KEY_ROUND];
 
-    BytesToWords64(key, K, KEY_LEN);
-    SimonKey128192Schedule(K, rk);
+#ifdef MAVLINK_CTR_SIMD
+    if (length > BLOCK_SIZE && _ctr128_simd(1, nonce, rk, SIMON128192_KEY_ROUNDS, plaintext, length))
+    {
+        return;
+    }
+#endif
 
     int block = 0;
     int last_block;
@@ -1015,10 +1376,32 @@ MAVLINK_HELPER void Simon128192(uint8_t *nonce, uint8_t *key, uint8_t *plaintext
     //STEP3
     xored(ct, &plaintext[block], length - block);
 }
+
+/**
+ * Expand a key into the round keys Simon128192CTR() takes
+ */
+MAVLINK_HELPER void Simon128192ExpandKey(uint8_t *key, uint64_t rk[SIMON128192_KEY_ROUNDS])
+{
+    const int KEY_LEN = 24;
+    const int KEY = 3;
+
+    uint64_t K[KEY];
+
+    BytesToWords64(key, K, KEY_LEN);
+    SimonKey128192Schedule(K, rk);
+}
+
+MAVLINK_HELPER void Simon128192(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+{
+    uint64_t rk[SIMON128192_KEY_ROUNDS];
+
+    Simon128192ExpandKey(key, rk);
+    Simon128192CTR(nonce, rk, plaintext, length);
+}
 /***************************************************************************
  *                              SIMON128256                                *
  ***************************************************************************/
-void inline Simon128256KeySchedule(uint64_t K[], uint64_t rk[])
+static inline void Simon128256KeySchedule(uint64_t K[], uint64_t rk[])
 {
     uint64_t i, D = K[3], C = K[2], B = K[1], A = K[0];
     uint64_t c = 0xfffffffffffffffcLL, z = 0xfdc94c3a046d678bLL;
@@ -1051,7 +1434,7 @@ void inline Simon128256KeySchedule(uint64_t K[], uint64_t rk[])
     rk[71] = D;
 }
 
-void inline Simon128256Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
+static inline void Simon128256Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
 {
     uint64_t i;
     Ct[0] = Pt[0];
@@ -1060,6 +1443,8 @@ void inline Simon128256Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
         R64x2(Ct[1], Ct[0], rk[i], rk[i + 1]);
 }
 
+#define SIMON128256_KEY_ROUNDS 72
+
 /**
  * For every block:
  * 1. Concat/xor/add nonce  with counter (random nonce)
@@ -1067,19 +1452,16 @@ void inline Simon128256Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
  * 3. XOR between encrypted nonce and plain
  * 4. Increment counter
  */
-MAVLINK_HELPER void Simon128256(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+MAVLINK_HELPER void Simon128256CTR(uint8_t *nonce, uint64_t rk[], uint8_t *plaintext, int length)
 {
-
     const int BLOCK_SIZE = 16;
-    const int KEY_LEN = 32;
-    const int KEY = 4;
-    const int KEY_ROUND = 72;
 
-    uint64_t K[KEY];
-    uint64_t rk[KEY_ROUND];
-
-    BytesToWords64(key, K, KEY_LEN);
-    Simon128256KeySchedule(K, rk);
+#ifdef MAVLINK_CTR_SIMD
+    if (length > BLOCK_SIZE && _ctr128_simd(1, nonce, rk, SIMON128256_KEY_ROUNDS, plaintext, length))
+    {
+        return;
+    }
+#endif
 
     int block = 0;
     int last_block;
@@ -1127,10 +1509,32 @@ MAVLINK_HELPER void Simon128256(uint8_t *nonce, uint8_t *key, uint8_t *plaintext
     //STEP3
     xored(ct, &plaintext[block], length - block);
 }
+
+/**
+ * Expand a key into the round keys Simon128256CTR() takes
+ */
+MAVLINK_HELPER void Simon128256ExpandKey(uint8_t *key, uint64_t rk[SIMON128256_KEY_ROUNDS])
+{
+    const int KEY_LEN = 32;
+    const int KEY = 4;
+
+    uint64_t K[KEY];
+
+    BytesToWords64(key, K, KEY_LEN);
+    Simon128256KeySchedule(K, rk);
+}
+
+MAVLINK_HELPER void Simon128256(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+{
+    uint64_t rk[SIMON128256_KEY_ROUNDS];
+
+    Simon128256ExpandKey(key, rk);
+    Simon128256CTR(nonce, rk, plaintext, length);
+}
 /***************************************************************************
  *                              SPECK6496                                  *
  ***************************************************************************/
-void inline Speck6496KeySchedule(uint32_t K[], uint32_t rk[])
+static inline void Speck6496KeySchedule(uint32_t K[], uint32_t rk[])
 {
     uint32_t i, C = K[2], B = K[1], A = K[0];
     for (i = 0; i < 26;)
@@ -1141,7 +1545,7 @@ void inline Speck6496KeySchedule(uint32_t K[], uint32_t rk[])
         ER32(C, A, i++);
     }
 }
-void inline Speck6496Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
+static inline void Speck6496Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
 {
     uint32_t i;
     Ct[0] = Pt[0];
@@ -1150,6 +1554,8 @@ void inline Speck6496Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
         ER32(Ct[1], Ct[0], rk[i++]);
 }
 
+#define SPECK6496_KEY_ROUNDS 26
+
 /**
  * For every block:
  * 1. Concat/xor/add nonce  with counter (random nonce)
@@ -1157,19 +1563,9 @@ void inline Speck6496Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
  * 3. XOR between encrypted nonce and plain
  * 4. Increment counter
  */
-MAVLINK_HELPER void Speck6496(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+MAVLINK_HELPER void Speck6496CTR(uint8_t *nonce, uint32_t rk[], uint8_t *plaintext, int length)
 {
-
     const int BLOCK_SIZE = 8;
-    const int KEY_LEN = 12;
-    const int KEY = 3;
-    const int KEY_ROUND = 26;
-
-    uint32_t K[KEY];
-    uint32_t rk[KEY_ROUND];
-
-    BytesToWords32(key, K, KEY_LEN);
-    Speck6496KeySchedule(K, rk);
 
     int block = 0;
     int last_block;
@@ -1217,10 +1613,32 @@ MAVLINK_HELPER void Speck6496(uint8_t *nonce, uint8_t *key, uint8_t *plaintext,
     //STEP3
     xored(ct, &plaintext[block], length - block);
 }
+
+/**
+ * Expand a key into the round keys Speck6496CTR() takes
+ */
+MAVLINK_HELPER void Speck6496ExpandKey(uint8_t *key, uint32_t rk[SPECK6496_KEY_ROUNDS])
+{
+    const int KEY_LEN = 12;
+    const int KEY = 3;
+
+    uint32_t K[KEY];
+
+    BytesToWords32(key, K, KEY_LEN);
+    Speck6496KeySchedule(K, rk);
+}
+
+MAVLINK_HELPER void Speck6496(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+{
+    uint32_t rk[SPECK6496_KEY_ROUNDS];
+
+    Speck6496ExpandKey(key, rk);
+    Speck6496CTR(nonce, rk, plaintext, length);
+}
 /***************************************************************************
  *                              SPECK64128                                 *
  ***************************************************************************/
-void inline Speck64128KeySchedule(uint32_t K[], uint32_t rk[])
+static inline void Speck64128KeySchedule(uint32_t K[], uint32_t rk[])
 {
     uint32_t i, D = K[3], C = K[2], B = K[1], A = K[0];
     for (i = 0; i < 27;)
@@ -1234,7 +1652,7 @@ void inline Speck64128KeySchedule(uint32_t K[], uint32_t rk[])
     }
 }
 
-void inline Speck64128Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
+static inline void Speck64128Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
 {
     uint32_t i;
     Ct[0] = Pt[0];
@@ -1243,6 +1661,8 @@ void inline Speck64128Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
         ER32(Ct[1], Ct[0], rk[i++]);
 }
 
+#define SPECK64128_KEY_ROUNDS 27
+
 /**
  * For every block:
  * 1. Concat/xor/add nonce  with counter (random nonce)
@@ -1250,18 +1670,9 @@ void inline Speck64128Encrypt(uint32_t Pt[], uint32_t Ct[], uint32_t rk[])
  * 3. XOR between encrypted nonce and plain
  * 4. Increment counter
  */
-MAVLINK_HELPER void Speck64128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+MAVLINK_HELPER void Speck64128CTR(uint8_t *nonce, uint32_t rk[], uint8_t *plaintext, int length)
 {
     int BLOCK_SIZE = 8;
-    int KEY_LEN = 16;
-    int KEY = 4;
-    int KEY_ROUND = 27;
-
-    uint32_t K[KEY];
-    uint32_t rk[KEY_ROUND];
-
-    BytesToWords32(key, K, KEY_LEN);
-    Speck64128KeySchedule(K, rk);
 
     int block = 0;
     int last_block;
@@ -1310,10 +1721,32 @@ MAVLINK_HELPER void Speck64128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext,
     xored(ct, &plaintext[block], length - block);
 }
 
+/**
+ * Expand a key into the round keys Speck64128CTR() takes
+ */
+MAVLINK_HELPER void Speck64128ExpandKey(uint8_t *key, uint32_t rk[SPECK64128_KEY_ROUNDS])
+{
+    int KEY_LEN = 16;
+    int KEY = 4;
+
+    uint32_t K[KEY];
+
+    BytesToWords32(key, K, KEY_LEN);
+    Speck64128KeySchedule(K, rk);
+}
+
+MAVLINK_HELPER void Speck64128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+{
+    uint32_t rk[SPECK64128_KEY_ROUNDS];
+
+    Speck64128ExpandKey(key, rk);
+    Speck64128CTR(nonce, rk, plaintext, length);
+}
+
 /***************************************************************************
  *                              SPECK128128                                *
  ***************************************************************************/
-void inline Speck128128KeySchedule(uint64_t K[], uint64_t rk[])
+static inline void Speck128128KeySchedule(uint64_t K[], uint64_t rk[])
 {
     uint64_t i, B = K[1], A = K[0];
     for (i = 0; i < 31;)
@@ -1323,7 +1756,7 @@ void inline Speck128128KeySchedule(uint64_t K[], uint64_t rk[])
     }
     rk[i] = A;
 }
-void inline Speck128128Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
+static inline void Speck128128Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
 {
     uint64_t i;
     Ct[0] = Pt[0];
@@ -1332,6 +1765,8 @@ void inline Speck128128Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
         ER64(Ct[1], Ct[0], rk[i++]);
 }
 
+#define SPECK128128_KEY_ROUNDS 32
+
 /**
  * For every block:
  * 1. Concat/xor/add nonce  with counter (random nonce)
@@ -1339,19 +1774,16 @@ void inline Speck128128Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
  * 3. XOR between encrypted nonce and plain
  * 4. Increment counter
  */
-MAVLINK_HELPER void Speck128128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+MAVLINK_HELPER void Speck128128CTR(uint8_t *nonce, uint64_t rk[], uint8_t *plaintext, int length)
 {
-
     const int BLOCK_SIZE = 16;
-    const int KEY_LEN = 16;
-    const int KEY = 2;
-    const int KEY_ROUND = 32;
-
-    uint64_t K[KEY];
-    uint64_t rk[KEY_ROUND];
 
-    BytesToWords64(key, K, KEY_LEN);
-    Speck128128KeySchedule(K, rk);
+#ifdef MAVLINK_CTR_SIMD
+    if (length > BLOCK_SIZE && _ctr128_simd(0, nonce, rk, SPECK128128_KEY_ROUNDS, plaintext, length))
+    {
+        return;
+    }
+#endif
 
     int block = 0;
     int last_block;
@@ -1400,10 +1832,32 @@ MAVLINK_HELPER void Speck128128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext
     xored(ct, &plaintext[block], length - block);
 }
 
+/**
+ * Expand a key into the round keys Speck128128CTR() takes
+ */
+MAVLINK_HELPER void Speck128128ExpandKey(uint8_t *key, uint64_t rk[SPECK128128_KEY_ROUNDS])
+{
+    const int KEY_LEN = 16;
+    const int KEY = 2;
+
+    uint64_t K[KEY];
+
+    BytesToWords64(key, K, KEY_LEN);
+    Speck128128KeySchedule(K, rk);
+}
+
+MAVLINK_HELPER void Speck128128(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+{
+    uint64_t rk[SPECK128128_KEY_ROUNDS];
+
+    Speck128128ExpandKey(key, rk);
+    Speck128128CTR(nonce, rk, plaintext, length);
+}
+
 /***************************************************************************
  *                              SPECK128256                                *
  ***************************************************************************/
-void inline Speck128256KeySchedule(uint64_t K[], uint64_t rk[])
+static inline void Speck128256KeySchedule(uint64_t K[], uint64_t rk[])
 {
     uint64_t i, D = K[3], C = K[2], B = K[1], A = K[0];
     for (i = 0; i < 33;)
@@ -1418,7 +1872,7 @@ void inline Speck128256KeySchedule(uint64_t K[], uint64_t rk[])
     rk[i] = A;
 }
 
-void inline Speck128256Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
+static inline void Speck128256Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
 {
     uint64_t i;
     Ct[0] = Pt[0];
@@ -1429,6 +1883,8 @@ void inline Speck128256Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
     }
 }
 
+#define SPECK128256_KEY_ROUNDS 34
+
 /**
  * For every block:
  * 1. Concat/xor/add nonce  with counter (random nonce)
@@ -1436,19 +1892,16 @@ void inline Speck128256Encrypt(uint64_t Pt[], uint64_t Ct[], uint64_t rk[])
  * 3. XOR between encrypted nonce and plain
  * 4. Increment counter
  */
-MAVLINK_HELPER void Speck128256(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+MAVLINK_HELPER void Speck128256CTR(uint8_t *nonce, uint64_t rk[], uint8_t *plaintext, int length)
 {
-
     const int BLOCK_SIZE = 16;
-    const int KEY_LEN = 32;
-    const int KEY = 4;
-    const int KEY_ROUND = 34;
 
-    uint64_t K[KEY];
-    uint64_t rk[KEY_ROUND];
-
-    BytesToWords64(key, K, KEY_LEN);
-    Speck128256KeySchedule(K, rk);
+#ifdef MAVLINK_CTR_SIMD
+    if (length > BLOCK_SIZE && _ctr128_simd(0, nonce, rk, SPECK128256_KEY_ROUNDS, plaintext, length))
+    {
+        return;
+    }
+#endif
 
     int block = 0;
     int last_block;
@@ -1496,5 +1949,27 @@ MAVLINK_HELPER void Speck128256(uint8_t *nonce, uint8_t *key, uint8_t *plaintext
     //STEP3
     xored(ct, &plaintext[block], length - block);
 }
+
+/**
+ * Expand a key into the round keys Speck128256CTR() takes
+ */
+MAVLINK_HELPER void Speck128256ExpandKey(uint8_t *key, uint64_t rk[SPECK128256_KEY_ROUNDS])
+{
+    const int KEY_LEN = 32;
+    const int KEY = 4;
+
+    uint64_t K[KEY];
+
+    BytesToWords64(key, K, KEY_LEN);
+    Speck128256KeySchedule(K, rk);
+}
+
+MAVLINK_HELPER void Speck128256(uint8_t *nonce, uint8_t *key, uint8_t *plaintext, int length)
+{
+    uint64_t rk[SPECK128256_KEY_ROUNDS];
+
+    Speck128256ExpandKey(key, rk);
+    Speck128256CTR(nonce, rk, plaintext, length);
+}
 #endif
 #endif
@@ -0,0 +1,308 @@
+#pragma once
+
+/*
+  runtime registry of parser channels, for processes that terminate more
+  links than MAVLINK_COMM_NUM_BUFFERS.
+
+  Channels are opened and closed at runtime and are named by a
+  mavlink_channel_handle_t. Handles below MAVLINK_COMM_NUM_BUFFERS are the
+  classic channels and use the storage behind mavlink_get_channel_status()
+  and mavlink_get_channel_buffer(), so code that still uses the uint8_t
+  chan API sees the same parser state. Higher handles are allocated on
+  demand in fixed size chunks, so a handle is found with one shift and
+  one mask, and a channel never moves once it has been opened.
+
+  The parser state (status and rx buffer) that is touched for every byte
+  is kept apart from the rarely used bookkeeping, so scanning many links
+  only pulls the parser state into the cache.
+
+  Enable with MAVLINK_USE_CHANNEL_REGISTRY. The allocator can be replaced
+  by defining MAVLINK_CHANNEL_MALLOC, MAVLINK_CHANNEL_REALLOC and
+  MAVLINK_CHANNEL_FREE.
+ */
+
+#ifdef MAVLINK_USE_CHANNEL_REGISTRY
+#define MAVLINK_HAVE_CHANNEL_REGISTRY
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef MAVLINK_CHANNEL_MALLOC
+#define MAVLINK_CHANNEL_MALLOC(size) malloc(size)
+#define MAVLINK_CHANNEL_REALLOC(ptr, size) realloc(ptr, size)
+#define MAVLINK_CHANNEL_FREE(ptr) free(ptr)
+#endif
+
+// log2 of the number of channels allocated at a time
+#ifndef MAVLINK_CHANNEL_CHUNK_BITS
+#define MAVLINK_CHANNEL_CHUNK_BITS 6
+#endif
+#define MAVLINK_CHANNEL_CHUNK_SIZE (1U << MAVLINK_CHANNEL_CHUNK_BITS)
+
+#define MAVLINK_CHANNEL_HANDLE_INVALID 0xFFFFFFFFU
+
+#ifdef MAVLINK_USE_CXX_NAMESPACE
+namespace mavlink
+{
+#endif
+
+	typedef uint32_t mavlink_channel_handle_t;
+
+	// parser state, touched for every received byte
+	typedef struct __mavlink_channel_hot
+	{
+		mavlink_status_t status;
+		mavlink_message_t rxmsg;
+	} mavlink_channel_hot_t;
+
+	// bookkeeping, touched on open and close
+	typedef struct __mavlink_channel_cold
+	{
+		void *user_data;
+		uint32_t next_free; // next closed channel, when this one is closed
+		uint8_t in_use;
+	} mavlink_channel_cold_t;
+
+	typedef struct __mavlink_channel_registry
+	{
+		mavlink_channel_hot_t **hot;   // chunk directory of parser state
+		mavlink_channel_cold_t **cold; // chunk directory of bookkeeping
+		uint32_t num_chunks;           // chunks allocated
+		uint32_t dir_size;             // capacity of the chunk directories
+		uint32_t num_slots;            // slots ever handed out
+		uint32_t free_head;            // most recently closed slot, or MAVLINK_CHANNEL_HANDLE_INVALID
+		uint32_t count;                // channels open, not counting the classic ones
+	} mavlink_channel_registry_t;
+
+	/**
+ * @brief Set up an empty registry
+ */
+	MAVLINK_HELPER void mavlink_channel_registry_init(mavlink_channel_registry_t *reg)
+	{
+		memset(reg, 0, sizeof(*reg));
+		reg->free_head = MAVLINK_CHANNEL_HANDLE_INVALID;
+	}
+
+	/**
+ * @brief Free all memory of a registry, every handle above the classic channels becomes invalid
+ */
+	MAVLINK_HELPER void mavlink_channel_registry_free(mavlink_channel_registry_t *reg)
+	{
+		uint32_t i;
+		for (i = 0; i < reg->num_chunks; i++)
+		{
+			MAVLINK_CHANNEL_FREE(reg->hot[i]);
+			MAVLINK_CHANNEL_FREE(reg->cold[i]);
+		}
+		MAVLINK_CHANNEL_FREE(reg->hot);
+		MAVLINK_CHANNEL_FREE(reg->cold);
+		mavlink_channel_registry_init(reg);
+	}
+
+	/**
+ * @brief Add one chunk of slots
+ *
+ * @return false if out of memory
+ */
+	MAVLINK_HELPER bool _mav_channel_registry_grow(mavlink_channel_registry_t *reg)
+	{
+		mavlink_channel_hot_t *hot;
+		mavlink_channel_cold_t *cold;
+		if (reg->num_chunks == reg->dir_size)
+		{
+			uint32_t dir_size = reg->dir_size ? reg->dir_size * 2 : 4;
+			mavlink_channel_hot_t **hot_dir;
+			mavlink_channel_cold_t **cold_dir;
+			hot_dir = (mavlink_channel_hot_t **)MAVLINK_CHANNEL_REALLOC(reg->hot, dir_size * sizeof(*hot_dir));
+			if (hot_dir == NULL)
+			{
+				return false;
+			}
+			reg->hot = hot_dir;
+			cold_dir = (mavlink_channel_cold_t **)MAVLINK_CHANNEL_REALLOC(reg->cold, dir_size * sizeof(*cold_dir));
+			if (cold_dir == NULL)
+			{
+				return false;
+			}
+			reg->cold = cold_dir;
+			reg->dir_size = dir_size;
+		}
+		hot = (mavlink_channel_hot_t *)MAVLINK_CHANNEL_MALLOC(MAVLINK_CHANNEL_CHUNK_SIZE * sizeof(*hot));
+		cold = (mavlink_channel_cold_t *)MAVLINK_CHANNEL_MALLOC(MAVLINK_CHANNEL_CHUNK_SIZE * sizeof(*cold));
+		if (hot == NULL || cold == NULL)
+		{
+			MAVLINK_CHANNEL_FREE(hot);
+			MAVLINK_CHANNEL_FREE(cold);
+			return false;
+		}
+		memset(cold, 0, MAVLINK_CHANNEL_CHUNK_SIZE * sizeof(*cold));
+		reg->hot[reg->num_chunks] = hot;
+		reg->cold[reg->num_chunks] = cold;
+		reg->num_chunks++;
+		return true;
+	}
+
+	/**
+ * @brief Parser state of a registry slot
+ */
+	MAVLINK_HELPER mavlink_channel_hot_t *_mav_channel_hot(const mavlink_channel_registry_t *reg, uint32_t slot)
+	{
+		return &reg->hot[slot >> MAVLINK_CHANNEL_CHUNK_BITS][slot & (MAVLINK_CHANNEL_CHUNK_SIZE - 1)];
+	}
+
+	/**
+ * @brief Bookkeeping of a registry slot
+ */
+	MAVLINK_HELPER mavlink_channel_cold_t *_mav_channel_cold(const mavlink_channel_registry_t *reg, uint32_t slot)
+	{
+		return &reg->cold[slot >> MAVLINK_CHANNEL_CHUNK_BITS][slot & (MAVLINK_CHANNEL_CHUNK_SIZE - 1)];
+	}
+
+	/**
+ * @brief Open a new channel with an idle parser
+ *
+ * Closed channels are reused before new memory is allocated.
+ *
+ * @return handle of the channel, MAVLINK_CHANNEL_HANDLE_INVALID if out of memory
+ */
+	MAVLINK_HELPER mavlink_channel_handle_t mavlink_channel_open(mavlink_channel_registry_t *reg, void *user_data)
+	{
+		uint32_t slot;
+		mavlink_channel_hot_t *hot;
+		mavlink_channel_cold_t *cold;
+		if (reg->free_head != MAVLINK_CHANNEL_HANDLE_INVALID)
+		{
+			slot = reg->free_head;
+			reg->free_head = _mav_channel_cold(reg, slot)->next_free;
+		}
+		else
+		{
+			if (reg->num_slots >= MAVLINK_CHANNEL_HANDLE_INVALID - MAVLINK_COMM_NUM_BUFFERS)
+			{
+				return MAVLINK_CHANNEL_HANDLE_INVALID;
+			}
+			if ((reg->num_slots >> MAVLINK_CHANNEL_CHUNK_BITS) == reg->num_chunks &&
+				!_mav_channel_registry_grow(reg))
+			{
+				return MAVLINK_CHANNEL_HANDLE_INVALID;
+			}
+			slot = reg->num_slots++;
+		}
+		hot = _mav_channel_hot(reg, slot);
+		cold = _mav_channel_cold(reg, slot);
+		memset(&hot->status, 0, sizeof(hot->status));
+		hot->status.parse_state = MAVLINK_PARSE_STATE_IDLE;
+		cold->user_data = user_data;
+		cold->next_free = MAVLINK_CHANNEL_HANDLE_INVALID;
+		cold->in_use = 1;
+		reg->count++;
+		return slot + MAVLINK_COMM_NUM_BUFFERS;
+	}
+
+	/**
+ * @brief Close a channel opened with mavlink_channel_open()
+ *
+ * The handle may be given out again by a later mavlink_channel_open().
+ * Classic channels below MAVLINK_COMM_NUM_BUFFERS can't be closed.
+ */
+	MAVLINK_HELPER void mavlink_channel_close(mavlink_channel_registry_t *reg, mavlink_channel_handle_t handle)
+	{
+		uint32_t slot = handle - MAVLINK_COMM_NUM_BUFFERS;
+		mavlink_channel_cold_t *cold;
+		if (handle < MAVLINK_COMM_NUM_BUFFERS || slot >= reg->num_slots)
+		{
+			return;
+		}
+		cold = _mav_channel_cold(reg, slot);
+		if (!cold->in_use)
+		{
+			return;
+		}
+		cold->in_use = 0;
+		cold->user_data = NULL;
+		cold->next_free = reg->free_head;
+		reg->free_head = slot;
+		reg->count--;
+	}
+
+	/**
+ * @brief Check that a handle names an open channel
+ */
+	MAVLINK_HELPER bool mavlink_channel_valid(const mavlink_channel_registry_t *reg, mavlink_channel_handle_t handle)
+	{
+		uint32_t slot = handle - MAVLINK_COMM_NUM_BUFFERS;
+		if (handle < MAVLINK_COMM_NUM_BUFFERS)
+		{
+			return true;
+		}
+		return slot < reg->num_slots && _mav_channel_cold(reg, slot)->in_use;
+	}
+
+	/**
+ * @brief Get the status of a channel, as mavlink_get_channel_status() does for a classic channel
+ *
+ * The handle must be valid, see mavlink_channel_valid().
+ */
+	MAVLINK_HELPER mavlink_status_t *mavlink_channel_get_status(const mavlink_channel_registry_t *reg, mavlink_channel_handle_t handle)
+	{
+		if (handle < MAVLINK_COMM_NUM_BUFFERS)
+		{
+			return mavlink_get_channel_status((uint8_t)handle);
+		}
+		return &_mav_channel_hot(reg, handle - MAVLINK_COMM_NUM_BUFFERS)->status;
+	}
+
+	/**
+ * @brief Get the parse buffer of a channel, as mavlink_get_channel_buffer() does for a classic channel
+ *
+ * The handle must be valid, see mavlink_channel_valid().
+ */
+	MAVLINK_HELPER mavlink_message_t *mavlink_channel_get_buffer(const mavlink_channel_registry_t *reg, mavlink_channel_handle_t handle)
+	{
+		if (handle < MAVLINK_COMM_NUM_BUFFERS)
+		{
+			return mavlink_get_channel_buffer((uint8_t)handle);
+		}
+		return &_mav_channel_hot(reg, handle - MAVLINK_COMM_NUM_BUFFERS)->rxmsg;
+	}
+
+	/**
+ * @brief Get the user data given to mavlink_channel_open(), NULL for classic channels
+ */
+	MAVLINK_HELPER void *mavlink_channel_get_user_data(const mavlink_channel_registry_t *reg, mavlink_channel_handle_t handle)
+	{
+		if (!mavlink_channel_valid(reg, handle) || handle < MAVLINK_COMM_NUM_BUFFERS)
+		{
+			return NULL;
+		}
+		return _mav_channel_cold(reg, handle - MAVLINK_COMM_NUM_BUFFERS)->user_data;
+	}
+
+	/**
+ * @brief mavlink_frame_char() for a registry channel
+ */
+	MAVLINK_HELPER uint8_t mavlink_channel_frame_char(const mavlink_channel_registry_t *reg, mavlink_channel_handle_t handle,
+													  uint8_t c, mavlink_message_t *r_message, mavlink_status_t *r_mavlink_status)
+	{
+		return mavlink_frame_char_buffer(mavlink_channel_get_buffer(reg, handle),
+										 mavlink_channel_get_status(reg, handle),
+										 c, r_message, r_mavlink_status);
+	}
+
+	/**
+ * @brief mavlink_frame_buffer() for a registry channel
+ */
+	MAVLINK_HELPER size_t mavlink_channel_frame_buffer(const mavlink_channel_registry_t *reg, mavlink_channel_handle_t handle,
+													   const uint8_t *buf, size_t len,
+													   mavlink_frame_callback_t callback, void *arg)
+	{
+		return mavlink_frame_buffer(mavlink_channel_get_buffer(reg, handle),
+									mavlink_channel_get_status(reg, handle),
+									buf, len, callback, arg);
+	}
+
+#ifdef MAVLINK_USE_CXX_NAMESPACE
+} // namespace mavlink
+#endif
+
+#endif // MAVLINK_USE_CHANNEL_REGISTRY
@@ -0,0 +1,256 @@
+#pragma once
+
+/*
+  lock-free rings of finalized wire frames, between the threads that
+  generate messages and the one thread that writes a link.
+
+  A ring belongs to one channel. Producers reserve a slot, finalize the
+  message straight into it and commit it. The MAVLink sequence number
+  is taken from the slot position at reservation time, so the order of
+  the sequence numbers is the order the writer sees the frames in, even
+  when producers finish out of order. The writer hands out frames in
+  slot order and keeps status->current_tx_seq up to date.
+
+  mavlink_frame_ring_reserve() may be called from any number of threads
+  at once. mavlink_frame_ring_reserve_spsc() is a cheaper variant for a
+  ring with a single producer. There must only be one consumer.
+
+  Each slot carries a turn counter as in D. Vyukov's bounded queue: a
+  producer may fill a slot when its turn equals the reserved position,
+  and the consumer may take it when the turn is one past that.
+
+  Signing timestamps are reserved in slot order as well, receivers drop
+  a signed frame whose timestamp is not newer than the previous one.
+  A producer that has won a position waits for the producer of the
+  position before it to take its timestamp, which is only the few
+  instructions between winning the position and taking the timestamp.
+  Hashing and signing then run without waiting on anyone. A producer
+  that is preempted inside that window holds the others up, so the wait
+  gives the CPU away through MAVLINK_FRAME_RING_WAIT(). Update the
+  signing timestamp of a channel with a ring through
+  mavlink_signing_timestamp_advance() when it is enabled, or only from
+  a producer thread.
+
+  Enable with MAVLINK_USE_FRAME_RING. Needs the GCC/clang __atomic builtins.
+ */
+
+#ifdef MAVLINK_USE_FRAME_RING
+#define MAVLINK_HAVE_FRAME_RING
+
+#include <string.h>
+
+#ifndef MAVLINK_FRAME_RING_CACHE_LINE
+#define MAVLINK_FRAME_RING_CACHE_LINE 64
+#endif
+
+#ifndef MAVLINK_FRAME_RING_WAIT
+#include <sched.h>
+#define MAVLINK_FRAME_RING_WAIT() sched_yield()
+#endif
+
+#ifdef MAVLINK_USE_CXX_NAMESPACE
+namespace mavlink
+{
+#endif
+
+	typedef struct __mavlink_frame_slot
+	{
+		uint32_t turn;                        // position this slot is at, see above
+		uint16_t len;                         // bytes in data
+		uint8_t seq;                          // MAVLink sequence number of the frame
+		uint64_t timestamp;                   // signing timestamp of the frame
+		uint8_t data[MAVLINK_MAX_PACKET_LEN]; // the frame as it goes on the wire
+	} mavlink_frame_slot_t;
+
+	typedef struct __mavlink_frame_ring
+	{
+		mavlink_frame_slot_t *slots;
+		uint32_t mask;            // number of slots - 1
+		mavlink_status_t *status; // channel the frames are finalized for
+		uint8_t seq_base;         // current_tx_seq when the ring was set up
+		uint8_t _pad0[MAVLINK_FRAME_RING_CACHE_LINE];
+		uint32_t head; // next position to reserve, written by producers
+		uint8_t _pad1[MAVLINK_FRAME_RING_CACHE_LINE];
+		uint32_t ts_turn; // position allowed to take the next signing timestamp
+		uint8_t _pad2[MAVLINK_FRAME_RING_CACHE_LINE];
+		uint32_t tail; // next position to consume, written by the consumer
+	} mavlink_frame_ring_t;
+
+	/**
+ * @brief Set up a ring over caller owned slots
+ *
+ * @param slots     storage for the frames
+ * @param num_slots number of slots, must be a power of 2
+ * @param status    status of the channel the frames are for. Its flags, signing
+ *                  and context are used to finalize frames, and its current_tx_seq
+ *                  numbers the first frame
+ */
+	MAVLINK_HELPER void mavlink_frame_ring_init(mavlink_frame_ring_t *ring, mavlink_frame_slot_t *slots,
+												uint32_t num_slots, mavlink_status_t *status)
+	{
+		uint32_t i;
+		memset(ring, 0, sizeof(*ring));
+		ring->slots = slots;
+		ring->mask = num_slots - 1;
+		ring->status = status;
+		ring->seq_base = status->current_tx_seq;
+		for (i = 0; i < num_slots; i++)
+		{
+			slots[i].turn = i;
+		}
+	}
+
+	/*
+	  take the next signing timestamp of the ring's channel, 0 if it does not sign
+	 */
+	MAVLINK_HELPER uint64_t _mav_frame_ring_timestamp(const mavlink_frame_ring_t *ring)
+	{
+		const mavlink_status_t *status = ring->status;
+		if ((status->flags & MAVLINK_STATUS_FLAG_OUT_MAVLINK1) || status->signing == NULL ||
+			!(status->signing->flags & MAVLINK_SIGNING_FLAG_SIGN_OUTGOING))
+		{
+			return 0;
+		}
+		return __atomic_fetch_add(&status->signing->timestamp, 1, __ATOMIC_RELAXED);
+	}
+
+	/**
+ * @brief Reserve the next slot, safe to call from several producers at once
+ *
+ * @return the slot, or NULL if the ring is full
+ */
+	MAVLINK_HELPER mavlink_frame_slot_t *mavlink_frame_ring_reserve(mavlink_frame_ring_t *ring)
+	{
+		uint32_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		for (;;)
+		{
+			mavlink_frame_slot_t *slot = &ring->slots[pos & ring->mask];
+			int32_t diff = (int32_t)(__atomic_load_n(&slot->turn, __ATOMIC_ACQUIRE) - pos);
+			if (diff == 0)
+			{
+				if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true,
+												__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				{
+					slot->seq = (uint8_t)(ring->seq_base + pos);
+					// take the timestamp after the producer of pos - 1 took its own
+					while (__atomic_load_n(&ring->ts_turn, __ATOMIC_ACQUIRE) != pos)
+					{
+						MAVLINK_FRAME_RING_WAIT();
+					}
+					slot->timestamp = _mav_frame_ring_timestamp(ring);
+					__atomic_store_n(&ring->ts_turn, pos + 1, __ATOMIC_RELEASE);
+					return slot;
+				}
+				// pos now holds the head another producer moved to
+			}
+			else if (diff < 0)
+			{
+				// the consumer has not freed this slot yet
+				return NULL;
+			}
+			else
+			{
+				pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+			}
+		}
+	}
+
+	/**
+ * @brief Reserve the next slot of a ring that only one thread produces into
+ *
+ * @return the slot, or NULL if the ring is full
+ */
+	MAVLINK_HELPER mavlink_frame_slot_t *mavlink_frame_ring_reserve_spsc(mavlink_frame_ring_t *ring)
+	{
+		uint32_t pos = ring->head;
+		mavlink_frame_slot_t *slot = &ring->slots[pos & ring->mask];
+		if (__atomic_load_n(&slot->turn, __ATOMIC_ACQUIRE) != pos)
+		{
+			return NULL;
+		}
+		__atomic_store_n(&ring->head, pos + 1, __ATOMIC_RELAXED);
+		slot->seq = (uint8_t)(ring->seq_base + pos);
+		slot->timestamp = _mav_frame_ring_timestamp(ring);
+		ring->ts_turn = pos + 1;
+		return slot;
+	}
+
+	/**
+ * @brief Finalize a message into a reserved slot
+ *
+ * This is mavlink_finalize_message_buffer() followed by
+ * mavlink_msg_to_send_buffer(), with the sequence number and signing
+ * timestamp of the slot instead of the next ones from the channel status
+ */
+	MAVLINK_HELPER void mavlink_frame_ring_fill(mavlink_frame_ring_t *ring, mavlink_frame_slot_t *slot,
+												mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
+												uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	{
+		mavlink_finalize_message_reserved(msg, system_id, component_id, ring->status, min_length, length, crc_extra,
+										  slot->seq, slot->timestamp);
+		slot->len = mavlink_msg_to_send_buffer(slot->data, msg);
+	}
+
+	/**
+ * @brief Hand a filled slot to the consumer
+ */
+	MAVLINK_HELPER void mavlink_frame_ring_commit(mavlink_frame_slot_t *slot)
+	{
+		__atomic_store_n(&slot->turn, slot->turn + 1, __ATOMIC_RELEASE);
+	}
+
+	/**
+ * @brief Reserve, fill and commit in one go
+ *
+ * @param spsc true if this is the only producer of the ring
+ *
+ * @return false if the ring is full
+ */
+	MAVLINK_HELPER bool mavlink_frame_ring_send(mavlink_frame_ring_t *ring, bool spsc, mavlink_message_t *msg,
+												uint8_t system_id, uint8_t component_id,
+												uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	{
+		mavlink_frame_slot_t *slot = spsc ? mavlink_frame_ring_reserve_spsc(ring) : mavlink_frame_ring_reserve(ring);
+		if (slot == NULL)
+		{
+			return false;
+		}
+		mavlink_frame_ring_fill(ring, slot, msg, system_id, component_id, min_length, length, crc_extra);
+		mavlink_frame_ring_commit(slot);
+		return true;
+	}
+
+	/**
+ * @brief Look at the oldest frame, consumer only
+ *
+ * @return the slot, or NULL if the ring is empty or the oldest slot is
+ *         still being filled
+ */
+	MAVLINK_HELPER const mavlink_frame_slot_t *mavlink_frame_ring_peek(mavlink_frame_ring_t *ring)
+	{
+		uint32_t pos = ring->tail;
+		mavlink_frame_slot_t *slot = &ring->slots[pos & ring->mask];
+		if (__atomic_load_n(&slot->turn, __ATOMIC_ACQUIRE) != pos + 1)
+		{
+			return NULL;
+		}
+		return slot;
+	}
+
+	/**
+ * @brief Release the frame returned by mavlink_frame_ring_peek(), consumer only
+ */
+	MAVLINK_HELPER void mavlink_frame_ring_pop(mavlink_frame_ring_t *ring)
+	{
+		uint32_t pos = ring->tail;
+		mavlink_frame_slot_t *slot = &ring->slots[pos & ring->mask];
+		ring->status->current_tx_seq = (uint8_t)(slot->seq + 1);
+		__atomic_store_n(&ring->tail, pos + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&slot->turn, pos + ring->mask + 1, __ATOMIC_RELEASE);
+	}
+
+#ifdef MAVLINK_USE_CXX_NAMESPACE
+} // namespace mavlink
+#endif
+
+#endif // MAVLINK_USE_FRAME_RING
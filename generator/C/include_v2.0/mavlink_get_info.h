@@ -3,17 +3,74 @@
 #ifdef MAVLINK_USE_MESSAGE_INFO
 #define MAVLINK_HAVE_GET_MESSAGE_INFO
 
+/*
+  return the message_info table, sorted with primary key msgid
+*/
+MAVLINK_HELPER const mavlink_message_info_t *_mav_message_info_table(uint32_t *count)
+{
+	static const mavlink_message_info_t mavlink_message_info[] = MAVLINK_MESSAGE_INFO;
+        *count = sizeof(mavlink_message_info)/sizeof(mavlink_message_info[0]);
+        return mavlink_message_info;
+}
+
+/*
+  FNV-1a hash of the 24 bit seed followed by a message or field name.
+  mavgen_c.py hashes names the same way when it builds the perfect hash
+  tables
+*/
+MAVLINK_HELPER uint32_t _mav_name_hash(uint32_t seed, const char *name)
+{
+        uint32_t h = 0x811c9dc5U;
+        uint8_t i;
+        for (i=0; i<3; i++) {
+            h ^= (uint8_t)(seed >> (i*8));
+            h *= 0x01000193U;
+        }
+        while (*name) {
+            h ^= (uint8_t)*name++;
+            h *= 0x01000193U;
+        }
+        return h;
+}
+
+/*
+  slot of a key in one of the generated perfect hash tables
+*/
+MAVLINK_HELPER uint32_t _mav_hash_slot(uint32_t key, uint32_t mul1, uint32_t mul2,
+                                       uint8_t bucket_bits, uint8_t slot_bits, const uint16_t *disp)
+{
+        uint32_t bucket = (uint32_t)(key * mul1) >> (32 - bucket_bits);
+        uint32_t slot = ((uint32_t)(key * mul2) >> (32 - slot_bits)) + disp[bucket];
+        return slot & ((1U << slot_bits) - 1);
+}
+
 /*
   return the message_info struct for a message
 */
 MAVLINK_HELPER const mavlink_message_info_t *mavlink_get_message_info_by_id(uint32_t msgid)
 {
-	static const mavlink_message_info_t mavlink_message_info[] = MAVLINK_MESSAGE_INFO;
+        uint32_t count;
+        const mavlink_message_info_t *mavlink_message_info = _mav_message_info_table(&count);
+#ifdef MAVLINK_MESSAGE_CRCS_HASH_INDEX
+        /*
+	  MAVLINK_MESSAGE_INFO has the same msgid order as the generated
+	  MAVLINK_MESSAGE_CRCS, so its perfect hash works for both tables
+	*/
+        static const uint16_t hash_disp[] = MAVLINK_MESSAGE_CRCS_HASH_DISP;
+        static const uint16_t hash_index[] = MAVLINK_MESSAGE_CRCS_HASH_INDEX;
+        uint32_t idx = hash_index[_mav_hash_slot(msgid, MAVLINK_MESSAGE_CRCS_HASH_MUL1, MAVLINK_MESSAGE_CRCS_HASH_MUL2,
+                                                 MAVLINK_MESSAGE_CRCS_HASH_BUCKET_BITS, MAVLINK_MESSAGE_CRCS_HASH_SLOT_BITS,
+                                                 hash_disp)];
+        if (idx < count && mavlink_message_info[idx].msgid == msgid) {
+            return &mavlink_message_info[idx];
+        }
+        return NULL;
+#else
         /*
-	  use a bisection search to find the right entry. A perfect hash may be better
+	  use a bisection search to find the right entry.
 	  Note that this assumes the table is sorted with primary key msgid
 	*/
-        uint32_t low=0, high=sizeof(mavlink_message_info)/sizeof(mavlink_message_info[0]);
+        uint32_t low=0, high=count-1;
         while (low < high) {
             uint32_t mid = (low+1+high)/2;
             if (msgid < mavlink_message_info[mid].msgid) {
@@ -31,6 +88,7 @@ MAVLINK_HELPER const mavlink_message_info_t *mavlink_get_message_info_by_id(uint
             return &mavlink_message_info[low];
         }
         return NULL;
+#endif
 }
 
 /*
@@ -46,12 +104,29 @@ MAVLINK_HELPER const mavlink_message_info_t *mavlink_get_message_info(const mavl
 */
 MAVLINK_HELPER const mavlink_message_info_t *mavlink_get_message_info_by_name(const char *name)
 {
+#ifdef MAVLINK_MESSAGE_NAMES_HASH_INDEX
+        /*
+	  one probe in the generated perfect hash of the names, then a
+	  strcmp to reject names that are not in the table
+	*/
+        static const uint16_t hash_disp[] = MAVLINK_MESSAGE_NAMES_HASH_DISP;
+        static const uint16_t hash_index[] = MAVLINK_MESSAGE_NAMES_HASH_INDEX;
+        uint32_t count;
+        const mavlink_message_info_t *mavlink_message_info = _mav_message_info_table(&count);
+        uint32_t idx = hash_index[_mav_hash_slot(_mav_name_hash(0, name), MAVLINK_MESSAGE_NAMES_HASH_MUL1, MAVLINK_MESSAGE_NAMES_HASH_MUL2,
+                                                 MAVLINK_MESSAGE_NAMES_HASH_BUCKET_BITS, MAVLINK_MESSAGE_NAMES_HASH_SLOT_BITS,
+                                                 hash_disp)];
+        if (idx < count && strcmp(mavlink_message_info[idx].name, name) == 0) {
+            return &mavlink_message_info[idx];
+        }
+        return NULL;
+#else
 	static const struct { const char *name; uint32_t msgid; } mavlink_message_names[] = MAVLINK_MESSAGE_NAMES;
         /*
-	  use a bisection search to find the right entry. A perfect hash may be better
+	  use a bisection search to find the right entry.
 	  Note that this assumes the table is sorted with primary key name
 	*/
-        uint32_t low=0, high=sizeof(mavlink_message_names)/sizeof(mavlink_message_names[0]);
+        uint32_t low=0, high=sizeof(mavlink_message_names)/sizeof(mavlink_message_names[0]) - 1;
         while (low < high) {
             uint32_t mid = (low+1+high)/2;
 	    int cmp = strcmp(mavlink_message_names[mid].name, name);
@@ -64,8 +139,116 @@ MAVLINK_HELPER const mavlink_message_info_t *mavlink_get_message_info_by_name(co
                 low = mid;
             }
         }
+        if (strcmp(mavlink_message_names[low].name, name) == 0) {
+            return mavlink_get_message_info_by_id(mavlink_message_names[low].msgid);
+        }
         return NULL;
+#endif
+}
+
+/*
+  return the field_info struct for a field of a message
+*/
+MAVLINK_HELPER const mavlink_field_info_t *mavlink_get_field_info_by_name(const mavlink_message_info_t *info, const char *name)
+{
+#ifdef MAVLINK_MESSAGE_FIELDS_HASH_INDEX
+        /*
+	  the generated hash is keyed on msgid and field name. Each entry
+	  holds the MAVLINK_MESSAGE_INFO index in the upper bits and the
+	  field index in the low 8 bits
+	*/
+        static const uint16_t hash_disp[] = MAVLINK_MESSAGE_FIELDS_HASH_DISP;
+        static const uint32_t hash_index[] = MAVLINK_MESSAGE_FIELDS_HASH_INDEX;
+        uint32_t count;
+        const mavlink_message_info_t *mavlink_message_info = _mav_message_info_table(&count);
+        uint32_t e = hash_index[_mav_hash_slot(_mav_name_hash(info->msgid, name), MAVLINK_MESSAGE_FIELDS_HASH_MUL1, MAVLINK_MESSAGE_FIELDS_HASH_MUL2,
+                                               MAVLINK_MESSAGE_FIELDS_HASH_BUCKET_BITS, MAVLINK_MESSAGE_FIELDS_HASH_SLOT_BITS,
+                                               hash_disp)];
+        uint32_t idx = e >> 8, fidx = e & 0xFF;
+        if (idx < count && mavlink_message_info[idx].msgid == info->msgid &&
+            fidx < info->num_fields && strcmp(info->fields[fidx].name, name) == 0) {
+            return &info->fields[fidx];
+        }
+        return NULL;
+#else
+        unsigned i;
+        for (i=0; i<info->num_fields; i++) {
+            if (strcmp(info->fields[i].name, name) == 0) {
+                return &info->fields[i];
+            }
+        }
+        return NULL;
+#endif
 }
-#endif // MAVLINK_USE_MESSAGE_INFO
 
+/*
+  resolve a message and field name once, so that the field can be read
+  from every received message with mavlink_field_handle_get() without
+  looking up names again. Returns false if either name is unknown
+*/
+MAVLINK_HELPER bool mavlink_field_handle_resolve(mavlink_field_handle_t *handle, const char *msg_name, const char *field_name)
+{
+        handle->info = mavlink_get_message_info_by_name(msg_name);
+        handle->field = handle->info ? mavlink_get_field_info_by_name(handle->info, field_name) : NULL;
+        if (handle->field == NULL) {
+            handle->info = NULL;
+            return false;
+        }
+        return true;
+}
 
+/*
+  read element idx of a resolved field as a double. Returns false if the
+  handle is unresolved, msg is a different message or idx is out of range
+*/
+MAVLINK_HELPER bool mavlink_field_handle_get(const mavlink_field_handle_t *handle, const mavlink_message_t *msg,
+                                             unsigned idx, double *value)
+{
+        static const uint8_t type_size[] = { 1, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8 };
+        const mavlink_field_info_t *f = handle->field;
+        uint8_t ofs;
+        if (handle->info == NULL || handle->info->msgid != msg->msgid ||
+            idx >= (f->array_length ? f->array_length : 1)) {
+            return false;
+        }
+        ofs = (uint8_t)(f->wire_offset + idx * type_size[f->type]);
+        switch (f->type) {
+        case MAVLINK_TYPE_CHAR:
+            *value = _MAV_RETURN_char(msg, ofs);
+            break;
+        case MAVLINK_TYPE_UINT8_T:
+            *value = _MAV_RETURN_uint8_t(msg, ofs);
+            break;
+        case MAVLINK_TYPE_INT8_T:
+            *value = _MAV_RETURN_int8_t(msg, ofs);
+            break;
+        case MAVLINK_TYPE_UINT16_T:
+            *value = _MAV_RETURN_uint16_t(msg, ofs);
+            break;
+        case MAVLINK_TYPE_INT16_T:
+            *value = _MAV_RETURN_int16_t(msg, ofs);
+            break;
+        case MAVLINK_TYPE_UINT32_T:
+            *value = _MAV_RETURN_uint32_t(msg, ofs);
+            break;
+        case MAVLINK_TYPE_INT32_T:
+            *value = _MAV_RETURN_int32_t(msg, ofs);
+            break;
+        case MAVLINK_TYPE_UINT64_T:
+            *value = (double)_MAV_RETURN_uint64_t(msg, ofs);
+            break;
+        case MAVLINK_TYPE_INT64_T:
+            *value = (double)_MAV_RETURN_int64_t(msg, ofs);
+            break;
+        case MAVLINK_TYPE_FLOAT:
+            *value = _MAV_RETURN_float(msg, ofs);
+            break;
+        case MAVLINK_TYPE_DOUBLE:
+            *value = _MAV_RETURN_double(msg, ofs);
+            break;
+        default:
+            return false;
+        }
+        return true;
+}
+#endif // MAVLINK_USE_MESSAGE_INFO
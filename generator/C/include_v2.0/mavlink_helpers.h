@@ -8,6 +8,15 @@
 #include "fourq.h"
 #include "tiger.h"
 #include <time.h>
+#include <stddef.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef MAVLINK_USE_IOVEC
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 #ifndef MAVLINK_HELPER
 #define MAVLINK_HELPER
@@ -23,47 +32,86 @@
 *include Crypto
 */
 #ifdef ENCRYPTION
+// the cipher of each remote key is chosen at run time, see mavlink_get_cipher()
 #include "light_crypto.h"
-#define SPECK128192
-
-#ifdef TEST
-//#define CHACHA20
-//#define RABBIT
-//#define TRIVIUM
-//#define SIMON6496
-//#define SIMON64128
-//#define SIMON128128
-//#define SIMON128192
-//#define SIMON128256
-//#define SPECK6496
-//#define SPECK64128
-//#define SPECK128128
-//#define SPECK128256
-#endif
 #endif
 
 #include "mavlink_sha256.h"
 
-static int readed_cert = 0;
-
 #ifdef MAVLINK_USE_CXX_NAMESPACE
 namespace mavlink
 {
 #endif
 
+#define MAVLINK_HAVE_CONTEXT
+
 /*
- * Internal function to give access to the channel status for each channel
+ * Internal function to give access to the default context, used by all
+ * functions that don't take a context argument
  */
-#ifndef MAVLINK_GET_CHANNEL_STATUS
-	MAVLINK_HELPER mavlink_status_t *mavlink_get_channel_status(uint8_t chan)
+#ifndef MAVLINK_GET_DEFAULT_CONTEXT
+	MAVLINK_HELPER mavlink_context_t *mavlink_get_default_context(void)
 	{
-#ifdef MAVLINK_EXTERNAL_RX_STATUS
-		// No m_mavlink_status array defined in function,
+#ifdef MAVLINK_EXTERNAL_CONTEXT
+		// No m_mavlink_context defined in function,
 		// has to be defined externally
 #else
-		static mavlink_status_t m_mavlink_status[MAVLINK_COMM_NUM_BUFFERS];
+		static mavlink_context_t m_mavlink_context;
+#endif
+		return &m_mavlink_context;
+	}
+#endif
+
+	/**
+ * @brief Set up a context with all channels idle and no keys or certificate
+ */
+	MAVLINK_HELPER void mavlink_context_init(mavlink_context_t *ctx)
+	{
+		uint8_t chan;
+		memset(ctx, 0, sizeof(*ctx));
+		for (chan = 0; chan < MAVLINK_COMM_NUM_BUFFERS; chan++)
+		{
+			ctx->status[chan].context = ctx;
+		}
+	}
+
+	/**
+ * @brief Get the status of a channel of a context
+ */
+	MAVLINK_HELPER mavlink_status_t *mavlink_ctx_get_channel_status(mavlink_context_t *ctx, uint8_t chan)
+	{
+#ifdef MAVLINK_EXTERNAL_RX_STATUS
+		// the default context uses the externally defined m_mavlink_status array
+		if (ctx == mavlink_get_default_context())
+		{
+			return &m_mavlink_status[chan];
+		}
+#endif
+		return &ctx->status[chan];
+	}
+
+	/**
+ * @brief Get the parse buffer of a channel of a context
+ */
+	MAVLINK_HELPER mavlink_message_t *mavlink_ctx_get_channel_buffer(mavlink_context_t *ctx, uint8_t chan)
+	{
+#ifdef MAVLINK_EXTERNAL_RX_BUFFER
+		// the default context uses the externally defined m_mavlink_buffer array
+		if (ctx == mavlink_get_default_context())
+		{
+			return &m_mavlink_buffer[chan];
+		}
 #endif
-		return &m_mavlink_status[chan];
+		return &ctx->buffer[chan];
+	}
+
+/*
+ * Internal function to give access to the channel status for each channel
+ */
+#ifndef MAVLINK_GET_CHANNEL_STATUS
+	MAVLINK_HELPER mavlink_status_t *mavlink_get_channel_status(uint8_t chan)
+	{
+		return mavlink_ctx_get_channel_status(mavlink_get_default_context(), chan);
 	}
 #endif
 
@@ -73,14 +121,7 @@ namespace mavlink
 #ifndef MAVLINK_GET_CHANNEL_BUFFER
 	MAVLINK_HELPER mavlink_message_t *mavlink_get_channel_buffer(uint8_t chan)
 	{
-
-#ifdef MAVLINK_EXTERNAL_RX_BUFFER
-		// No m_mavlink_buffer array defined in function,
-		// has to be defined externally
-#else
-		static mavlink_message_t m_mavlink_buffer[MAVLINK_COMM_NUM_BUFFERS];
-#endif
-		return &m_mavlink_buffer[chan];
+		return mavlink_ctx_get_channel_buffer(mavlink_get_default_context(), chan);
 	}
 #endif // MAVLINK_GET_CHANNEL_BUFFER
 
@@ -95,21 +136,31 @@ namespace mavlink
 	/**
  * @brief Reset the status of a channel.
  */
+	MAVLINK_HELPER void mavlink_ctx_reset_channel_status(mavlink_context_t *ctx, uint8_t chan)
+	{
+		mavlink_status_t *status = mavlink_ctx_get_channel_status(ctx, chan);
+		status->parse_state = MAVLINK_PARSE_STATE_IDLE;
+	}
+
 	MAVLINK_HELPER void mavlink_reset_channel_status(uint8_t chan)
 	{
 		mavlink_status_t *status = mavlink_get_channel_status(chan);
 		status->parse_state = MAVLINK_PARSE_STATE_IDLE;
 	}
 
+	MAVLINK_HELPER mavlink_device_certificate_t *mavlink_ctx_get_device_certificate(mavlink_context_t *ctx)
+	{
+		return &ctx->certificate;
+	}
+
 	MAVLINK_HELPER mavlink_device_certificate_t *mavlink_get_device_certificate()
 	{
-		static mavlink_device_certificate_t mavlink_device_certificate;
-		return &mavlink_device_certificate;
+		return mavlink_ctx_get_device_certificate(mavlink_get_default_context());
 	}
 
-	MAVLINK_HELPER uint8_t mavlink_read_certificate(const char *path_to_certificate)
+	MAVLINK_HELPER uint8_t mavlink_ctx_read_certificate(mavlink_context_t *ctx, const char *path_to_certificate)
 	{
-		if (!readed_cert)
+		if (!ctx->certificate_loaded)
 		{
 			FILE *fptr;
 			fptr = fopen(path_to_certificate, "rb");
@@ -120,9 +171,10 @@ namespace mavlink
 			}
 			else
 			{
-				mavlink_device_certificate_t *certificate = mavlink_get_device_certificate();
-				readed_cert = 1;
+				mavlink_device_certificate_t *certificate = mavlink_ctx_get_device_certificate(ctx);
+				ctx->certificate_loaded = 1;
 				int result = fread(certificate, sizeof(mavlink_device_certificate_t), 1, fptr);
+				fclose(fptr);
 				if (result <= 0)
 				{
 					return 0;
@@ -132,11 +184,17 @@ namespace mavlink
 		return 1;
 	}
 
+	MAVLINK_HELPER uint8_t mavlink_read_certificate(const char *path_to_certificate)
+	{
+		return mavlink_ctx_read_certificate(mavlink_get_default_context(), path_to_certificate);
+	}
+
 	/*
 		Check if certificate is valid
 		date and sign
 	*/
-	MAVLINK_HELPER unsigned int mavlink_check_remote_certificate(float start, float end, uint8_t *remote_certificate, const unsigned char *sign)
+	MAVLINK_HELPER unsigned int mavlink_ctx_check_remote_certificate(mavlink_context_t *ctx, float start, float end,
+																	 uint8_t *remote_certificate, const unsigned char *sign)
 	{
 		time_t now;
 		unsigned int valid = false;
@@ -146,30 +204,265 @@ namespace mavlink
 		if ((int)start <= (int)now && (int)now <= (int)end)
 		{
 
-			mavlink_device_certificate_t *certificate = mavlink_get_device_certificate();
+			mavlink_device_certificate_t *certificate = mavlink_ctx_get_device_certificate(ctx);
 			SchnorrQ_Verify(certificate->public_key_auth, remote_certificate, sizeof(info_t), sign, &valid);
 		}
 		return valid;
 	}
 
-	MAVLINK_HELPER key_status_t *mavlink_get_remote_key(int id)
+	MAVLINK_HELPER unsigned int mavlink_check_remote_certificate(float start, float end, uint8_t *remote_certificate, const unsigned char *sign)
+	{
+		return mavlink_ctx_check_remote_certificate(mavlink_get_default_context(), start, end, remote_certificate, sign);
+	}
+
+	MAVLINK_HELPER key_status_t *mavlink_ctx_get_remote_key(mavlink_context_t *ctx, int id)
 	{
 #ifdef MAVLINK_EXTERNAL_KEYS_STORAGE
-		// No m_mavlink_status array defined in function,
-		// has to be defined externally
+		// the default context uses the externally defined remote_keys array
+		if (ctx == mavlink_get_default_context())
+		{
+			return &remote_keys[id];
+		}
+#endif
+		return &ctx->remote_keys[id];
+	}
+
+	MAVLINK_HELPER key_status_t *mavlink_get_remote_key(int id)
+	{
+		return mavlink_ctx_get_remote_key(mavlink_get_default_context(), id);
+	}
+
+#ifdef ENCRYPTION
+/*
+  state derived from a key is built aside and published with a release
+  store of its flag, readers acquire the flag before using the state.
+  The live copy is only written by the one thread that moved the flag
+  from empty to building, others build their own copy on the stack. A
+  reader never sees a half written schedule
+ */
+#define _MAV_KEY_STATE_EMPTY 0
+#define _MAV_KEY_STATE_READY 1
+#define _MAV_KEY_STATE_BUILDING 2
+#ifdef __GNUC__
+#define _MAV_KEY_FLAG_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define _MAV_KEY_FLAG_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+	static inline bool _mav_key_flag_claim(int *flag)
+	{
+		int expected = _MAV_KEY_STATE_EMPTY;
+		return __atomic_compare_exchange_n(flag, &expected, _MAV_KEY_STATE_BUILDING, false,
+										   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+	}
 #else
+#define _MAV_KEY_FLAG_LOAD(p) (*(p))
+#define _MAV_KEY_FLAG_STORE(p, v) (*(p) = (v))
+	static inline bool _mav_key_flag_claim(int *flag)
+	{
+		if (*flag != _MAV_KEY_STATE_EMPTY)
+		{
+			return false;
+		}
+		*flag = _MAV_KEY_STATE_BUILDING;
+		return true;
+	}
+#endif
+
+	/*
+		round keys of a remote key. The key schedule runs once per key
+		exchange, or on first use for a key that was never exchanged and
+		is still all zero. While another thread publishes them, the
+		schedule is made in scratch
+	*/
+	MAVLINK_HELPER const uint64_t *_mav_remote_key_round_keys(key_status_t *remote_key, uint64_t scratch[SPECK128192_KEY_ROUNDS])
+	{
+		if (_MAV_KEY_FLAG_LOAD(&remote_key->round_keys_set) == _MAV_KEY_STATE_READY)
+		{
+			return remote_key->round_keys;
+		}
+		Speck128192ExpandKey(remote_key->shared_key, scratch);
+		if (_mav_key_flag_claim(&remote_key->round_keys_set))
+		{
+			memcpy(remote_key->round_keys, scratch, SPECK128192_KEY_ROUNDS * sizeof(uint64_t));
+			_MAV_KEY_FLAG_STORE(&remote_key->round_keys_set, _MAV_KEY_STATE_READY);
+		}
+		return scratch;
+	}
+
+	/*
+		Speck128192 in CTR mode with the shared key and IV of the remote key
+	*/
+	MAVLINK_HELPER void _mav_speck128192_init(key_status_t *remote_key)
+	{
+		_MAV_KEY_FLAG_STORE(&remote_key->round_keys_set, _MAV_KEY_STATE_EMPTY);
+	}
+
+	/*
+		the round keys are expanded here, at key exchange, rather than
+		on the first payload
+	*/
+	MAVLINK_HELPER void _mav_speck128192_key_setup(key_status_t *remote_key)
+	{
+		uint64_t round_keys[SPECK128192_KEY_ROUNDS];
+		_mav_speck128192_init(remote_key);
+		_mav_remote_key_round_keys(remote_key, round_keys);
+	}
+
+	MAVLINK_HELPER void _mav_speck128192_xor_stream(key_status_t *remote_key, uint8_t *payload, uint8_t len)
+	{
+		uint64_t scratch[SPECK128192_KEY_ROUNDS];
+		Speck128192CTR(remote_key->iv, (uint64_t *)_mav_remote_key_round_keys(remote_key, scratch), payload, len);
+	}
+
+#ifdef TEST
+	/*
+		the other ciphers of light_crypto.h, with the fixed keys and
+		nonces of their test vectors. Keys shorter than the cipher key
+		are zero padded
+	*/
+	MAVLINK_HELPER void _mav_cipher_no_setup(key_status_t *remote_key)
+	{
+		(void)remote_key;
+	}
+
+	MAVLINK_HELPER void _mav_chacha20_xor_stream(key_status_t *remote_key, uint8_t *payload, uint8_t len)
+	{
+		uint8_t key[] = {
+			0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+			0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
+		uint8_t nonce[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00};
+		uint8_t out[MAVLINK_MAX_PAYLOAD_LEN];
+		(void)remote_key;
+		ChaCha20XOR(key, 1, nonce, payload, out, len);
+		memcpy(payload, out, len);
+	}
+
+	MAVLINK_HELPER void _mav_trivium_xor_stream(key_status_t *remote_key, uint8_t *payload, uint8_t len)
+	{
+		uint8_t key[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99};
+		uint8_t iv[] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x01, 0x23};
+		(void)remote_key;
+		trivium(key, iv, payload, len);
+	}
+
+	MAVLINK_HELPER void _mav_rabbit_xor_stream(key_status_t *remote_key, uint8_t *payload, uint8_t len)
+	{
+		const uint8_t key[] = {0x9f, 0x45, 0xd6, 0x2b, 0x00, 0xb3, 0xc5, 0x82, 0x10, 0x49, 0x2c, 0x95, 0x48, 0xff, 0x81, 0x48};
+		const uint8_t iv[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77};
+		uint8_t out[MAVLINK_MAX_PAYLOAD_LEN];
+		(void)remote_key;
+		rabbit(iv, key, payload, out, len);
+		memcpy(payload, out, len);
+	}
 
-	static key_status_t remote_keys[256];
+#define _MAV_CIPHER_KEY_96 {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b, 0x10, 0x11, 0x12, 0x13}
+#define _MAV_CIPHER_KEY_128 {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f}
+#define _MAV_CIPHER_NONCE_64 {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b}
+#define _MAV_CIPHER_NONCE_128 _MAV_CIPHER_KEY_128
+#define _MAV_CIPHER_XOR_STREAM(name, key_len, key_init, nonce_len, nonce_init)                              \
+	MAVLINK_HELPER void _mav_##name##_xor_stream(key_status_t *remote_key, uint8_t *payload, uint8_t len) \
+	{                                                                                                     \
+		uint8_t k[key_len] = key_init;                                                                    \
+		uint8_t nonce[nonce_len] = nonce_init;                                                            \
+		(void)remote_key;                                                                                 \
+		name(nonce, k, payload, len);                                                                     \
+	}
+
+	_MAV_CIPHER_XOR_STREAM(Simon6496, 12, _MAV_CIPHER_KEY_96, 8, _MAV_CIPHER_NONCE_64)
+	_MAV_CIPHER_XOR_STREAM(Simon64128, 16, _MAV_CIPHER_KEY_128, 8, _MAV_CIPHER_NONCE_64)
+	_MAV_CIPHER_XOR_STREAM(Simon128128, 16, _MAV_CIPHER_KEY_128, 16, _MAV_CIPHER_NONCE_128)
+	_MAV_CIPHER_XOR_STREAM(Simon128192, 24, _MAV_CIPHER_KEY_128, 16, _MAV_CIPHER_NONCE_128)
+	_MAV_CIPHER_XOR_STREAM(Simon128256, 32, _MAV_CIPHER_KEY_128, 16, _MAV_CIPHER_NONCE_128)
+	_MAV_CIPHER_XOR_STREAM(Speck6496, 12, _MAV_CIPHER_KEY_96, 8, _MAV_CIPHER_NONCE_64)
+	_MAV_CIPHER_XOR_STREAM(Speck64128, 16, _MAV_CIPHER_KEY_128, 8, _MAV_CIPHER_NONCE_64)
+	_MAV_CIPHER_XOR_STREAM(Speck128128, 16, _MAV_CIPHER_KEY_128, 16, _MAV_CIPHER_NONCE_128)
+	_MAV_CIPHER_XOR_STREAM(Speck128256, 32, _MAV_CIPHER_KEY_128, 16, _MAV_CIPHER_NONCE_128)
+#endif // TEST
+
+	/**
+ * @brief Look up a cipher suite by the id agreed at key exchange
+ *
+ * @return the suite, or NULL if it is not built in
+ */
+	MAVLINK_HELPER const mavlink_cipher_t *mavlink_get_cipher(uint8_t cipher_id)
+	{
+		static const mavlink_cipher_t ciphers[] = {
+			{MAVLINK_CIPHER_SPECK128192, "Speck128192", _mav_speck128192_init, _mav_speck128192_key_setup, _mav_speck128192_xor_stream},
+#ifdef TEST
+			{MAVLINK_CIPHER_CHACHA20, "ChaCha20", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_chacha20_xor_stream},
+			{MAVLINK_CIPHER_TRIVIUM, "Trivium", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_trivium_xor_stream},
+			{MAVLINK_CIPHER_RABBIT, "Rabbit", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_rabbit_xor_stream},
+			{MAVLINK_CIPHER_SIMON6496, "Simon6496", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_Simon6496_xor_stream},
+			{MAVLINK_CIPHER_SIMON64128, "Simon64128", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_Simon64128_xor_stream},
+			{MAVLINK_CIPHER_SIMON128128, "Simon128128", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_Simon128128_xor_stream},
+			{MAVLINK_CIPHER_SIMON128192, "Simon128192", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_Simon128192_xor_stream},
+			{MAVLINK_CIPHER_SIMON128256, "Simon128256", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_Simon128256_xor_stream},
+			{MAVLINK_CIPHER_SPECK6496, "Speck6496", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_Speck6496_xor_stream},
+			{MAVLINK_CIPHER_SPECK64128, "Speck64128", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_Speck64128_xor_stream},
+			{MAVLINK_CIPHER_SPECK128128, "Speck128128", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_Speck128128_xor_stream},
+			{MAVLINK_CIPHER_SPECK128256, "Speck128256", _mav_cipher_no_setup, _mav_cipher_no_setup, _mav_Speck128256_xor_stream},
 #endif
+		};
+		unsigned i;
+		for (i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); i++)
+		{
+			if (ciphers[i].id == cipher_id)
+			{
+				return &ciphers[i];
+			}
+		}
+		return NULL;
+	}
 
-		return &remote_keys[id];
+	/*
+		cipher suite of a remote key, MAVLINK_DEFAULT_CIPHER until one is chosen
+	*/
+	MAVLINK_HELPER const mavlink_cipher_t *_mav_remote_key_cipher(key_status_t *remote_key)
+	{
+		const mavlink_cipher_t *cipher = _MAV_KEY_FLAG_LOAD(&remote_key->cipher);
+		if (cipher == NULL)
+		{
+			cipher = mavlink_get_cipher(MAVLINK_DEFAULT_CIPHER);
+			_MAV_KEY_FLAG_STORE(&remote_key->cipher, cipher);
+		}
+		return cipher;
 	}
 
-	MAVLINK_HELPER void mavlink_set_remote_key(int id, uint8_t *public_key)
+	/**
+ * @brief Choose the cipher suite of a remote key, as agreed at key exchange
+ *
+ * Keys default to MAVLINK_DEFAULT_CIPHER. The key and IV already set are
+ * kept and set up for the new suite. Like a new key or IV, choose the
+ * suite before other threads send or parse with the key
+ *
+ * @return false if the suite is not built in, the key is left as it was
+ */
+	MAVLINK_HELPER bool mavlink_ctx_set_remote_key_cipher(mavlink_context_t *ctx, int id, uint8_t cipher_id)
+	{
+		key_status_t *remote_key = mavlink_ctx_get_remote_key(ctx, id);
+		const mavlink_cipher_t *cipher = mavlink_get_cipher(cipher_id);
+		if (cipher == NULL)
+		{
+			return false;
+		}
+		_MAV_KEY_FLAG_STORE(&remote_key->cipher, cipher);
+		cipher->init(remote_key);
+		if (remote_key->status == MAVLINK_KEY_EXCHANGE_COMPLETE)
+		{
+			cipher->key_setup(remote_key);
+		}
+		return true;
+	}
+
+	MAVLINK_HELPER bool mavlink_set_remote_key_cipher(int id, uint8_t cipher_id)
+	{
+		return mavlink_ctx_set_remote_key_cipher(mavlink_get_default_context(), id, cipher_id);
+	}
+#endif // ENCRYPTION
+
+	MAVLINK_HELPER void mavlink_ctx_set_remote_key(mavlink_context_t *ctx, int id, uint8_t *public_key)
 	{
-		key_status_t *remote_key = mavlink_get_remote_key(id);
-		static uint8_t shared_key[32];
-		mavlink_device_certificate_t *device_certificate = mavlink_get_device_certificate();
+		key_status_t *remote_key = mavlink_ctx_get_remote_key(ctx, id);
+		uint8_t shared_key[32];
+		mavlink_device_certificate_t *device_certificate = mavlink_ctx_get_device_certificate(ctx);
 		tiger_ctx tiger;
 
 		CompressedSecretAgreement(device_certificate->secret_key, public_key, shared_key);
@@ -179,46 +472,225 @@ namespace mavlink
 		rhash_tiger_final(&tiger, remote_key->shared_key);
 
 		remote_key->status = MAVLINK_KEY_EXCHANGE_COMPLETE;
+#ifdef ENCRYPTION
+		_mav_remote_key_cipher(remote_key)->key_setup(remote_key);
+#endif
 	}
 
-	MAVLINK_HELPER uint8_t *mavlink_compute_iv(int id)
+	MAVLINK_HELPER void mavlink_set_remote_key(int id, uint8_t *public_key)
 	{
-		key_status_t *remote_key = mavlink_get_remote_key(id);
+		mavlink_ctx_set_remote_key(mavlink_get_default_context(), id, public_key);
+	}
+
+	MAVLINK_HELPER uint8_t *mavlink_ctx_compute_iv(mavlink_context_t *ctx, int id)
+	{
+		key_status_t *remote_key = mavlink_ctx_get_remote_key(ctx, id);
 		RandomBytesFunction(remote_key->iv, 16);
 		remote_key->iv_set = MAVLINK_IV_COMPLETE;
+#ifdef ENCRYPTION
+		_mav_remote_key_cipher(remote_key)->key_setup(remote_key);
+#endif
 		return remote_key->iv;
 	}
 
-	MAVLINK_HELPER void mavlink_set_iv(int id, uint8_t *ivc)
+	MAVLINK_HELPER uint8_t *mavlink_compute_iv(int id)
+	{
+		return mavlink_ctx_compute_iv(mavlink_get_default_context(), id);
+	}
+
+	MAVLINK_HELPER void mavlink_ctx_set_iv(mavlink_context_t *ctx, int id, uint8_t *ivc)
 	{
-		key_status_t *remote_key = mavlink_get_remote_key(id);
+		key_status_t *remote_key = mavlink_ctx_get_remote_key(ctx, id);
 		if (remote_key->iv_set == MAVLINK_IV_EMPTY)
 		{
 			memcpy(remote_key->iv, ivc, member_size(key_status_t, iv));
 			remote_key->iv_set = MAVLINK_IV_COMPLETE;
+#ifdef ENCRYPTION
+			_mav_remote_key_cipher(remote_key)->key_setup(remote_key);
+#endif
 		}
 	}
 
-	MAVLINK_HELPER bool mavlink_is_set_iv(int id)
+	MAVLINK_HELPER void mavlink_set_iv(int id, uint8_t *ivc)
 	{
-		key_status_t *key = mavlink_get_remote_key(id);
+		mavlink_ctx_set_iv(mavlink_get_default_context(), id, ivc);
+	}
+
+	MAVLINK_HELPER bool mavlink_ctx_is_set_iv(mavlink_context_t *ctx, int id)
+	{
+		key_status_t *key = mavlink_ctx_get_remote_key(ctx, id);
 		return key->iv_set;
 	}
 
-	MAVLINK_HELPER bool mavlink_is_set_remote_key(int id)
+	MAVLINK_HELPER bool mavlink_is_set_iv(int id)
 	{
-		key_status_t *key = mavlink_get_remote_key(id);
+		return mavlink_ctx_is_set_iv(mavlink_get_default_context(), id);
+	}
+
+	MAVLINK_HELPER bool mavlink_ctx_is_set_remote_key(mavlink_context_t *ctx, int id)
+	{
+		key_status_t *key = mavlink_ctx_get_remote_key(ctx, id);
 		return key->status;
 	}
 
+	MAVLINK_HELPER bool mavlink_is_set_remote_key(int id)
+	{
+		return mavlink_ctx_is_set_remote_key(mavlink_get_default_context(), id);
+	}
+
+#ifdef ENCRYPTION
+	static inline uint32_t _mav_peer_key_slot(uint32_t key)
+	{
+		return ((uint32_t)(key * 0x9e3779b1U) >> 16) & (MAVLINK_PEER_KEY_SLOTS - 1);
+	}
+
 	/**
- * @brief create a signature block for a packet
+ * @brief Choose the remote key used with a peer on a link
+ *
+ * Payloads from the peer are decrypted with the key, and payloads whose
+ * target is the peer are encrypted with it. A compid of 0 covers every
+ * component of the system, and a sysid and compid of 0 cover everything
+ * else on the link, including messages without a target. Peers with no
+ * key set use key 0. Set up the keys before traffic starts, the table is
+ * not safe to change while other threads send or parse.
+ *
+ * @param link  the link field of the channel status
+ * @param id    index of the remote key
+ * @return false if id is not below MAVLINK_NUM_REMOTE_KEYS or the table is full
  */
-	MAVLINK_HELPER uint8_t mavlink_sign_packet(mavlink_signing_t *signing,
-											   uint8_t signature[MAVLINK_SIGNATURE_BLOCK_LEN],
-											   const uint8_t *header, uint8_t header_len,
-											   const uint8_t *packet, uint8_t packet_len,
-											   const uint8_t crc[2])
+	MAVLINK_HELPER bool mavlink_ctx_set_peer_key(mavlink_context_t *ctx, uint8_t link, uint8_t sysid, uint8_t compid, int id)
+	{
+		uint32_t key = (((uint32_t)link << 16) | ((uint32_t)sysid << 8) | compid) + 1;
+		uint32_t slot = _mav_peer_key_slot(key);
+		uint32_t i;
+		if (id < 0 || id >= MAVLINK_NUM_REMOTE_KEYS)
+		{
+			return false;
+		}
+		for (i = 0; i < MAVLINK_PEER_KEY_SLOTS; i++)
+		{
+			mavlink_peer_key_t *p = &ctx->peer_keys[(slot + i) & (MAVLINK_PEER_KEY_SLOTS - 1)];
+			if (p->key == 0 || p->key == key)
+			{
+				p->key = key;
+				p->id = (uint8_t)id;
+				ctx->peer_keys_generation++;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	MAVLINK_HELPER bool mavlink_set_peer_key(uint8_t link, uint8_t sysid, uint8_t compid, int id)
+	{
+		return mavlink_ctx_set_peer_key(mavlink_get_default_context(), link, sysid, compid, id);
+	}
+
+	/**
+ * @brief Forget all peer keys, every peer uses key 0 again
+ */
+	MAVLINK_HELPER void mavlink_ctx_clear_peer_keys(mavlink_context_t *ctx)
+	{
+		memset(ctx->peer_keys, 0, sizeof(ctx->peer_keys));
+		ctx->peer_keys_generation++;
+	}
+
+	MAVLINK_HELPER void mavlink_clear_peer_keys(void)
+	{
+		mavlink_ctx_clear_peer_keys(mavlink_get_default_context());
+	}
+
+	/*
+		remote key set for exactly this peer, -1 if none. Entries are
+		only removed all at once, so a linear probe stops at the key or
+		the first free slot, normally on the first probe
+	*/
+	MAVLINK_HELPER int _mav_peer_key_find(const mavlink_context_t *ctx, uint8_t link, uint8_t sysid, uint8_t compid)
+	{
+		uint32_t key = (((uint32_t)link << 16) | ((uint32_t)sysid << 8) | compid) + 1;
+		uint32_t slot = _mav_peer_key_slot(key);
+		uint32_t i;
+		for (i = 0; i < MAVLINK_PEER_KEY_SLOTS; i++)
+		{
+			const mavlink_peer_key_t *p = &ctx->peer_keys[(slot + i) & (MAVLINK_PEER_KEY_SLOTS - 1)];
+			if (p->key == key)
+			{
+				return p->id;
+			}
+			if (p->key == 0)
+			{
+				break;
+			}
+		}
+		return -1;
+	}
+
+	/*
+		remote key of a peer, falling back to the key of its system, then
+		of its link, then to key 0
+	*/
+	MAVLINK_HELPER uint8_t _mav_peer_key_lookup(const mavlink_context_t *ctx, uint8_t link, uint8_t sysid, uint8_t compid)
+	{
+		int id = _mav_peer_key_find(ctx, link, sysid, compid);
+		if (id < 0 && compid != 0)
+		{
+			id = _mav_peer_key_find(ctx, link, sysid, 0);
+		}
+		if (id < 0 && sysid != 0)
+		{
+			id = _mav_peer_key_find(ctx, link, 0, 0);
+		}
+		return id < 0 ? 0 : (uint8_t)id;
+	}
+
+	/*
+		remote key of a peer, through one direction of the cache of a
+		channel. The cache holds the generation of the table, the link of
+		the channel, the last peer and its key id, so a run of payloads
+		with one peer looks at the table once, and a change of the table
+		or of status->link makes it look again. A zeroed cache is valid
+		for an empty table, where every peer uses key 0.
+
+		With MAVLINK_USE_CONCURRENT_FINALIZE or MAVLINK_USE_FRAME_RING
+		several threads encrypt for a channel at once, the cache is then
+		read and written as one atomic word and a thread that loses the
+		race only does another lookup
+	*/
+	MAVLINK_HELPER key_status_t *_mav_peer_key_cached(const mavlink_status_t *status, uint64_t *cache,
+													  uint8_t sysid, uint8_t compid)
+	{
+		mavlink_context_t *ctx = status->context ? status->context : mavlink_get_default_context();
+		uint64_t tag = ((uint64_t)ctx->peer_keys_generation << 32) | ((uint32_t)status->link << 24) |
+					   ((uint32_t)sysid << 16) | ((uint32_t)compid << 8);
+#if defined(MAVLINK_USE_CONCURRENT_FINALIZE) || defined(MAVLINK_USE_FRAME_RING)
+		uint64_t cached = __atomic_load_n(cache, __ATOMIC_RELAXED);
+#else
+		uint64_t cached = *cache;
+#endif
+		if ((cached & ~(uint64_t)0xFF) != tag)
+		{
+			cached = tag | _mav_peer_key_lookup(ctx, status->link, sysid, compid);
+#if defined(MAVLINK_USE_CONCURRENT_FINALIZE) || defined(MAVLINK_USE_FRAME_RING)
+			__atomic_store_n(cache, cached, __ATOMIC_RELAXED);
+#else
+			*cache = cached;
+#endif
+		}
+		return mavlink_ctx_get_remote_key(ctx, (uint8_t)cached);
+	}
+#endif
+
+	/**
+ * @brief create a signature block for a packet with a timestamp the caller reserved
+ *
+ * Does not change signing, so several threads may sign with the same
+ * signing state at once as long as each uses its own timestamp.
+ */
+	MAVLINK_HELPER uint8_t mavlink_sign_packet_timestamp(const mavlink_signing_t *signing,
+														 uint8_t signature[MAVLINK_SIGNATURE_BLOCK_LEN],
+														 const uint8_t *header, uint8_t header_len,
+														 const uint8_t *packet, uint8_t packet_len,
+														 const uint8_t crc[2], uint64_t timestamp)
 	{
 		mavlink_sha256_ctx ctx;
 		union
@@ -231,9 +703,8 @@ namespace mavlink
 			return 0;
 		}
 		signature[0] = signing->link_id;
-		tstamp.t64 = signing->timestamp;
+		tstamp.t64 = timestamp;
 		memcpy(&signature[1], tstamp.t8, 6);
-		signing->timestamp++;
 
 		mavlink_sha256_init(&ctx);
 		mavlink_sha256_update(&ctx, signing->secret_key, sizeof(signing->secret_key));
@@ -246,20 +717,98 @@ namespace mavlink
 		return MAVLINK_SIGNATURE_BLOCK_LEN;
 	}
 
+	/**
+ * @brief create a signature block for a packet
+ */
+	MAVLINK_HELPER uint8_t mavlink_sign_packet(mavlink_signing_t *signing,
+											   uint8_t signature[MAVLINK_SIGNATURE_BLOCK_LEN],
+											   const uint8_t *header, uint8_t header_len,
+											   const uint8_t *packet, uint8_t packet_len,
+											   const uint8_t crc[2])
+	{
+		if (signing == NULL || !(signing->flags & MAVLINK_SIGNING_FLAG_SIGN_OUTGOING))
+		{
+			return 0;
+		}
+		return mavlink_sign_packet_timestamp(signing, signature, header, header_len, packet, packet_len, crc,
+											 signing->timestamp++);
+	}
+
+#if defined(MAVLINK_USE_CONCURRENT_FINALIZE) || defined(MAVLINK_USE_FRAME_RING)
+	/**
+ * @brief Move the signing timestamp forward to at least timestamp
+ *
+ * Safe against threads finalizing with mavlink_finalize_message_concurrent()
+ * or into a frame ring. Use this instead of writing signing->timestamp when
+ * updating it from a clock.
+ */
+	MAVLINK_HELPER void mavlink_signing_timestamp_advance(mavlink_signing_t *signing, uint64_t timestamp)
+	{
+		uint64_t cur = __atomic_load_n(&signing->timestamp, __ATOMIC_RELAXED);
+		while (cur < timestamp &&
+			   !__atomic_compare_exchange_n(&signing->timestamp, &cur, timestamp, true,
+											__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+		}
+	}
+#endif
+
+	/*
+	  _mav_trim_payload() for targets without SSE2: skip all zero words,
+	  then scan the last one by byte
+	*/
+	MAVLINK_HELPER uint8_t _mav_trim_payload_words(const char *payload, uint8_t length)
+	{
+		uint64_t word;
+		while (length > 8)
+		{
+			memcpy(&word, &payload[length - 8], sizeof(word));
+			if (word != 0)
+			{
+				break;
+			}
+			length -= 8;
+		}
+		while (length > 1 && payload[length - 1] == 0)
+		{
+			length--;
+		}
+		return length;
+	}
+
 	/**
  * @brief Trim payload of any trailing zero-populated bytes (MAVLink 2 only).
  *
+ * Scans 16 bytes at a time with SSE2. Define MAVLINK_NO_TRIM_SIMD to use
+ * _mav_trim_payload_words() instead.
+ *
  * @param payload Serialised payload buffer.
  * @param length Length of full-width payload buffer.
  * @return Length of payload after zero-filled bytes are trimmed.
  */
 	MAVLINK_HELPER uint8_t _mav_trim_payload(const char *payload, uint8_t length)
 	{
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(MAVLINK_NO_TRIM_SIMD)
+		// skip all zero blocks of 16 bytes, then find the last non zero byte of the block
+		const __m128i zero = _mm_setzero_si128();
+		while (length > 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)&payload[length - 16]);
+			unsigned nonzero = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0xFFFF;
+			if (nonzero != 0)
+			{
+				return (uint8_t)(length - 16 + 32 - __builtin_clz(nonzero));
+			}
+			length -= 16;
+		}
 		while (length > 1 && payload[length - 1] == 0)
 		{
 			length--;
 		}
 		return length;
+#else
+		return _mav_trim_payload_words(payload, length);
+#endif
 	}
 
 	/**
@@ -350,27 +899,68 @@ namespace mavlink
 		memcpy(signing_streams->stream[i].timestamp_bytes, psig + 1, 6);
 
 		// our next timestamp must be at least this timestamp
+#if defined(MAVLINK_USE_CONCURRENT_FINALIZE) || defined(MAVLINK_USE_FRAME_RING)
+		mavlink_signing_timestamp_advance(signing, tstamp.t64);
+#else
 		if (tstamp.t64 > signing->timestamp)
 		{
 			signing->timestamp = tstamp.t64;
 		}
+#endif
 		return true;
 	}
 
+#ifdef ENCRYPTION
+	MAVLINK_HELPER const mavlink_msg_entry_t *mavlink_get_msg_entry(uint32_t msgid);
+
 	/**
- * @brief Finalize a MAVLink message with channel assignment
+ * @brief Encrypt an outgoing payload in place with the cipher suite of the remote key
  *
- * This function calculates the checksum and sets length and aircraft id correctly.
- * It assumes that the message id and the payload are already correctly set. This function
- * can also be used if the message header has already been written before (as in mavlink_msg_xxx_pack
- * instead of mavlink_msg_xxx_pack_headerless), it just introduces little extra overhead.
+ * Heartbeats and the key exchange messages 10000 and 10010 go out in clear.
+ * The key is the peer key of the target system and component of the
+ * message on the link of the channel, see mavlink_ctx_set_peer_key()
  *
- * @param msg Message to finalize
- * @param system_id Id of the sending (this) system, 1-127
- * @param length Message length
+ * @param len length of the payload on the wire, after trimming
  */
-	MAVLINK_HELPER uint16_t mavlink_finalize_message_buffer(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
-															mavlink_status_t *status, uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	MAVLINK_HELPER void _mav_encrypt_payload(mavlink_status_t *status, uint32_t msgid, uint8_t *payload, uint8_t len)
+	{
+		if (msgid == 0 || msgid == 10000 || msgid == 10010)
+		{
+			return;
+		}
+		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msgid);
+		uint8_t target_system = 0, target_component = 0;
+		key_status_t *remote_key;
+		if (e != NULL)
+		{
+			// targets trimmed off the end of the payload are 0
+			if ((e->flags & MAV_MSG_ENTRY_FLAG_HAVE_TARGET_SYSTEM) && e->target_system_ofs < len)
+			{
+				target_system = payload[e->target_system_ofs];
+			}
+			if ((e->flags & MAV_MSG_ENTRY_FLAG_HAVE_TARGET_COMPONENT) && e->target_component_ofs < len)
+			{
+				target_component = payload[e->target_component_ofs];
+			}
+		}
+		remote_key = _mav_peer_key_cached(status, &status->tx_key_cache, target_system, target_component);
+		_mav_remote_key_cipher(remote_key)->xor_stream(remote_key, payload, len);
+	}
+#endif
+
+	/**
+ * @brief Finalize a MAVLink message with a sequence number and signing timestamp the caller reserved
+ *
+ * Only reads status, apart from the peer key cache with ENCRYPTION, which is
+ * written atomically with MAVLINK_USE_CONCURRENT_FINALIZE or MAVLINK_USE_FRAME_RING,
+ * so it may run on several threads at once for the same channel.
+ *
+ * @param seq       sequence number of the message
+ * @param timestamp signing timestamp, unused if the channel does not sign
+ */
+	MAVLINK_HELPER uint16_t mavlink_finalize_message_reserved(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
+															  mavlink_status_t *status, uint8_t min_length, uint8_t length,
+															  uint8_t crc_extra, uint8_t seq, uint64_t timestamp)
 	{
 
 		bool mavlink1 = (status->flags & MAVLINK_STATUS_FLAG_OUT_MAVLINK1) != 0;
@@ -396,8 +986,7 @@ namespace mavlink
 			msg->incompat_flags |= MAVLINK_IFLAG_SIGNED;
 		}
 		msg->compat_flags = 0;
-		msg->seq = status->current_tx_seq;
-		status->current_tx_seq = status->current_tx_seq + 1;
+		msg->seq = seq;
 
 		// form the header as a byte array for the crc
 		buf[0] = msg->magic;
@@ -422,174 +1011,388 @@ namespace mavlink
 		}
 
 #ifdef ENCRYPTION
-		if (msg->msgid != 0 && msg->msgid != 10000 && msg->msgid != 10010)
-		{
-#ifdef CHACHA20
-			uint8_t key[] = {
-				0x00, 0x01, 0x02, 0x03,
-				0x04, 0x05, 0x06, 0x07,
-				0x08, 0x09, 0x0a, 0x0b,
-				0x0c, 0x0d, 0x0e, 0x0f,
-				0x10, 0x11, 0x12, 0x13,
-				0x14, 0x15, 0x16, 0x17,
-				0x18, 0x19, 0x1a, 0x1b,
-				0x1c, 0x1d, 0x1e, 0x1f};
-			uint8_t nonce[] = {
-				0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00};
-			uint8_t encrypt[length];
-
-			//encrypt
-			ChaCha20XOR(key, 1, nonce, (uint8_t *)_MAV_PAYLOAD(msg), (uint8_t *)encrypt, length);
-
-			// copy encrypt in payload for checksum
-			memcpy((uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), encrypt, sizeof(encrypt));
-#endif
-
-#ifdef TRIVIUM
-			//initialize key
-			uint8_t key[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99};
-
-			//initialize initial vector
-			uint8_t iv[] = {
-				0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x01, 0x23};
-
-			//encrypt payload
-			trivium((uint8_t *)key, (uint8_t *)iv, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), length);
-
-#endif
-
-#ifdef RABBIT
-
-			//128 bits key
-			const uint8_t key[] =
-				{
-					0x9f, 0x45, 0xd6, 0x2b,
-					0x00, 0xb3, 0xc5, 0x82,
-					0x10, 0x49, 0x2c, 0x95,
-					0x48, 0xff, 0x81, 0x48};
-			//64 bits iv
-			const uint8_t iv[] = {
-				0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77};
-
-			uint8_t encrypt[length];
-			//encrypt payload
-			rabbit((uint8_t *)iv, (uint8_t *)key, (const uint8_t *)_MAV_PAYLOAD(msg), encrypt, length);
-			//copy encrypted payload in msg
-			memcpy((uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), encrypt, sizeof(encrypt));
+		_mav_encrypt_payload(status, msg->msgid, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
 #endif
+		uint16_t checksum = crc_calculate(&buf[1], header_len - 1);
+		crc_accumulate_buffer(&checksum, _MAV_PAYLOAD(msg), msg->len);
+		crc_accumulate(crc_extra, &checksum);
+		mavlink_ck_a(msg) = (uint8_t)(checksum & 0xFF);
+		mavlink_ck_b(msg) = (uint8_t)(checksum >> 8);
 
-#ifdef SIMON6496
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b, 0x10, 0x11, 0x12, 0x13};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
+		msg->checksum = checksum;
 
-			Simon6496(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
+		if (signing)
+		{
+			mavlink_sign_packet_timestamp(status->signing,
+										  msg->signature,
+										  (const uint8_t *)buf, header_len,
+										  (const uint8_t *)_MAV_PAYLOAD(msg), msg->len,
+										  (const uint8_t *)_MAV_PAYLOAD(msg) + (uint16_t)msg->len,
+										  timestamp);
+		}
 
-#endif
+		return msg->len + header_len + 2 + signature_len;
+	}
 
-#ifdef SIMON64128
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
+	/**
+ * @brief Finalize a MAVLink message with channel assignment
+ *
+ * This function calculates the checksum and sets length and aircraft id correctly.
+ * It assumes that the message id and the payload are already correctly set. This function
+ * can also be used if the message header has already been written before (as in mavlink_msg_xxx_pack
+ * instead of mavlink_msg_xxx_pack_headerless), it just introduces little extra overhead.
+ *
+ * @param msg Message to finalize
+ * @param system_id Id of the sending (this) system, 1-127
+ * @param length Message length
+ */
+	MAVLINK_HELPER uint16_t mavlink_finalize_message_buffer(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
+															mavlink_status_t *status, uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	{
+		bool signing = !(status->flags & MAVLINK_STATUS_FLAG_OUT_MAVLINK1) && status->signing &&
+					   (status->signing->flags & MAVLINK_SIGNING_FLAG_SIGN_OUTGOING);
+		uint8_t seq = status->current_tx_seq;
+		uint64_t timestamp = signing ? status->signing->timestamp++ : 0;
+		status->current_tx_seq = seq + 1;
+		return mavlink_finalize_message_reserved(msg, system_id, component_id, status, min_length, length, crc_extra,
+												 seq, timestamp);
+	}
 
-			Simon64128(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
-#endif
+#ifdef MAVLINK_USE_CONCURRENT_FINALIZE
+#define MAVLINK_HAVE_CONCURRENT_FINALIZE
+	/**
+ * @brief Finalize a MAVLink message from any number of threads at once
+ *
+ * The sequence number and signing timestamp are reserved with atomic
+ * increments, the CRC and the SHA-256 signature are then computed
+ * without holding anything, so threads finalizing for the same channel
+ * only contend on two counters.
+ *
+ * The frames still have to go on the wire in signing timestamp order,
+ * a receiver drops a signed frame whose timestamp is not newer than the
+ * last one it saw from the same link. Threads that write the link in
+ * whatever order they finish should use the frame ring instead, which
+ * keeps the timestamps in slot order.
+ *
+ * Needs the GCC/clang __atomic builtins. Enable with MAVLINK_USE_CONCURRENT_FINALIZE.
+ */
+	MAVLINK_HELPER uint16_t mavlink_finalize_message_concurrent(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
+																mavlink_status_t *status, uint8_t min_length, uint8_t length,
+																uint8_t crc_extra)
+	{
+		bool signing = !(status->flags & MAVLINK_STATUS_FLAG_OUT_MAVLINK1) && status->signing &&
+					   (status->signing->flags & MAVLINK_SIGNING_FLAG_SIGN_OUTGOING);
+		uint8_t seq = __atomic_fetch_add(&status->current_tx_seq, 1, __ATOMIC_RELAXED);
+		uint64_t timestamp = signing ? __atomic_fetch_add(&status->signing->timestamp, 1, __ATOMIC_RELAXED) : 0;
+		return mavlink_finalize_message_reserved(msg, system_id, component_id, status, min_length, length, crc_extra,
+												 seq, timestamp);
+	}
+#endif // MAVLINK_USE_CONCURRENT_FINALIZE
 
-#ifdef SIMON128128
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+	MAVLINK_HELPER uint16_t mavlink_finalize_message_chan(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
+														  uint8_t chan, uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	{
+		mavlink_status_t *status = mavlink_get_channel_status(chan);
+		return mavlink_finalize_message_buffer(msg, system_id, component_id, status, min_length, length, crc_extra);
+	}
 
-			Simon128128(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
-#endif
+	/**
+ * @brief Finalize a MAVLink message on a channel of a context
+ */
+	MAVLINK_HELPER uint16_t mavlink_ctx_finalize_message_chan(mavlink_context_t *ctx, mavlink_message_t *msg,
+															  uint8_t system_id, uint8_t component_id,
+															  uint8_t chan, uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	{
+		mavlink_status_t *status = mavlink_ctx_get_channel_status(ctx, chan);
+		return mavlink_finalize_message_buffer(msg, system_id, component_id, status, min_length, length, crc_extra);
+	}
 
-#ifdef SIMON128192
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+	/**
+ * @brief Finalize a MAVLink message with MAVLINK_COMM_0 as default channel
+ */
+	MAVLINK_HELPER uint16_t mavlink_finalize_message(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
+													 uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	{
+		return mavlink_finalize_message_chan(msg, system_id, component_id, MAVLINK_COMM_0, min_length, length, crc_extra);
+	}
 
-			Simon128192(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
-#endif
+	static inline void _mav_parse_error(mavlink_status_t *status)
+	{
+		status->parse_error++;
+		if (status->stats != NULL)
+		{
+			status->stats->parse_errors++;
+		}
+	}
 
-#ifdef SIMON128256
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+#define MAVLINK_HAVE_FINALIZE_WIRE
 
-			Simon128256(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
-#endif
+	/**
+ * @brief Offset of the payload in a frame finalized for a channel
+ *
+ * mavlink_msg_*_pack_to_wire() write the payload here before calling
+ * mavlink_finalize_wire()
+ */
+	MAVLINK_HELPER uint8_t mavlink_wire_header_len(const mavlink_status_t *status)
+	{
+		return (status->flags & MAVLINK_STATUS_FLAG_OUT_MAVLINK1) ? MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 : MAVLINK_NUM_HEADER_BYTES;
+	}
 
-#ifdef SPECK6496
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b, 0x10, 0x11, 0x12, 0x13};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
+	/**
+ * @brief Finalize a frame whose payload is already in place in the wire buffer
+ *
+ * Like mavlink_finalize_message_buffer() followed by mavlink_msg_to_send_buffer(),
+ * without the mavlink_message_t in between. Header, checksum and signature
+ * are written around the payload at out + mavlink_wire_header_len(status).
+ *
+ * @param out buffer of at least MAVLINK_MAX_PACKET_LEN bytes
+ *
+ * @return length of the frame, 0 if it can't be sent with this status
+ */
+	MAVLINK_HELPER uint16_t mavlink_finalize_wire(uint8_t *out, uint8_t system_id, uint8_t component_id,
+												  mavlink_status_t *status, uint32_t msgid,
+												  uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	{
+		bool mavlink1 = (status->flags & MAVLINK_STATUS_FLAG_OUT_MAVLINK1) != 0;
+		bool signing = (!mavlink1) && status->signing && (status->signing->flags & MAVLINK_SIGNING_FLAG_SIGN_OUTGOING);
+		uint8_t header_len = mavlink_wire_header_len(status);
+		uint8_t *payload = out + header_len;
+		uint8_t signature_len = 0;
+		uint16_t checksum;
+		uint8_t len;
 
-			Speck6496(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
-#endif
+		if (mavlink1)
+		{
+			if (msgid > 255)
+			{
+				// can't send 16 bit messages
+				status->parse_error++;
+				return 0;
+			}
+			len = min_length;
+			out[0] = MAVLINK_STX_MAVLINK1;
+			out[1] = len;
+			out[2] = status->current_tx_seq;
+			out[3] = system_id;
+			out[4] = component_id;
+			out[5] = msgid & 0xFF;
+		}
+		else
+		{
+			len = _mav_trim_payload((const char *)payload, length);
+			out[0] = MAVLINK_STX;
+			out[1] = len;
+			out[2] = signing ? MAVLINK_IFLAG_SIGNED : 0;
+			out[3] = 0; // compat_flags
+			out[4] = status->current_tx_seq;
+			out[5] = system_id;
+			out[6] = component_id;
+			out[7] = msgid & 0xFF;
+			out[8] = (msgid >> 8) & 0xFF;
+			out[9] = (msgid >> 16) & 0xFF;
+		}
+		status->current_tx_seq++;
 
-#ifdef SPECK64128
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
-			Speck64128(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
+#ifdef ENCRYPTION
+		_mav_encrypt_payload(status, msgid, payload, len);
 #endif
+		checksum = crc_calculate(&out[1], header_len - 1);
+		crc_accumulate_buffer(&checksum, (const char *)payload, len);
+		crc_accumulate(crc_extra, &checksum);
+		payload[len] = (uint8_t)(checksum & 0xFF);
+		payload[len + 1] = (uint8_t)(checksum >> 8);
 
-#ifdef SPECK128128
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+		if (signing)
+		{
+			signature_len = mavlink_sign_packet(status->signing, &payload[len + 2],
+												out, header_len, payload, len, &payload[len]);
+		}
+		return header_len + len + 2 + signature_len;
+	}
 
-			Speck128128(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
-#endif
+#ifdef MAVLINK_USE_CONVENIENCE_FUNCTIONS
+	MAVLINK_HELPER void _mavlink_send_uart(mavlink_channel_t chan, const char *buf, uint16_t len);
 
-#ifdef SPECK128192
-			key_status_t *remote_key = mavlink_get_remote_key(0); //how get the right key?
-			Speck128192(remote_key->iv, remote_key->shared_key, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
+#ifdef MAVLINK_USE_TX_BUFFER
+	MAVLINK_HELPER void _mavlink_tx_start_frame(mavlink_channel_t chan, uint16_t length);
+	MAVLINK_HELPER void _mavlink_tx_end_frame(mavlink_channel_t chan, uint16_t length);
+	/*
+	  with a transmit buffer the user's MAVLINK_START_UART_SEND() and
+	  MAVLINK_END_UART_SEND() wrap each flush instead of each frame
+	*/
+#define _MAVLINK_START_FRAME(chan, length) _mavlink_tx_start_frame(chan, length)
+#define _MAVLINK_END_FRAME(chan, length) _mavlink_tx_end_frame(chan, length)
+#else
+#define _MAVLINK_START_FRAME(chan, length) MAVLINK_START_UART_SEND(chan, length)
+#define _MAVLINK_END_FRAME(chan, length) MAVLINK_END_UART_SEND(chan, length)
 #endif
 
-#ifdef SPECK128256
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+#ifdef MAVLINK_USE_RATE_LIMIT
+#define MAVLINK_HAVE_RATE_LIMIT
 
-			Speck128256(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg), msg->len);
-#endif
-		}
+	/*
+	  Token buckets are filled from the POSIX monotonic clock unless
+	  MAVLINK_RATE_LIMIT_TIME_MS() is defined to return a millisecond tick
+	*/
+#ifndef MAVLINK_RATE_LIMIT_TIME_MS
+	MAVLINK_HELPER uint32_t _mavlink_rate_limit_time_ms(void)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+	}
+#define MAVLINK_RATE_LIMIT_TIME_MS() _mavlink_rate_limit_time_ms()
 #endif
-		uint16_t checksum = crc_calculate(&buf[1], header_len - 1);
-		crc_accumulate_buffer(&checksum, _MAV_PAYLOAD(msg), msg->len);
-		crc_accumulate(crc_extra, &checksum);
-		mavlink_ck_a(msg) = (uint8_t)(checksum & 0xFF);
-		mavlink_ck_b(msg) = (uint8_t)(checksum >> 8);
 
-		msg->checksum = checksum;
+	/*
+	  rate limit table of the context a channel belongs to
+	*/
+	MAVLINK_HELPER mavlink_rate_limit_t *_mav_rate_limit_table(mavlink_channel_t chan)
+	{
+		mavlink_status_t *status = mavlink_get_channel_status(chan);
+		mavlink_context_t *ctx = status->context ? status->context : mavlink_get_default_context();
+		return ctx->rate_limit;
+	}
 
-		if (signing)
+	/*
+	  find the bucket of a message id on a channel, optionally taking a
+	  free slot for it. Buckets are never removed, so plain linear probing
+	  is enough
+	*/
+	MAVLINK_HELPER mavlink_rate_limit_t *_mav_rate_limit_find(mavlink_channel_t chan, uint32_t msgid, bool create)
+	{
+		mavlink_rate_limit_t *table = _mav_rate_limit_table(chan);
+		// 64 bit so that chan 255 with msgid 0xFFFFFF does not wrap to the free slot marker
+		uint64_t key = (((uint64_t)chan << 24) | msgid) + 1;
+		uint32_t i = (((uint32_t)key * 0x9e3779b1U) >> 16) & (MAVLINK_RATE_LIMIT_SLOTS - 1);
+		uint32_t n;
+		for (n = 0; n < MAVLINK_RATE_LIMIT_SLOTS; n++)
 		{
-			mavlink_sign_packet(status->signing,
-								msg->signature,
-								(const uint8_t *)buf, header_len,
-								(const uint8_t *)_MAV_PAYLOAD(msg), msg->len,
-								(const uint8_t *)_MAV_PAYLOAD(msg) + (uint16_t)msg->len);
+			mavlink_rate_limit_t *r = &table[i];
+			if (r->key == key)
+			{
+				return r;
+			}
+			if (r->key == 0)
+			{
+				if (!create)
+				{
+					return NULL;
+				}
+				memset(r, 0, sizeof(*r));
+				r->key = key;
+				return r;
+			}
+			i = (i + 1) & (MAVLINK_RATE_LIMIT_SLOTS - 1);
 		}
-
-		return msg->len + header_len + 2 + signature_len;
+		return NULL;
 	}
 
-	MAVLINK_HELPER uint16_t mavlink_finalize_message_chan(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
-														  uint8_t chan, uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	/**
+ * @brief Limit the rate a message is sent at on a channel
+ *
+ * Applies to the mavlink_msg_*_send() functions. Calling it again for the
+ * same message changes the limit and refills the bucket.
+ *
+ * @param rate_mhz average rate in frames per 1000 seconds, 5000 for 5 Hz
+ * @param burst    frames that may go out back to back after a quiet spell, at least 1
+ * @param policy   MAVLINK_RATE_LIMIT_DROP or MAVLINK_RATE_LIMIT_DEFER
+ *
+ * @return false if all MAVLINK_RATE_LIMIT_SLOTS are taken
+ */
+	MAVLINK_HELPER bool mavlink_rate_limit_set(mavlink_channel_t chan, uint32_t msgid, uint32_t rate_mhz,
+											   uint16_t burst, uint8_t policy)
 	{
-		mavlink_status_t *status = mavlink_get_channel_status(chan);
-		return mavlink_finalize_message_buffer(msg, system_id, component_id, status, min_length, length, crc_extra);
+		mavlink_rate_limit_t *r = _mav_rate_limit_find(chan, msgid, true);
+		if (r == NULL)
+		{
+			return false;
+		}
+		r->rate_mhz = rate_mhz;
+		r->burst = (burst ? burst : 1) * 1000U;
+		r->tokens = r->burst;
+		r->tokens_frac = 0;
+		r->last_ms = MAVLINK_RATE_LIMIT_TIME_MS();
+		r->policy = policy;
+		return true;
 	}
 
 	/**
- * @brief Finalize a MAVLink message with MAVLINK_COMM_0 as default channel
+ * @brief Get the bucket and counters of a rate limited message
+ *
+ * @return NULL if the message is not rate limited on this channel
  */
-	MAVLINK_HELPER uint16_t mavlink_finalize_message(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
-													 uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	MAVLINK_HELPER const mavlink_rate_limit_t *mavlink_rate_limit_get(mavlink_channel_t chan, uint32_t msgid)
 	{
-		return mavlink_finalize_message_chan(msg, system_id, component_id, MAVLINK_COMM_0, min_length, length, crc_extra);
+		return _mav_rate_limit_find(chan, msgid, false);
 	}
 
-	static inline void _mav_parse_error(mavlink_status_t *status)
+	/*
+	  add the tokens earned since the last refill. What is earned in one
+	  millisecond can be less than a thousandth of a frame, so the
+	  remainder is carried over to the next refill
+	*/
+	MAVLINK_HELPER void _mav_rate_limit_refill(mavlink_rate_limit_t *r, uint32_t now_ms)
 	{
-		status->parse_error++;
+		uint64_t earned = (uint64_t)(now_ms - r->last_ms) * r->rate_mhz + r->tokens_frac;
+		uint64_t tokens = r->tokens + earned / 1000U;
+		if (tokens >= r->burst)
+		{
+			r->tokens = r->burst;
+			r->tokens_frac = 0;
+		}
+		else
+		{
+			r->tokens = (uint32_t)tokens;
+			r->tokens_frac = (uint32_t)(earned % 1000U);
+		}
+		r->last_ms = now_ms;
 	}
 
-#ifdef MAVLINK_USE_CONVENIENCE_FUNCTIONS
-	MAVLINK_HELPER void _mavlink_send_uart(mavlink_channel_t chan, const char *buf, uint16_t len);
+	/*
+	  take a token for a frame about to be finalized. Without one the frame
+	  is dropped, or kept as the deferred frame of the bucket in place of
+	  an older one
+	*/
+	MAVLINK_HELPER bool _mav_rate_limit_admit(mavlink_channel_t chan, uint32_t msgid, const char *packet,
+											  uint8_t min_length, uint8_t length, uint8_t crc_extra)
+	{
+		mavlink_rate_limit_t *r = _mav_rate_limit_find(chan, msgid, false);
+		if (r == NULL)
+		{
+			return true;
+		}
+		_mav_rate_limit_refill(r, MAVLINK_RATE_LIMIT_TIME_MS());
+		if (r->tokens >= 1000U)
+		{
+			r->tokens -= 1000U;
+			r->sent++;
+			if (r->pending)
+			{
+				// this frame is newer than the deferred one
+				r->pending = 0;
+				r->dropped++;
+			}
+			return true;
+		}
+		if (r->policy != MAVLINK_RATE_LIMIT_DEFER)
+		{
+			r->dropped++;
+			return false;
+		}
+		if (r->pending)
+		{
+			r->dropped++;
+		}
+		memcpy(r->payload, packet, length);
+		r->min_length = min_length;
+		r->length = length;
+		r->crc_extra = crc_extra;
+		r->pending = 1;
+		r->deferred++;
+		return false;
+	}
+#endif // MAVLINK_USE_RATE_LIMIT
 
 	/**
  * @brief Finalize a MAVLink message with channel assignment and send
@@ -609,13 +1412,20 @@ namespace mavlink
 		bool mavlink1 = (status->flags & MAVLINK_STATUS_FLAG_OUT_MAVLINK1) != 0;
 		bool signing = (!mavlink1) && status->signing && (status->signing->flags & MAVLINK_SIGNING_FLAG_SIGN_OUTGOING);
 
+#ifdef MAVLINK_USE_RATE_LIMIT
+		if (!_mav_rate_limit_admit(chan, msgid, packet, min_length, length, crc_extra))
+		{
+			return;
+		}
+#endif
+
 		if (mavlink1)
 		{
 			length = min_length;
 			if (msgid > 255)
 			{
 				// can't send 16 bit messages
-				_mav_parse_error(status);
+				status->parse_error++;
 				return;
 			}
 			header_len = MAVLINK_CORE_HEADER_MAVLINK1_LEN;
@@ -647,131 +1457,7 @@ namespace mavlink
 		}
 
 #ifdef ENCRYPTION
-		if (msgid != 0 && msgid != 10000 && msgid != 10010)
-		{
-#ifdef CHACHA20
-			//set key
-			uint8_t key[] = {
-				0x00, 0x01, 0x02, 0x03,
-				0x04, 0x05, 0x06, 0x07,
-				0x08, 0x09, 0x0a, 0x0b,
-				0x0c, 0x0d, 0x0e, 0x0f,
-				0x10, 0x11, 0x12, 0x13,
-				0x14, 0x15, 0x16, 0x17,
-				0x18, 0x19, 0x1a, 0x1b,
-				0x1c, 0x1d, 0x1e, 0x1f};
-			//set nonce
-			uint8_t nonce[] = {
-				0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00};
-			//declare encrypt
-			uint8_t encrypt[length];
-
-			//encrypt payload
-			ChaCha20XOR(key, 1, nonce, (uint8_t *)packet, (uint8_t *)encrypt, length);
-
-			//copy encrypted payload
-			memcpy((uint8_t *)packet, encrypt, sizeof(encrypt));
-#endif
-
-#ifdef TRIVIUM
-			//initialize key
-			uint8_t key[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99};
-
-			//initialize initial vector
-			uint8_t iv[] = {
-				0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x01, 0x23};
-
-			//encrypt payload
-			trivium((uint8_t *)key, (uint8_t *)iv, (uint8_t *)packet, length);
-
-#endif
-
-#ifdef RABBIT
-
-			//128 bits key
-			const uint8_t key[] =
-				{
-					0x9f, 0x45, 0xd6, 0x2b,
-					0x00, 0xb3, 0xc5, 0x82,
-					0x10, 0x49, 0x2c, 0x95,
-					0x48, 0xff, 0x81, 0x48};
-			//64 bits iv
-			const uint8_t iv[] = {
-				0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77};
-
-			uint8_t encrypt[length];
-			//encrypt payload
-			rabbit((uint8_t *)iv, (uint8_t *)key, (uint8_t *)packet, encrypt, length);
-			//copy encrypted payload in msg
-			memcpy((uint8_t *)packet, encrypt, sizeof(encrypt));
-#endif
-
-#ifdef SIMON6496
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b, 0x10, 0x11, 0x12, 0x13};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
-			Simon6496(nonce, k, (uint8_t *)packet, length);
-#endif
-
-#ifdef SIMON64128
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
-
-			Simon64128(nonce, k, (uint8_t *)packet, length);
-#endif
-
-#ifdef SPECK6496
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b, 0x10, 0x11, 0x12, 0x13};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
-			Speck6496(nonce, k, (uint8_t *)packet, length);
-#endif
-
-#ifdef SPECK64128
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
-
-			Speck64128(nonce, k, (uint8_t *)packet, length);
-#endif
-
-#ifdef SIMON128128
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-
-			Simon128128(nonce, k, (uint8_t *)packet, length);
-#endif
-
-#ifdef SIMON128192
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-
-			Simon128192(nonce, k, (uint8_t *)packet, length);
-#endif
-
-#ifdef SIMON128256
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-
-			Simon128256(nonce, k, (uint8_t *)packet, length);
-#endif
-
-#ifdef SPECK128128
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-
-			Speck128128(nonce, k, (uint8_t *)packet, length);
-#endif
-
-#ifdef SPECK128192
-			key_status_t *remote_key = mavlink_get_remote_key(0); //how get the right key?
-			Speck128192(remote_key->iv, remote_key->shared_key, (uint8_t *)packet, length);
-#endif
-
-#ifdef SPECK128256
-			uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-			uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-
-			Speck128256(nonce, k, (uint8_t *)packet, length);
-#endif
-		}
+		_mav_encrypt_payload(status, msgid, (uint8_t *)packet, length);
 #endif
 		status->current_tx_seq++;
 		checksum = crc_calculate((const uint8_t *)&buf[1], header_len);
@@ -786,7 +1472,7 @@ namespace mavlink
 			signature_len = mavlink_sign_packet(status->signing, signature, buf, header_len + 1,
 												(const uint8_t *)packet, length, ck);
 		}
-		MAVLINK_START_UART_SEND(chan, header_len + 3 + (uint16_t)length + (uint16_t)signature_len);
+		_MAVLINK_START_FRAME(chan, header_len + 3 + (uint16_t)length + (uint16_t)signature_len);
 		_mavlink_send_uart(chan, (const char *)buf, header_len + 1);
 		_mavlink_send_uart(chan, packet, length);
 		_mavlink_send_uart(chan, (const char *)ck, 2);
@@ -794,8 +1480,41 @@ namespace mavlink
 		{
 			_mavlink_send_uart(chan, (const char *)signature, signature_len);
 		}
-		MAVLINK_END_UART_SEND(chan, header_len + 3 + (uint16_t)length + (uint16_t)signature_len);
+		_MAVLINK_END_FRAME(chan, header_len + 3 + (uint16_t)length + (uint16_t)signature_len);
+	}
+
+#ifdef MAVLINK_USE_RATE_LIMIT
+	/**
+ * @brief Send the deferred frames of a channel that have a token by now
+ *
+ * Call this regularly on channels with MAVLINK_RATE_LIMIT_DEFER limits
+ */
+	MAVLINK_HELPER void mavlink_rate_limit_poll(mavlink_channel_t chan)
+	{
+		mavlink_rate_limit_t *table = _mav_rate_limit_table(chan);
+		uint32_t now_ms = MAVLINK_RATE_LIMIT_TIME_MS();
+		uint32_t i;
+		for (i = 0; i < MAVLINK_RATE_LIMIT_SLOTS; i++)
+		{
+			mavlink_rate_limit_t *r = &table[i];
+			char payload[MAVLINK_MAX_PAYLOAD_LEN];
+			if (!r->pending || (uint32_t)((r->key - 1) >> 24) != (uint32_t)chan)
+			{
+				continue;
+			}
+			_mav_rate_limit_refill(r, now_ms);
+			if (r->tokens < 1000U)
+			{
+				continue;
+			}
+			// sending takes the token and clears pending
+			memcpy(payload, r->payload, r->length);
+			r->pending = 0;
+			_mav_finalize_message_chan_send(chan, (uint32_t)((r->key - 1) & 0xFFFFFF), payload,
+											r->min_length, r->length, r->crc_extra);
+		}
 	}
+#endif // MAVLINK_USE_RATE_LIMIT
 
 	/**
  * @brief re-send a message over a uart channel
@@ -817,7 +1536,7 @@ namespace mavlink
 		{
 			header_len = MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
 			signature_len = 0;
-			MAVLINK_START_UART_SEND(chan, header_len + msg->len + 2 + signature_len);
+			_MAVLINK_START_FRAME(chan, header_len + msg->len + 2 + signature_len);
 			// we can't send the structure directly as it has extra mavlink2 elements in it
 			uint8_t buf[MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1];
 			buf[0] = msg->magic;
@@ -832,7 +1551,7 @@ namespace mavlink
 		{
 			header_len = MAVLINK_CORE_HEADER_LEN + 1;
 			signature_len = (msg->incompat_flags & MAVLINK_IFLAG_SIGNED) ? MAVLINK_SIGNATURE_BLOCK_LEN : 0;
-			MAVLINK_START_UART_SEND(chan, header_len + msg->len + 2 + signature_len);
+			_MAVLINK_START_FRAME(chan, header_len + msg->len + 2 + signature_len);
 			uint8_t buf[MAVLINK_CORE_HEADER_LEN + 1];
 			buf[0] = msg->magic;
 			buf[1] = msg->len;
@@ -852,7 +1571,7 @@ namespace mavlink
 		{
 			_mavlink_send_uart(chan, (const char *)msg->signature, MAVLINK_SIGNATURE_BLOCK_LEN);
 		}
-		MAVLINK_END_UART_SEND(chan, header_len + msg->len + 2 + signature_len);
+		_MAVLINK_END_FRAME(chan, header_len + msg->len + 2 + signature_len);
 	}
 #endif // MAVLINK_USE_CONVENIENCE_FUNCTIONS
 
@@ -880,7 +1599,8 @@ namespace mavlink
 		}
 		else
 		{
-			length = _mav_trim_payload(_MAV_PAYLOAD(msg), length);
+			// msg->len was trimmed when the message was finalized, and the
+			// checksum covers exactly that many bytes
 			header_len = MAVLINK_CORE_HEADER_LEN;
 			buf[0] = msg->magic;
 			buf[1] = length;
@@ -906,6 +1626,149 @@ namespace mavlink
 		return header_len + 1 + 2 + (uint16_t)length + (uint16_t)signature_len;
 	}
 
+#ifdef MAVLINK_USE_IOVEC
+#define MAVLINK_HAVE_IOVEC
+
+	/**
+ * @brief Describe a batch of finalized messages as an iovec array
+ *
+ * Each message takes up to MAVLINK_IOVEC_PER_MSG entries: its header and
+ * trailer (CRC and signature) are written to scratch, its payload is
+ * referenced in place. The iovec array can be handed to writev() or
+ * sendmsg() and stays valid as long as msgs and scratch do.
+ *
+ * Unlike mavlink_msg_to_send_buffer() the payload is sent with the
+ * length in msg->len, which is what the CRC was computed over.
+ *
+ * @param msgs    finalized messages
+ * @param count   number of messages
+ * @param scratch one entry per message
+ * @param iov     room for count * MAVLINK_IOVEC_PER_MSG entries
+ * @param bytes   if not NULL, set to the total number of bytes described
+ *
+ * @return number of iov entries used
+ */
+	MAVLINK_HELPER unsigned mavlink_msgs_to_iovec(const mavlink_message_t *const *msgs, unsigned count,
+												  mavlink_iovec_scratch_t *scratch, struct iovec *iov, size_t *bytes)
+	{
+		unsigned i, n = 0;
+		size_t total = 0;
+
+		for (i = 0; i < count; i++)
+		{
+			const mavlink_message_t *msg = msgs[i];
+			uint8_t *hdr = scratch[i].header;
+			uint8_t *trailer = scratch[i].trailer;
+			uint8_t header_len, trailer_len = MAVLINK_NUM_CHECKSUM_BYTES;
+
+			hdr[0] = msg->magic;
+			hdr[1] = msg->len;
+			if (msg->magic == MAVLINK_STX_MAVLINK1)
+			{
+				header_len = MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
+				hdr[2] = msg->seq;
+				hdr[3] = msg->sysid;
+				hdr[4] = msg->compid;
+				hdr[5] = msg->msgid & 0xFF;
+			}
+			else
+			{
+				header_len = MAVLINK_CORE_HEADER_LEN + 1;
+				hdr[2] = msg->incompat_flags;
+				hdr[3] = msg->compat_flags;
+				hdr[4] = msg->seq;
+				hdr[5] = msg->sysid;
+				hdr[6] = msg->compid;
+				hdr[7] = msg->msgid & 0xFF;
+				hdr[8] = (msg->msgid >> 8) & 0xFF;
+				hdr[9] = (msg->msgid >> 16) & 0xFF;
+				if (msg->incompat_flags & MAVLINK_IFLAG_SIGNED)
+				{
+					memcpy(&trailer[MAVLINK_NUM_CHECKSUM_BYTES], msg->signature, MAVLINK_SIGNATURE_BLOCK_LEN);
+					trailer_len += MAVLINK_SIGNATURE_BLOCK_LEN;
+				}
+			}
+			trailer[0] = (uint8_t)(msg->checksum & 0xFF);
+			trailer[1] = (uint8_t)(msg->checksum >> 8);
+
+			iov[n].iov_base = hdr;
+			iov[n].iov_len = header_len;
+			n++;
+			if (msg->len > 0)
+			{
+				iov[n].iov_base = (void *)_MAV_PAYLOAD(msg);
+				iov[n].iov_len = msg->len;
+				n++;
+			}
+			iov[n].iov_base = trailer;
+			iov[n].iov_len = trailer_len;
+			n++;
+			total += header_len + msg->len + trailer_len;
+		}
+
+		if (bytes != NULL)
+		{
+			*bytes = total;
+		}
+		return n;
+	}
+
+#ifndef MAVLINK_IOVEC_MAX_MSGS
+#define MAVLINK_IOVEC_MAX_MSGS 64
+#endif
+
+	/**
+ * @brief Write a batch of finalized messages to a file descriptor
+ *
+ * Up to MAVLINK_IOVEC_MAX_MSGS messages go out per writev() call, short
+ * writes are continued where they stopped.
+ *
+ * @return number of bytes written, or -1 with errno set on error
+ */
+	MAVLINK_HELPER ssize_t mavlink_writev(int fd, const mavlink_message_t *const *msgs, unsigned count)
+	{
+		mavlink_iovec_scratch_t scratch[MAVLINK_IOVEC_MAX_MSGS];
+		struct iovec iov[MAVLINK_IOVEC_MAX_MSGS * MAVLINK_IOVEC_PER_MSG];
+		ssize_t written = 0;
+
+		while (count > 0)
+		{
+			unsigned batch = count < MAVLINK_IOVEC_MAX_MSGS ? count : MAVLINK_IOVEC_MAX_MSGS;
+			unsigned n = mavlink_msgs_to_iovec(msgs, batch, scratch, iov, NULL);
+			struct iovec *v = iov;
+
+			while (n > 0)
+			{
+				ssize_t ret = writev(fd, v, n);
+				if (ret < 0)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					return -1;
+				}
+				written += ret;
+				// skip the entries that went out, and the sent part of the next one
+				while (n > 0 && (size_t)ret >= v->iov_len)
+				{
+					ret -= v->iov_len;
+					v++;
+					n--;
+				}
+				if (n > 0)
+				{
+					v->iov_base = (uint8_t *)v->iov_base + ret;
+					v->iov_len -= ret;
+				}
+			}
+			msgs += batch;
+			count -= batch;
+		}
+		return written;
+	}
+#endif // MAVLINK_USE_IOVEC
+
 	union __mavlink_bitfield
 	{
 		uint8_t uint8;
@@ -937,8 +1800,21 @@ namespace mavlink
 	MAVLINK_HELPER const mavlink_msg_entry_t *mavlink_get_msg_entry(uint32_t msgid)
 	{
 		static const mavlink_msg_entry_t mavlink_message_crcs[] = MAVLINK_MESSAGE_CRCS;
+#ifdef MAVLINK_MESSAGE_CRCS_HASH_INDEX
 		/*
-	  use a bisection search to find the right entry. A perfect hash may be better
+	  use the perfect hash generated alongside the table. Every msgid in the
+	  table has its own slot, unused slots point at entry 0, so one compare
+	  tells a hit from a miss
+	*/
+		static const uint16_t hash_disp[] = MAVLINK_MESSAGE_CRCS_HASH_DISP;
+		static const uint16_t hash_index[] = MAVLINK_MESSAGE_CRCS_HASH_INDEX;
+		uint32_t bucket = (uint32_t)(msgid * MAVLINK_MESSAGE_CRCS_HASH_MUL1) >> (32 - MAVLINK_MESSAGE_CRCS_HASH_BUCKET_BITS);
+		uint32_t slot = ((uint32_t)(msgid * MAVLINK_MESSAGE_CRCS_HASH_MUL2) >> (32 - MAVLINK_MESSAGE_CRCS_HASH_SLOT_BITS)) + hash_disp[bucket];
+		const mavlink_msg_entry_t *e = &mavlink_message_crcs[hash_index[slot & ((1U << MAVLINK_MESSAGE_CRCS_HASH_SLOT_BITS) - 1)]];
+		return e->msgid == msgid ? e : NULL;
+#else
+		/*
+	  use a bisection search to find the right entry.
 	  Note that this assumes the table is sorted by msgid
 	*/
 		uint32_t low = 0, high = sizeof(mavlink_message_crcs) / sizeof(mavlink_message_crcs[0]) - 1;
@@ -964,36 +1840,284 @@ namespace mavlink
 			return NULL;
 		}
 		return &mavlink_message_crcs[low];
+#endif // MAVLINK_MESSAGE_CRCS_HASH_INDEX
+	}
+#endif // MAVLINK_GET_MSG_ENTRY
+
+	/*
+  return the crc_extra value for a message
+*/
+	MAVLINK_HELPER uint8_t mavlink_get_crc_extra(const mavlink_message_t *msg)
+	{
+		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msg->msgid);
+		return e ? e->crc_extra : 0;
+	}
+
+/*
+  return the min message length
+*/
+#define MAVLINK_HAVE_MIN_MESSAGE_LENGTH
+	MAVLINK_HELPER uint8_t mavlink_min_message_length(const mavlink_message_t *msg)
+	{
+		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msg->msgid);
+		return e ? e->min_msg_len : 0;
+	}
+
+/*
+  return the max message length (including extensions)
+*/
+#define MAVLINK_HAVE_MAX_MESSAGE_LENGTH
+	MAVLINK_HELPER uint8_t mavlink_max_message_length(const mavlink_message_t *msg)
+	{
+		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msg->msgid);
+		return e ? e->max_msg_len : 0;
+	}
+
+#define MAVLINK_HAVE_RX_STATS
+
+	/**
+ * @brief Clear a receive statistics block
+ *
+ * Attach it to a channel afterwards with status->stats = stats
+ */
+	MAVLINK_HELPER void mavlink_rx_stats_init(mavlink_rx_stats_t *stats)
+	{
+		memset(stats, 0, sizeof(*stats));
+	}
+
+	/*
+  probe start for a key in one of the open addressed stats tables
+*/
+	static inline uint32_t _mav_rx_stats_hash(uint32_t key, uint32_t num_slots)
+	{
+		return ((uint32_t)(key * 0x9e3779b1U) >> 16) & (num_slots - 1);
+	}
+
+	/**
+ * @brief Look up the histogram entry of a msgid
+ *
+ * @return the entry, or NULL if the msgid was never counted
+ */
+	MAVLINK_HELPER const mavlink_rx_stats_msg_t *mavlink_rx_stats_find_msg(const mavlink_rx_stats_t *stats, uint32_t msgid)
+	{
+		uint32_t key = msgid + 1;
+		uint32_t slot = _mav_rx_stats_hash(key, MAVLINK_RX_STATS_MSG_SLOTS);
+		uint32_t i;
+		for (i = 0; i < MAVLINK_RX_STATS_MSG_SLOTS; i++)
+		{
+			const mavlink_rx_stats_msg_t *m = &stats->msgs[(slot + i) & (MAVLINK_RX_STATS_MSG_SLOTS - 1)];
+			if (m->key == key)
+			{
+				return m;
+			}
+			if (m->key == 0)
+			{
+				break;
+			}
+		}
+		return NULL;
+	}
+
+	/**
+ * @brief Look up the sequence tracking of a (sysid, compid)
+ *
+ * @return the entry, or NULL if no good frame came from that peer
+ */
+	MAVLINK_HELPER const mavlink_rx_stats_peer_t *mavlink_rx_stats_find_peer(const mavlink_rx_stats_t *stats, uint8_t sysid, uint8_t compid)
+	{
+		uint32_t key = (((uint32_t)sysid << 8) | compid) + 1;
+		uint32_t slot = _mav_rx_stats_hash(key, MAVLINK_RX_STATS_PEER_SLOTS);
+		uint32_t i;
+		for (i = 0; i < MAVLINK_RX_STATS_PEER_SLOTS; i++)
+		{
+			const mavlink_rx_stats_peer_t *p = &stats->peers[(slot + i) & (MAVLINK_RX_STATS_PEER_SLOTS - 1)];
+			if (p->key == key)
+			{
+				return p;
+			}
+			if (p->key == 0)
+			{
+				break;
+			}
+		}
+		return NULL;
+	}
+
+	/*
+  account for a frame that the parser just completed. Entries are
+  never removed, so a linear probe stops at the key or the first free
+  slot, normally on the first probe
+*/
+	MAVLINK_HELPER void _mav_rx_stats_frame(mavlink_rx_stats_t *stats, const mavlink_message_t *rxmsg, uint8_t framing)
+	{
+		bool mavlink1 = (rxmsg->magic == MAVLINK_STX_MAVLINK1);
+		uint32_t bytes = (mavlink1 ? MAVLINK_CORE_HEADER_MAVLINK1_LEN : MAVLINK_CORE_HEADER_LEN) + 1 +
+						 rxmsg->len + MAVLINK_NUM_CHECKSUM_BYTES;
+		uint32_t key, slot, i;
+
+		if (!mavlink1 && (rxmsg->incompat_flags & MAVLINK_IFLAG_SIGNED))
+		{
+			bytes += MAVLINK_SIGNATURE_BLOCK_LEN;
+		}
+		stats->bytes += bytes;
+
+		/*
+	  a signed frame with a bad CRC is reported again once its
+	  signature is in, so go by the checksum rather than framing
+	*/
+		if (rxmsg->checksum != (uint16_t)(rxmsg->ck[0] | (rxmsg->ck[1] << 8)))
+		{
+			stats->crc_errors++;
+			return;
+		}
+		if (framing != MAVLINK_FRAMING_OK)
+		{
+			stats->signature_errors++;
+			return;
+		}
+		stats->frames++;
+
+		key = rxmsg->msgid + 1;
+		slot = _mav_rx_stats_hash(key, MAVLINK_RX_STATS_MSG_SLOTS);
+		for (i = 0; i < MAVLINK_RX_STATS_MSG_SLOTS; i++)
+		{
+			mavlink_rx_stats_msg_t *m = &stats->msgs[(slot + i) & (MAVLINK_RX_STATS_MSG_SLOTS - 1)];
+			if (m->key == 0)
+			{
+				m->key = key;
+			}
+			if (m->key == key)
+			{
+				m->count++;
+				m->bytes += bytes;
+				break;
+			}
+		}
+		if (i == MAVLINK_RX_STATS_MSG_SLOTS)
+		{
+			stats->untracked_msgs++;
+		}
+
+		key = (((uint32_t)rxmsg->sysid << 8) | rxmsg->compid) + 1;
+		slot = _mav_rx_stats_hash(key, MAVLINK_RX_STATS_PEER_SLOTS);
+		for (i = 0; i < MAVLINK_RX_STATS_PEER_SLOTS; i++)
+		{
+			mavlink_rx_stats_peer_t *p = &stats->peers[(slot + i) & (MAVLINK_RX_STATS_PEER_SLOTS - 1)];
+			if (p->key == 0)
+			{
+				p->key = key;
+			}
+			else if (p->key == key)
+			{
+				uint8_t gap = (uint8_t)(rxmsg->seq - p->last_seq - 1);
+				p->seq_gaps += gap;
+				stats->seq_gaps += gap;
+			}
+			else
+			{
+				continue;
+			}
+			p->last_seq = rxmsg->seq;
+			p->frames++;
+			break;
+		}
+		if (i == MAVLINK_RX_STATS_PEER_SLOTS)
+		{
+			stats->untracked_peers++;
+		}
+	}
+
+#define MAVLINK_HAVE_RX_FILTER
+
+	/**
+ * @brief Clear a msgid filter
+ *
+ * Attach it to a channel afterwards with status->filter = filter
+ *
+ * @param pass_unlisted true to pass msgids without a rule, false to only pass the ones given to mavlink_rx_filter_set()
+ */
+	MAVLINK_HELPER void mavlink_rx_filter_init(mavlink_rx_filter_t *filter, bool pass_unlisted)
+	{
+		memset(filter, 0, sizeof(*filter));
+		filter->pass_unlisted = pass_unlisted;
 	}
-#endif // MAVLINK_GET_MSG_ENTRY
 
 	/*
-  return the crc_extra value for a message
+  find the rule for a msgid, or the free slot it belongs in
 */
-	MAVLINK_HELPER uint8_t mavlink_get_crc_extra(const mavlink_message_t *msg)
+	static inline mavlink_rx_filter_entry_t *_mav_rx_filter_slot(mavlink_rx_filter_t *filter, uint32_t msgid)
 	{
-		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msg->msgid);
-		return e ? e->crc_extra : 0;
+		uint32_t key = msgid + 1;
+		uint32_t slot = _mav_rx_stats_hash(key, MAVLINK_RX_FILTER_SLOTS);
+		uint32_t i;
+		for (i = 0; i < MAVLINK_RX_FILTER_SLOTS; i++)
+		{
+			mavlink_rx_filter_entry_t *e = &filter->entries[(slot + i) & (MAVLINK_RX_FILTER_SLOTS - 1)];
+			if (e->key == key || e->key == 0)
+			{
+				return e;
+			}
+		}
+		return NULL;
 	}
 
-/*
-  return the min message length
-*/
-#define MAVLINK_HAVE_MIN_MESSAGE_LENGTH
-	MAVLINK_HELPER uint8_t mavlink_min_message_length(const mavlink_message_t *msg)
+	/**
+ * @brief Set the rule for a msgid
+ *
+ * @param every 1 to pass every frame, N to pass the first of every N frames, 0 to drop them all
+ *
+ * @return false if the filter has no room for another msgid
+ */
+	MAVLINK_HELPER bool mavlink_rx_filter_set(mavlink_rx_filter_t *filter, uint32_t msgid, uint16_t every)
 	{
-		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msg->msgid);
-		return e ? e->min_msg_len : 0;
+		mavlink_rx_filter_entry_t *e = _mav_rx_filter_slot(filter, msgid);
+		if (e == NULL)
+		{
+			return false;
+		}
+		e->key = msgid + 1;
+		e->every = every;
+		e->count = 0;
+		return true;
 	}
 
-/*
-  return the max message length (including extensions)
+	/*
+  decide on a frame as soon as its msgid is known. A rejected frame
+  moves the parser to MAVLINK_PARSE_STATE_SKIP_FRAME for the rest of its
+  payload, CRC and signature. Decimation counts frames before their CRC
+  is checked
 */
-#define MAVLINK_HAVE_MAX_MESSAGE_LENGTH
-	MAVLINK_HELPER uint8_t mavlink_max_message_length(const mavlink_message_t *msg)
+	static inline bool _mav_rx_filter_skip(mavlink_status_t *status, const mavlink_message_t *rxmsg)
 	{
-		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msg->msgid);
-		return e ? e->max_msg_len : 0;
+		mavlink_rx_filter_t *filter = status->filter;
+		mavlink_rx_filter_entry_t *e = _mav_rx_filter_slot(filter, rxmsg->msgid);
+		bool pass;
+
+		if (e == NULL || e->key == 0)
+		{
+			pass = filter->pass_unlisted;
+		}
+		else
+		{
+			pass = e->every != 0 && e->count == 0;
+			if (e->every != 0 && ++e->count >= e->every)
+			{
+				e->count = 0;
+			}
+		}
+		if (pass)
+		{
+			return false;
+		}
+
+		filter->rejected++;
+		status->skip_wait = rxmsg->len + MAVLINK_NUM_CHECKSUM_BYTES;
+		if (rxmsg->magic != MAVLINK_STX_MAVLINK1 && (rxmsg->incompat_flags & MAVLINK_IFLAG_SIGNED))
+		{
+			status->skip_wait += MAVLINK_SIGNATURE_BLOCK_LEN;
+		}
+		status->parse_state = MAVLINK_PARSE_STATE_SKIP_FRAME;
+		return true;
 	}
 
 	/**
@@ -1137,6 +2261,10 @@ namespace mavlink
 					break;
 				}
 #endif
+				if (status->filter != NULL)
+				{
+					_mav_rx_filter_skip(status, rxmsg);
+				}
 			}
 			else
 			{
@@ -1170,6 +2298,17 @@ namespace mavlink
 				break;
 			}
 #endif
+			if (status->filter != NULL)
+			{
+				_mav_rx_filter_skip(status, rxmsg);
+			}
+			break;
+
+		case MAVLINK_PARSE_STATE_SKIP_FRAME:
+			if (--status->skip_wait == 0)
+			{
+				status->parse_state = MAVLINK_PARSE_STATE_IDLE;
+			}
 			break;
 
 		case MAVLINK_PARSE_STATE_GOT_MSGID3:
@@ -1249,212 +2388,489 @@ namespace mavlink
 #ifdef ENCRYPTION
 				if (rxmsg->msgid != 0 && rxmsg->msgid != 10000 && rxmsg->msgid != 10010)
 				{
-#ifdef CHACHA20
-					uint8_t key[] = {
-						0x00, 0x01, 0x02, 0x03,
-						0x04, 0x05, 0x06, 0x07,
-						0x08, 0x09, 0x0a, 0x0b,
-						0x0c, 0x0d, 0x0e, 0x0f,
-						0x10, 0x11, 0x12, 0x13,
-						0x14, 0x15, 0x16, 0x17,
-						0x18, 0x19, 0x1a, 0x1b,
-						0x1c, 0x1d, 0x1e, 0x1f};
-					uint8_t nonce[] = {
-						0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00};
-
-					uint8_t decrypt[rxmsg->len];
-
-					ChaCha20XOR(key, 1, nonce, (uint8_t *)_MAV_PAYLOAD(rxmsg), (uint8_t *)decrypt, rxmsg->len);
-					memcpy((uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), decrypt, sizeof(decrypt));
-#endif
-
-#ifdef TRIVIUM
-					//initialize key
-					uint8_t key[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99};
-
-					//initialize initial vector
-					uint8_t iv[] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x01, 0x23};
-
-					//encrypt payload
-					trivium((uint8_t *)key, (uint8_t *)iv, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
-#endif
-
-#ifdef RABBIT
-
-					//128 bits key
-					const uint8_t key[] =
-						{
-							0x9f, 0x45, 0xd6, 0x2b,
-							0x00, 0xb3, 0xc5, 0x82,
-							0x10, 0x49, 0x2c, 0x95,
-							0x48, 0xff, 0x81, 0x48};
-					//64 bits iv
-					const uint8_t iv[] = {
-						0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77};
-
-					uint8_t decrypt[rxmsg->len];
-					//decrypt payload
-					rabbit((uint8_t *)iv, (uint8_t *)key, (uint8_t *)_MAV_PAYLOAD(rxmsg), decrypt, rxmsg->len);
-					//copy encrypted payload in msg
-					memcpy((uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), decrypt, sizeof(decrypt));
-#endif
-#ifdef SIMON6496
-					uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b, 0x10, 0x11, 0x12, 0x13};
-					uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
-
-					Simon6496(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
-#endif
-
-#ifdef SIMON64128
-					uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-					uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
-
-					Simon64128(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
+					key_status_t *remote_key = _mav_peer_key_cached(status, &status->rx_key_cache, rxmsg->sysid, rxmsg->compid);
+					_mav_remote_key_cipher(remote_key)->xor_stream(remote_key, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
+				}
 #endif
 
-#ifdef SIMON128128
-					uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-					uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-
-					Simon128128(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
-#endif
+				status->parse_state = MAVLINK_PARSE_STATE_IDLE;
+				if (r_message != NULL)
+				{
+					memcpy(r_message, rxmsg, sizeof(mavlink_message_t));
+				}
+			}
+			break;
+		case MAVLINK_PARSE_STATE_SIGNATURE_WAIT:
+			rxmsg->signature[MAVLINK_SIGNATURE_BLOCK_LEN - status->signature_wait] = c;
+			status->signature_wait--;
+			if (status->signature_wait == 0)
+			{
+				// we have the whole signature, check it is OK
+				bool sig_ok = mavlink_signature_check(status->signing, status->signing_streams, rxmsg);
+				if (!sig_ok &&
+					(status->signing->accept_unsigned_callback &&
+					 status->signing->accept_unsigned_callback(status, rxmsg->msgid)))
+				{
+					// accepted via application level override
+					sig_ok = true;
+				}
+				if (sig_ok)
+				{
+					status->msg_received = MAVLINK_FRAMING_OK;
+				}
+				else
+				{
+					status->msg_received = MAVLINK_FRAMING_BAD_SIGNATURE;
+				}
+				status->parse_state = MAVLINK_PARSE_STATE_IDLE;
+				if (r_message != NULL)
+				{
+					memcpy(r_message, rxmsg, sizeof(mavlink_message_t));
+				}
+			}
+			break;
+		}
 
-#ifdef SIMON128192
-					uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-					uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+		bufferIndex++;
+		if (status->stats != NULL && status->msg_received != MAVLINK_FRAMING_INCOMPLETE &&
+			status->parse_state == MAVLINK_PARSE_STATE_IDLE)
+		{
+			_mav_rx_stats_frame(status->stats, rxmsg, status->msg_received);
+		}
+		// If a message has been sucessfully decoded, check index
+		if (status->msg_received == MAVLINK_FRAMING_OK)
+		{
+			//while(status->current_seq != rxmsg->seq)
+			//{
+			//	status->packet_rx_drop_count++;
+			//               status->current_seq++;
+			//}
+			status->current_rx_seq = rxmsg->seq;
+			// Initial condition: If no packet has been received so far, drop count is undefined
+			if (status->packet_rx_success_count == 0)
+				status->packet_rx_drop_count = 0;
+			// Count this packet as received
+			status->packet_rx_success_count++;
+		}
 
-					Simon128192(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
-#endif
+		if (r_message != NULL)
+		{
+			r_message->len = rxmsg->len; // Provide visibility on how far we are into current msg
+		}
+		if (r_mavlink_status != NULL)
+		{
+			r_mavlink_status->parse_state = status->parse_state;
+			r_mavlink_status->packet_idx = status->packet_idx;
+			r_mavlink_status->current_rx_seq = status->current_rx_seq + 1;
+			r_mavlink_status->packet_rx_success_count = status->packet_rx_success_count;
+			r_mavlink_status->packet_rx_drop_count = status->parse_error;
+			r_mavlink_status->flags = status->flags;
+		}
+		status->parse_error = 0;
 
-#ifdef SIMON128256
-					uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-					uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+		if (status->msg_received == MAVLINK_FRAMING_BAD_CRC)
+		{
+			/*
+		  the CRC came out wrong. We now need to overwrite the
+		  msg CRC with the one on the wire so that if the
+		  caller decides to forward the message anyway that
+		  mavlink_msg_to_send_buffer() won't overwrite the
+		  checksum
+		 */
+			if (r_message != NULL)
+			{
+				r_message->checksum = rxmsg->ck[0] | (rxmsg->ck[1] << 8);
+			}
+		}
 
-					Simon128256(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
-#endif
+		return status->msg_received;
+	}
 
-#ifdef SPECK6496
-					uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b, 0x10, 0x11, 0x12, 0x13};
-					uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
+#define MAVLINK_HAVE_FRAME_BUFFER
 
-					Speck6496(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
+	/**
+ * @brief Find the next possible start of frame in a byte buffer
+ *
+ * Looks for either the MAVLink2 or the MAVLink1 marker, 16 bytes at a time
+ * when SSE2 is available.
+ *
+ * @return offset of the first marker, or len if there is none
+ */
+	MAVLINK_HELPER size_t _mav_find_stx(const uint8_t *buf, size_t len)
+	{
+		size_t i = 0;
+#if defined(__SSE2__)
+		const __m128i stx = _mm_set1_epi8((char)MAVLINK_STX);
+		const __m128i stx1 = _mm_set1_epi8((char)MAVLINK_STX_MAVLINK1);
+		for (; i + 16 <= len; i += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)&buf[i]);
+			int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, stx), _mm_cmpeq_epi8(v, stx1)));
+			if (mask != 0)
+			{
+				return i + __builtin_ctz(mask);
+			}
+		}
 #endif
+		for (; i < len; i++)
+		{
+			if (buf[i] == MAVLINK_STX || buf[i] == MAVLINK_STX_MAVLINK1)
+			{
+				return i;
+			}
+		}
+		return len;
+	}
 
-#ifdef SPECK64128
-					uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-					uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b};
+	/**
+ * @brief Take the header and payload of a frame in one step
+ *
+ * buf must start with a start of frame marker and the parser must be idle.
+ * If the whole header and payload are in buf they are copied into rxmsg,
+ * the CRC is run over the block and the parser is left in
+ * MAVLINK_PARSE_STATE_GOT_PAYLOAD, exactly as if the bytes had been fed
+ * through mavlink_frame_char_buffer() one at a time.
+ *
+ * @return number of bytes consumed, or 0 if the frame has to go through the byte parser
+ */
+	MAVLINK_HELPER size_t _mav_frame_block(mavlink_message_t *rxmsg, mavlink_status_t *status,
+										   const uint8_t *buf, size_t len)
+	{
+		bool mavlink1 = (buf[0] == MAVLINK_STX_MAVLINK1);
+		uint8_t header_len = mavlink1 ? MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 : MAVLINK_CORE_HEADER_LEN + 1;
+		uint8_t payload_len;
 
-					Speck64128(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
+		if (len < header_len)
+		{
+			return 0;
+		}
+		payload_len = buf[1];
+#if (MAVLINK_MAX_PAYLOAD_LEN < 255)
+		if (payload_len > MAVLINK_MAX_PAYLOAD_LEN)
+		{
+			return 0;
+		}
 #endif
+		if (len < (size_t)header_len + payload_len)
+		{
+			return 0;
+		}
+		if (!mavlink1 && (buf[2] & ~MAVLINK_IFLAG_MASK) != 0)
+		{
+			// let the byte parser account for the bad flags
+			return 0;
+		}
 
-#ifdef SPECK128128
-					uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-					uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-
-					Speck128128(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
+		rxmsg->magic = buf[0];
+		rxmsg->len = payload_len;
+		if (mavlink1)
+		{
+			status->flags |= MAVLINK_STATUS_FLAG_IN_MAVLINK1;
+			rxmsg->incompat_flags = 0;
+			rxmsg->compat_flags = 0;
+			rxmsg->seq = buf[2];
+			rxmsg->sysid = buf[3];
+			rxmsg->compid = buf[4];
+			rxmsg->msgid = buf[5];
+		}
+		else
+		{
+			status->flags &= ~MAVLINK_STATUS_FLAG_IN_MAVLINK1;
+			rxmsg->incompat_flags = buf[2];
+			rxmsg->compat_flags = buf[3];
+			rxmsg->seq = buf[4];
+			rxmsg->sysid = buf[5];
+			rxmsg->compid = buf[6];
+			rxmsg->msgid = buf[7] | (buf[8] << 8) | ((uint32_t)buf[9] << 16);
+		}
+#ifdef MAVLINK_CHECK_MESSAGE_LENGTH
+		if (rxmsg->len < mavlink_min_message_length(rxmsg) ||
+			rxmsg->len > mavlink_max_message_length(rxmsg))
+		{
+			return 0;
+		}
 #endif
+		if (status->filter != NULL && _mav_rx_filter_skip(status, rxmsg))
+		{
+			// the rest of the frame goes through the bulk skip in _mav_frame_buffer_next()
+			status->msg_received = MAVLINK_FRAMING_INCOMPLETE;
+			return header_len;
+		}
+		memcpy(_MAV_PAYLOAD_NON_CONST(rxmsg), &buf[header_len], payload_len);
+		rxmsg->checksum = crc_calculate(&buf[1], header_len - 1 + payload_len);
 
-#ifdef SPECK128192
-					key_status_t *remote_key = mavlink_get_remote_key(0);
-					Speck128192(remote_key->iv, remote_key->shared_key, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
-
-#endif
+		status->msg_received = MAVLINK_FRAMING_INCOMPLETE;
+		status->packet_idx = payload_len;
+		status->parse_state = MAVLINK_PARSE_STATE_GOT_PAYLOAD;
+		return header_len + payload_len;
+	}
 
-#ifdef SPECK128256
-					uint8_t k[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-					uint8_t nonce[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+	/**
+ * @brief Parse bytes from a buffer until one frame is complete
+ *
+ * @param consumed set to the number of bytes of buf that were used
+ *
+ * @return MAVLINK_FRAMING_INCOMPLETE if all of buf was used without completing a frame,
+ *         otherwise the framing result of the frame now in rxmsg
+ */
+	MAVLINK_HELPER uint8_t _mav_frame_buffer_next(mavlink_message_t *rxmsg, mavlink_status_t *status,
+												  const uint8_t *buf, size_t len, size_t *consumed)
+	{
+		size_t i = 0;
+		uint8_t framing = MAVLINK_FRAMING_INCOMPLETE;
 
-					Speck128256(nonce, k, (uint8_t *)_MAV_PAYLOAD_NON_CONST(rxmsg), rxmsg->len);
-#endif
+		while (i < len && framing == MAVLINK_FRAMING_INCOMPLETE)
+		{
+			if (status->parse_state == MAVLINK_PARSE_STATE_UNINIT ||
+				status->parse_state == MAVLINK_PARSE_STATE_IDLE)
+			{
+				i += _mav_find_stx(&buf[i], len - i);
+				if (i == len)
+				{
+					break;
 				}
-#endif
-
-				status->parse_state = MAVLINK_PARSE_STATE_IDLE;
-				if (r_message != NULL)
+				size_t n = _mav_frame_block(rxmsg, status, &buf[i], len - i);
+				if (n != 0)
 				{
-					memcpy(r_message, rxmsg, sizeof(mavlink_message_t));
+					i += n;
+					continue;
 				}
 			}
-			break;
-		case MAVLINK_PARSE_STATE_SIGNATURE_WAIT:
-			rxmsg->signature[MAVLINK_SIGNATURE_BLOCK_LEN - status->signature_wait] = c;
-			status->signature_wait--;
-			if (status->signature_wait == 0)
+			else if (status->parse_state == MAVLINK_PARSE_STATE_SKIP_FRAME)
+			{
+				// drop the rest of a filtered frame in one go
+				size_t n = status->skip_wait;
+				if (n > len - i)
+				{
+					n = len - i;
+				}
+				status->skip_wait -= n;
+				i += n;
+				if (status->skip_wait == 0)
+				{
+					status->parse_state = MAVLINK_PARSE_STATE_IDLE;
+				}
+				continue;
+			}
+			else if (status->parse_state == MAVLINK_PARSE_STATE_SIGNATURE_WAIT && status->signature_wait > 1)
+			{
+				// copy all but the last signature byte, which triggers the check
+				size_t n = status->signature_wait - 1;
+				if (n > len - i)
+				{
+					n = len - i;
+				}
+				memcpy(&rxmsg->signature[MAVLINK_SIGNATURE_BLOCK_LEN - status->signature_wait], &buf[i], n);
+				status->signature_wait -= n;
+				i += n;
+				continue;
+			}
+
+			framing = mavlink_frame_char_buffer(rxmsg, status, buf[i++], NULL, NULL);
+		}
+		if (framing == MAVLINK_FRAMING_BAD_CRC)
+		{
+			// hand out the CRC from the wire, as mavlink_frame_char_buffer() does
+			rxmsg->checksum = rxmsg->ck[0] | (rxmsg->ck[1] << 8);
+		}
+		*consumed = i;
+		return framing;
+	}
+
+	/**
+ * This is a variant of mavlink_frame_char_buffer() that takes a whole block
+ * of received bytes at once. Start of frame markers are found with a vector
+ * scan, the header and payload of each frame are copied in one go and the
+ * CRC is run over the whole block. Frames that are split across two calls,
+ * or that need special handling, continue through the byte parser, so all
+ * parsing state stays in status and rxmsg and the next call resumes where
+ * this one stopped.
+ *
+ * @param rxmsg    parsing message buffer
+ * @param status   parsing status buffer
+ * @param buf      received bytes
+ * @param len      number of bytes in buf
+ * @param callback called once for each completed frame (good, bad CRC or bad signature), may be NULL
+ * @param arg      passed through to callback
+ *
+ * The message handed to the callback is rxmsg itself. It is only valid until
+ * the callback returns.
+ *
+ * @return number of completed frames
+ */
+	MAVLINK_HELPER size_t mavlink_frame_buffer(mavlink_message_t *rxmsg,
+											   mavlink_status_t *status,
+											   const uint8_t *buf, size_t len,
+											   mavlink_frame_callback_t callback, void *arg)
+	{
+		size_t i = 0;
+		size_t frames = 0;
+
+		while (i < len)
+		{
+			size_t n;
+			uint8_t framing = _mav_frame_buffer_next(rxmsg, status, &buf[i], len - i, &n);
+			i += n;
+			if (framing != MAVLINK_FRAMING_INCOMPLETE)
 			{
-				// we have the whole signature, check it is OK
-				bool sig_ok = mavlink_signature_check(status->signing, status->signing_streams, rxmsg);
-				if (!sig_ok &&
-					(status->signing->accept_unsigned_callback &&
-					 status->signing->accept_unsigned_callback(status, rxmsg->msgid)))
-				{
-					// accepted via application level override
-					sig_ok = true;
-				}
-				if (sig_ok)
-				{
-					status->msg_received = MAVLINK_FRAMING_OK;
-				}
-				else
-				{
-					status->msg_received = MAVLINK_FRAMING_BAD_SIGNATURE;
-				}
-				status->parse_state = MAVLINK_PARSE_STATE_IDLE;
-				if (r_message != NULL)
+				frames++;
+				if (callback != NULL)
 				{
-					memcpy(r_message, rxmsg, sizeof(mavlink_message_t));
+					callback(arg, framing, rxmsg, status);
 				}
 			}
-			break;
 		}
+		return frames;
+	}
 
-		bufferIndex++;
-		// If a message has been sucessfully decoded, check index
-		if (status->msg_received == MAVLINK_FRAMING_OK)
+#define MAVLINK_HAVE_RX_RING
+
+	/**
+ * @brief Set up a receive ring over caller owned message slots
+ *
+ * @param slots     array of num_slots messages, must outlive the ring
+ * @param num_slots number of slots, at most MAVLINK_RX_RING_MAX_SLOTS
+ */
+	MAVLINK_HELPER void mavlink_rx_ring_init(mavlink_rx_ring_t *ring, mavlink_message_t *slots, uint8_t num_slots)
+	{
+		if (num_slots > MAVLINK_RX_RING_MAX_SLOTS)
 		{
-			//while(status->current_seq != rxmsg->seq)
-			//{
-			//	status->packet_rx_drop_count++;
-			//               status->current_seq++;
-			//}
-			status->current_rx_seq = rxmsg->seq;
-			// Initial condition: If no packet has been received so far, drop count is undefined
-			if (status->packet_rx_success_count == 0)
-				status->packet_rx_drop_count = 0;
-			// Count this packet as received
-			status->packet_rx_success_count++;
+			num_slots = MAVLINK_RX_RING_MAX_SLOTS;
 		}
+		ring->slots = slots;
+		ring->num_slots = num_slots;
+		ring->parse_slot = MAVLINK_RX_RING_NO_SLOT;
+		ring->busy = 0;
+	}
 
-		if (r_message != NULL)
+	/**
+ * @brief Return the slot the parser fills next, taking a free one if needed
+ *
+ * @return NULL if every slot is handed out
+ */
+	MAVLINK_HELPER mavlink_message_t *_mav_rx_ring_parse_slot(mavlink_rx_ring_t *ring)
+	{
+		uint8_t i;
+		if (ring->parse_slot != MAVLINK_RX_RING_NO_SLOT)
 		{
-			r_message->len = rxmsg->len; // Provide visibility on how far we are into current msg
+			return &ring->slots[ring->parse_slot];
 		}
-		if (r_mavlink_status != NULL)
+		for (i = 0; i < ring->num_slots; i++)
 		{
-			r_mavlink_status->parse_state = status->parse_state;
-			r_mavlink_status->packet_idx = status->packet_idx;
-			r_mavlink_status->current_rx_seq = status->current_rx_seq + 1;
-			r_mavlink_status->packet_rx_success_count = status->packet_rx_success_count;
-			r_mavlink_status->packet_rx_drop_count = status->parse_error;
-			r_mavlink_status->flags = status->flags;
+			if ((ring->busy & (1ULL << i)) == 0)
+			{
+				ring->busy |= 1ULL << i;
+				ring->parse_slot = i;
+				return &ring->slots[i];
+			}
 		}
-		status->parse_error = 0;
+		return NULL;
+	}
 
-		if (status->msg_received == MAVLINK_FRAMING_BAD_CRC)
+	/**
+ * @brief Hand out the slot holding a completed frame
+ */
+	MAVLINK_HELPER void _mav_rx_ring_hand_out(mavlink_rx_ring_t *ring, uint8_t framing, mavlink_message_view_t *view)
+	{
+		const mavlink_message_t *msg = &ring->slots[ring->parse_slot];
+		view->msg = msg;
+		view->payload = (const uint8_t *)_MAV_PAYLOAD(msg);
+		view->len = msg->len;
+		view->signature = (msg->incompat_flags & MAVLINK_IFLAG_SIGNED) ? msg->signature : NULL;
+		view->framing = framing;
+		view->slot = ring->parse_slot;
+		ring->parse_slot = MAVLINK_RX_RING_NO_SLOT;
+	}
+
+	/**
+ * This is a variant of mavlink_frame_char_buffer() that parses straight
+ * into a slot of a caller owned receive ring instead of copying each
+ * completed message out of a parse buffer.
+ *
+ * @param ring     receive ring, set up with mavlink_rx_ring_init()
+ * @param status   parsing status buffer
+ * @param c        The char to parse
+ * @param view     filled in when a frame completes. The slot stays handed out
+ *                 until it is given back with mavlink_rx_ring_release()
+ *
+ * If every slot is handed out the byte is dropped and counted as a buffer
+ * overrun, the parser only ever takes a new slot between frames.
+ *
+ * @return 0 if no message could be decoded, otherwise the framing result as for mavlink_frame_char_buffer()
+ */
+	MAVLINK_HELPER uint8_t mavlink_frame_char_view(mavlink_rx_ring_t *ring, mavlink_status_t *status,
+												   uint8_t c, mavlink_message_view_t *view)
+	{
+		mavlink_message_t *rxmsg = _mav_rx_ring_parse_slot(ring);
+		uint8_t framing;
+		if (rxmsg == NULL)
 		{
-			/*
-		  the CRC came out wrong. We now need to overwrite the
-		  msg CRC with the one on the wire so that if the
-		  caller decides to forward the message anyway that
-		  mavlink_msg_to_send_buffer() won't overwrite the
-		  checksum
-		 */
-			if (r_message != NULL)
+			status->buffer_overrun++;
+			return MAVLINK_FRAMING_INCOMPLETE;
+		}
+		framing = mavlink_frame_char_buffer(rxmsg, status, c, NULL, NULL);
+		if (framing != MAVLINK_FRAMING_INCOMPLETE)
+		{
+			if (framing == MAVLINK_FRAMING_BAD_CRC)
 			{
-				r_message->checksum = rxmsg->ck[0] | (rxmsg->ck[1] << 8);
+				rxmsg->checksum = rxmsg->ck[0] | (rxmsg->ck[1] << 8);
 			}
+			_mav_rx_ring_hand_out(ring, framing, view);
 		}
+		return framing;
+	}
 
-		return status->msg_received;
+	/**
+ * This is a variant of mavlink_frame_buffer() that parses straight into a
+ * slot of a caller owned receive ring. It stops after each completed frame,
+ * so callers loop until all of buf is used:
+ *
+ * @code
+ * while (len > 0) {
+ *     size_t n = mavlink_frame_buffer_view(&ring, &status, buf, len, &view);
+ *     if (n == 0) {
+ *         break; // all slots handed out, release some and try again
+ *     }
+ *     buf += n;
+ *     len -= n;
+ *     if (view.framing != MAVLINK_FRAMING_INCOMPLETE) {
+ *         handle(&view); // calls mavlink_rx_ring_release() when done
+ *     }
+ * }
+ * @endcode
+ *
+ * @param view     view.framing is MAVLINK_FRAMING_INCOMPLETE unless a frame completed
+ *
+ * @return number of bytes of buf used, 0 if no slot is free
+ */
+	MAVLINK_HELPER size_t mavlink_frame_buffer_view(mavlink_rx_ring_t *ring, mavlink_status_t *status,
+													const uint8_t *buf, size_t len, mavlink_message_view_t *view)
+	{
+		mavlink_message_t *rxmsg = _mav_rx_ring_parse_slot(ring);
+		size_t n;
+		uint8_t framing;
+		view->framing = MAVLINK_FRAMING_INCOMPLETE;
+		if (rxmsg == NULL)
+		{
+			return 0;
+		}
+		framing = _mav_frame_buffer_next(rxmsg, status, buf, len, &n);
+		if (framing != MAVLINK_FRAMING_INCOMPLETE)
+		{
+			_mav_rx_ring_hand_out(ring, framing, view);
+		}
+		return n;
+	}
+
+	/**
+ * @brief Give a slot handed out by the ring back for parsing
+ */
+	MAVLINK_HELPER void mavlink_rx_ring_release(mavlink_rx_ring_t *ring, const mavlink_message_view_t *view)
+	{
+		if (view->slot < ring->num_slots && view->slot != ring->parse_slot)
+		{
+			ring->busy &= ~(1ULL << view->slot);
+		}
 	}
 
 	/**
@@ -1509,6 +2925,19 @@ namespace mavlink
 										 r_mavlink_status);
 	}
 
+	/**
+ * @brief mavlink_frame_char() on a channel of a context
+ */
+	MAVLINK_HELPER uint8_t mavlink_ctx_frame_char(mavlink_context_t *ctx, uint8_t chan, uint8_t c,
+												  mavlink_message_t *r_message, mavlink_status_t *r_mavlink_status)
+	{
+		return mavlink_frame_char_buffer(mavlink_ctx_get_channel_buffer(ctx, chan),
+										 mavlink_ctx_get_channel_status(ctx, chan),
+										 c,
+										 r_message,
+										 r_mavlink_status);
+	}
+
 	/**
  * Set the protocol version
  */
@@ -1543,6 +2972,59 @@ namespace mavlink
 		}
 	}
 
+	/**
+ * Set the protocol version of a channel of a context
+ */
+	MAVLINK_HELPER void mavlink_ctx_set_proto_version(mavlink_context_t *ctx, uint8_t chan, unsigned int version)
+	{
+		mavlink_status_t *status = mavlink_ctx_get_channel_status(ctx, chan);
+		if (version > 1)
+		{
+			status->flags &= ~(MAVLINK_STATUS_FLAG_OUT_MAVLINK1);
+		}
+		else
+		{
+			status->flags |= MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+		}
+	}
+
+	/**
+ * Get the protocol version of a channel of a context
+ *
+ * @return 1 for v1, 2 for v2
+ */
+	MAVLINK_HELPER unsigned int mavlink_ctx_get_proto_version(mavlink_context_t *ctx, uint8_t chan)
+	{
+		mavlink_status_t *status = mavlink_ctx_get_channel_status(ctx, chan);
+		return (status->flags & MAVLINK_STATUS_FLAG_OUT_MAVLINK1) ? 1 : 2;
+	}
+
+	/**
+ * @brief mavlink_frame_char_buffer() treating bad CRCs and signatures as parse errors
+ */
+	MAVLINK_HELPER uint8_t _mav_parse_char(mavlink_message_t *rxmsg, mavlink_status_t *status, uint8_t c,
+										   mavlink_message_t *r_message, mavlink_status_t *r_mavlink_status)
+	{
+		uint8_t msg_received = mavlink_frame_char_buffer(rxmsg, status, c, r_message, r_mavlink_status);
+		if (msg_received == MAVLINK_FRAMING_BAD_CRC ||
+			msg_received == MAVLINK_FRAMING_BAD_SIGNATURE)
+		{
+			// we got a bad CRC. Treat as a parse failure
+			_mav_parse_error(status);
+			status->msg_received = MAVLINK_FRAMING_INCOMPLETE;
+			status->parse_state = MAVLINK_PARSE_STATE_IDLE;
+			if (c == MAVLINK_STX)
+			{
+				status->parse_state = MAVLINK_PARSE_STATE_GOT_STX;
+				rxmsg->len = 0;
+				mavlink_start_checksum(rxmsg);
+			}
+			return 0;
+		}
+
+		return msg_received;
+	}
+
 	/**
  * This is a convenience function which handles the complete MAVLink parsing.
  * the function will parse one byte at a time and return the complete packet once
@@ -1586,26 +3068,18 @@ namespace mavlink
  */
 	MAVLINK_HELPER uint8_t mavlink_parse_char(uint8_t chan, uint8_t c, mavlink_message_t *r_message, mavlink_status_t *r_mavlink_status)
 	{
-		uint8_t msg_received = mavlink_frame_char(chan, c, r_message, r_mavlink_status);
-		if (msg_received == MAVLINK_FRAMING_BAD_CRC ||
-			msg_received == MAVLINK_FRAMING_BAD_SIGNATURE)
-		{
-			// we got a bad CRC. Treat as a parse failure
-			mavlink_message_t *rxmsg = mavlink_get_channel_buffer(chan);
-			mavlink_status_t *status = mavlink_get_channel_status(chan);
-			_mav_parse_error(status);
-			status->msg_received = MAVLINK_FRAMING_INCOMPLETE;
-			status->parse_state = MAVLINK_PARSE_STATE_IDLE;
-			if (c == MAVLINK_STX)
-			{
-				status->parse_state = MAVLINK_PARSE_STATE_GOT_STX;
-				rxmsg->len = 0;
-				mavlink_start_checksum(rxmsg);
-			}
-			return 0;
-		}
+		return _mav_parse_char(mavlink_get_channel_buffer(chan), mavlink_get_channel_status(chan),
+							   c, r_message, r_mavlink_status);
+	}
 
-		return msg_received;
+	/**
+ * @brief mavlink_parse_char() on a channel of a context
+ */
+	MAVLINK_HELPER uint8_t mavlink_ctx_parse_char(mavlink_context_t *ctx, uint8_t chan, uint8_t c,
+												  mavlink_message_t *r_message, mavlink_status_t *r_mavlink_status)
+	{
+		return _mav_parse_char(mavlink_ctx_get_channel_buffer(ctx, chan), mavlink_ctx_get_channel_status(ctx, chan),
+							   c, r_message, r_mavlink_status);
 	}
 
 	/**
@@ -1734,7 +3208,11 @@ void comm_send_ch(mavlink_channel_t chan, uint8_t ch)
 }
  */
 
+#ifdef MAVLINK_USE_TX_BUFFER
+	MAVLINK_HELPER void _mavlink_send_uart_bytes(mavlink_channel_t chan, const char *buf, uint16_t len)
+#else
 	MAVLINK_HELPER void _mavlink_send_uart(mavlink_channel_t chan, const char *buf, uint16_t len)
+#endif
 	{
 #ifdef MAVLINK_SEND_UART_BYTES
 		/* this is the more efficient approach, if the platform
@@ -1749,6 +3227,178 @@ void comm_send_ch(mavlink_channel_t chan, uint8_t ch)
 		}
 #endif
 	}
+
+#ifdef MAVLINK_USE_TX_BUFFER
+#define MAVLINK_HAVE_TX_BUFFER
+
+	/*
+	  By default deadlines are measured with the POSIX monotonic clock.
+	  Other platforms define MAVLINK_TX_BUFFER_TIME_MS() to return a
+	  millisecond tick
+	*/
+#ifndef MAVLINK_TX_BUFFER_TIME_MS
+	MAVLINK_HELPER uint32_t _mavlink_tx_time_ms(void)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+	}
+#define MAVLINK_TX_BUFFER_TIME_MS() _mavlink_tx_time_ms()
+#endif
+
+	/*
+	  internal function to give access to the transmit buffer of a
+	  channel, held by the context the channel belongs to. Channels past
+	  MAVLINK_COMM_NUM_BUFFERS have no buffer and are sent unbuffered
+	*/
+	MAVLINK_HELPER mavlink_tx_buffer_t *mavlink_get_tx_buffer(uint8_t chan)
+	{
+		mavlink_status_t *status;
+		mavlink_context_t *ctx;
+		if (chan >= MAVLINK_COMM_NUM_BUFFERS)
+		{
+			return NULL;
+		}
+		status = mavlink_get_channel_status(chan);
+		ctx = status->context ? status->context : mavlink_get_default_context();
+		return &ctx->tx_buffer[chan];
+	}
+
+	/**
+ * @brief Set the flush triggers of a channel's transmit buffer
+ *
+ * A trigger of 0 is off. With all of them off, which is the state of a
+ * zeroed context, every frame is sent as soon as it is complete, as
+ * without the buffer. Set at least one trigger to coalesce frames. To
+ * only send when the next frame does not fit or on mavlink_tx_flush(),
+ * set flush_bytes to MAVLINK_TX_BUFFER_SIZE. The deadline is checked
+ * when a frame is queued and by mavlink_tx_poll(). Channels past
+ * MAVLINK_COMM_NUM_BUFFERS are always unbuffered and ignore this.
+ *
+ * @param flush_bytes  flush once this many bytes are waiting
+ * @param flush_frames flush once this many frames are waiting
+ * @param flush_ms     flush once the oldest frame has waited this many milliseconds
+ */
+	MAVLINK_HELPER void mavlink_tx_buffer_config(mavlink_channel_t chan, uint16_t flush_bytes,
+												 uint16_t flush_frames, uint32_t flush_ms)
+	{
+		mavlink_tx_buffer_t *tx = mavlink_get_tx_buffer(chan);
+		if (tx == NULL)
+		{
+			return;
+		}
+		tx->flush_bytes = flush_bytes;
+		tx->flush_frames = flush_frames;
+		tx->flush_ms = flush_ms;
+	}
+
+	/**
+ * @brief Send everything waiting in a channel's transmit buffer
+ *
+ * The whole buffer goes to the driver in one MAVLINK_SEND_UART_BYTES()
+ * call, between one MAVLINK_START_UART_SEND() and MAVLINK_END_UART_SEND()
+ */
+	MAVLINK_HELPER void mavlink_tx_flush(mavlink_channel_t chan)
+	{
+		mavlink_tx_buffer_t *tx = mavlink_get_tx_buffer(chan);
+		uint16_t len;
+		if (tx == NULL || tx->len == 0)
+		{
+			return;
+		}
+		len = tx->len;
+		MAVLINK_START_UART_SEND(chan, len);
+		_mavlink_send_uart_bytes(chan, (const char *)tx->buf, len);
+		MAVLINK_END_UART_SEND(chan, len);
+		tx->len = 0;
+		tx->frames = 0;
+	}
+
+	/**
+ * @brief Flush a channel's transmit buffer if its deadline has passed
+ *
+ * Call this regularly when a deadline is set and frames may be sent
+ * rarely, so that the last few frames do not wait for the next one
+ */
+	MAVLINK_HELPER void mavlink_tx_poll(mavlink_channel_t chan)
+	{
+		mavlink_tx_buffer_t *tx = mavlink_get_tx_buffer(chan);
+		if (tx != NULL && tx->frames != 0 && tx->flush_ms != 0 &&
+			(uint32_t)(MAVLINK_TX_BUFFER_TIME_MS() - tx->first_ms) >= tx->flush_ms)
+		{
+			mavlink_tx_flush(chan);
+		}
+	}
+
+	/*
+	  make room for a whole frame, so that a frame is never split between
+	  two flushes
+	*/
+	MAVLINK_HELPER void _mavlink_tx_start_frame(mavlink_channel_t chan, uint16_t length)
+	{
+		mavlink_tx_buffer_t *tx = mavlink_get_tx_buffer(chan);
+		if (tx == NULL)
+		{
+			MAVLINK_START_UART_SEND(chan, length);
+			return;
+		}
+		if (tx->len + length > MAVLINK_TX_BUFFER_SIZE)
+		{
+			mavlink_tx_flush(chan);
+		}
+		if (tx->frames == 0 && tx->flush_ms != 0)
+		{
+			tx->first_ms = MAVLINK_TX_BUFFER_TIME_MS();
+		}
+	}
+
+	MAVLINK_HELPER void _mavlink_tx_end_frame(mavlink_channel_t chan, uint16_t length)
+	{
+		mavlink_tx_buffer_t *tx = mavlink_get_tx_buffer(chan);
+		if (tx == NULL)
+		{
+			MAVLINK_END_UART_SEND(chan, length);
+			return;
+		}
+		tx->frames++;
+		// with no trigger set the buffer is not in use, send each frame
+		if ((tx->flush_bytes == 0 && tx->flush_frames == 0 && tx->flush_ms == 0) ||
+			(tx->flush_bytes != 0 && tx->len >= tx->flush_bytes) ||
+			(tx->flush_frames != 0 && tx->frames >= tx->flush_frames))
+		{
+			mavlink_tx_flush(chan);
+		}
+		else
+		{
+			mavlink_tx_poll(chan);
+		}
+	}
+
+	/*
+	  queue bytes of the frame being sent
+	*/
+	MAVLINK_HELPER void _mavlink_send_uart(mavlink_channel_t chan, const char *buf, uint16_t len)
+	{
+		mavlink_tx_buffer_t *tx = mavlink_get_tx_buffer(chan);
+		if (tx == NULL)
+		{
+			_mavlink_send_uart_bytes(chan, buf, len);
+			return;
+		}
+		if (tx->len + len > MAVLINK_TX_BUFFER_SIZE)
+		{
+			// only when the caller sends more than a frame between start and end
+			mavlink_tx_flush(chan);
+			if (len > MAVLINK_TX_BUFFER_SIZE)
+			{
+				_mavlink_send_uart_bytes(chan, buf, len);
+				return;
+			}
+		}
+		memcpy(&tx->buf[tx->len], buf, len);
+		tx->len += len;
+	}
+#endif // MAVLINK_USE_TX_BUFFER
 #endif // MAVLINK_USE_CONVENIENCE_FUNCTIONS
 
 #ifdef MAVLINK_USE_CXX_NAMESPACE
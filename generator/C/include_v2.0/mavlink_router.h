@@ -0,0 +1,312 @@
+#pragma once
+
+/*
+  frame router between MAVLink endpoints.
+
+  Bytes from each endpoint go through the parser of that endpoint. Every
+  good frame teaches the router that its (sysid, compid) is reached
+  through the endpoint it came from, and is then forwarded by its
+  target system and component. The targets are read from the payload at
+  the offsets in the message's mavlink_msg_entry_t, nothing is decoded.
+
+  - no target system, or target system 0: all other endpoints
+  - target component 0, or a component not seen yet: every endpoint
+    the target system has been seen on
+  - otherwise the endpoint the target component was last seen on
+
+  Frames are never sent back to the endpoint they came from. A frame
+  with an unknown target system goes nowhere.
+
+  What is forwarded are the bytes as they were received, captured while
+  they are parsed, so signatures, sequence numbers and encrypted
+  payloads reach the other endpoints untouched. The bytes are captured
+  straight into a frame buffer from a caller owned pool. A frame going
+  to several endpoints is queued on each of them with a reference
+  count, and the buffer goes back to the pool when the last endpoint
+  has taken it.
+
+  The router does not check signatures, leave the status signing of the
+  endpoints unset and let the final receivers check them.
+
+  Not thread safe, run input and the endpoint queues on one thread.
+  Enable with MAVLINK_USE_ROUTER.
+ */
+
+#ifdef MAVLINK_USE_ROUTER
+#define MAVLINK_HAVE_ROUTER
+
+#include <string.h>
+
+// endpoints are kept in 64 bit masks
+#ifndef MAVLINK_ROUTER_MAX_ENDPOINTS
+#define MAVLINK_ROUTER_MAX_ENDPOINTS 64
+#endif
+
+// frames queued per endpoint, a power of 2
+#ifndef MAVLINK_ROUTER_QUEUE_LEN
+#define MAVLINK_ROUTER_QUEUE_LEN 64
+#endif
+
+#define MAVLINK_ROUTER_NONE 0xFFFF
+
+#ifdef MAVLINK_USE_CXX_NAMESPACE
+namespace mavlink
+{
+#endif
+
+	typedef struct __mavlink_router_frame
+	{
+		uint16_t refs;                        // endpoint queues holding the frame
+		uint16_t len;                         // bytes in data
+		uint16_t next;                        // next free frame
+		uint8_t data[MAVLINK_MAX_PACKET_LEN]; // the frame as received
+	} mavlink_router_frame_t;
+
+	typedef struct __mavlink_router_endpoint
+	{
+		mavlink_status_t status;                  // parser state
+		mavlink_message_t rxmsg;                  // frame being parsed
+		uint16_t rx_frame;                        // frame the incoming bytes are captured into
+		uint16_t rx_len;                          // bytes captured
+		bool rx_bad_crc;                          // a signed frame had a bad CRC before its signature
+		uint16_t queue[MAVLINK_ROUTER_QUEUE_LEN]; // frames to send
+		uint32_t queue_head;                      // next position to queue at
+		uint32_t queue_tail;                      // next position to send
+		uint32_t rx_frames;                       // good frames received
+		uint32_t rx_bad;                          // frames with a bad CRC or signature
+		uint32_t tx_frames;                       // frames taken out of the queue
+		uint32_t tx_dropped;                      // frames not queued because the queue was full
+	} mavlink_router_endpoint_t;
+
+	typedef struct __mavlink_router
+	{
+		mavlink_router_endpoint_t *endpoints; // caller owned
+		uint8_t num_endpoints;
+		mavlink_router_frame_t *frames; // caller owned pool
+		uint16_t free_head;             // first unused frame
+		uint64_t all_endpoints;         // mask of all endpoints
+		uint64_t system_endpoints[256]; // mask of the endpoints each system was seen on
+		uint8_t routes[256 * 256];      // endpoint + 1 by sysid << 8 | compid, 0 if not seen
+		uint32_t routed;                // frames queued on at least one endpoint
+		uint32_t not_forwarded;         // frames with nowhere to go
+		uint32_t dropped_no_frame;      // frames lost because the pool was empty
+	} mavlink_router_t;
+
+	/**
+ * @brief Set up a router over caller owned endpoints and frames
+ *
+ * @param num_endpoints up to MAVLINK_ROUTER_MAX_ENDPOINTS
+ * @param num_frames    frames in the pool, less than MAVLINK_ROUTER_NONE. Each
+ *                      endpoint holds one while receiving, the rest are shared
+ *                      by the endpoint queues
+ */
+	MAVLINK_HELPER void mavlink_router_init(mavlink_router_t *r, mavlink_router_endpoint_t *endpoints, uint8_t num_endpoints,
+											mavlink_router_frame_t *frames, uint16_t num_frames)
+	{
+		uint16_t i;
+		memset(r, 0, sizeof(*r));
+		memset(endpoints, 0, num_endpoints * sizeof(endpoints[0]));
+		r->endpoints = endpoints;
+		r->num_endpoints = num_endpoints;
+		r->frames = frames;
+		for (i = 0; i < num_endpoints; i++)
+		{
+			endpoints[i].rx_frame = MAVLINK_ROUTER_NONE;
+			r->all_endpoints |= 1ULL << i;
+		}
+		for (i = 0; i < num_frames; i++)
+		{
+			frames[i].refs = 0;
+			frames[i].next = i + 1 < num_frames ? i + 1 : MAVLINK_ROUTER_NONE;
+		}
+		r->free_head = num_frames ? 0 : MAVLINK_ROUTER_NONE;
+	}
+
+	MAVLINK_HELPER void _mav_router_free(mavlink_router_t *r, uint16_t idx)
+	{
+		r->frames[idx].next = r->free_head;
+		r->free_head = idx;
+	}
+
+	/*
+	  endpoints a frame goes to, before taking out the one it came from
+	 */
+	MAVLINK_HELPER uint64_t _mav_router_destinations(const mavlink_router_t *r, const mavlink_message_t *msg)
+	{
+		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msg->msgid);
+		uint8_t target_system = 0, target_component = 0, route;
+		if (e != NULL)
+		{
+			// the parser zero fills the payload of a known message up to its full length
+			if (e->flags & MAV_MSG_ENTRY_FLAG_HAVE_TARGET_SYSTEM)
+			{
+				target_system = _MAV_PAYLOAD(msg)[e->target_system_ofs];
+			}
+			if (e->flags & MAV_MSG_ENTRY_FLAG_HAVE_TARGET_COMPONENT)
+			{
+				target_component = _MAV_PAYLOAD(msg)[e->target_component_ofs];
+			}
+		}
+		if (target_system == 0)
+		{
+			return r->all_endpoints;
+		}
+		route = target_component != 0 ? r->routes[target_system << 8 | target_component] : 0;
+		if (route != 0)
+		{
+			return 1ULL << (route - 1);
+		}
+		return r->system_endpoints[target_system];
+	}
+
+	/*
+	  learn where the sender of a frame is and queue the captured frame
+	  on the endpoints it goes to
+	 */
+	MAVLINK_HELPER void _mav_router_forward(mavlink_router_t *r, uint8_t src)
+	{
+		mavlink_router_endpoint_t *ep = &r->endpoints[src];
+		const mavlink_message_t *msg = &ep->rxmsg;
+		mavlink_router_frame_t *f;
+		uint16_t key = (uint16_t)(msg->sysid << 8 | msg->compid);
+		uint64_t dests;
+		uint8_t i;
+
+		if (r->routes[key] != src + 1)
+		{
+			// the system stays on the endpoint it was seen on before too
+			r->routes[key] = src + 1;
+			r->system_endpoints[msg->sysid] |= 1ULL << src;
+		}
+
+		if (ep->rx_frame == MAVLINK_ROUTER_NONE)
+		{
+			r->dropped_no_frame++;
+			return;
+		}
+		f = &r->frames[ep->rx_frame];
+		f->len = ep->rx_len;
+		f->refs = 0;
+		dests = _mav_router_destinations(r, msg) & ~(1ULL << src);
+		for (i = 0; dests != 0; i++, dests >>= 1)
+		{
+			mavlink_router_endpoint_t *dst;
+			if (!(dests & 1))
+			{
+				continue;
+			}
+			dst = &r->endpoints[i];
+			if (dst->queue_head - dst->queue_tail == MAVLINK_ROUTER_QUEUE_LEN)
+			{
+				dst->tx_dropped++;
+				continue;
+			}
+			dst->queue[dst->queue_head++ & (MAVLINK_ROUTER_QUEUE_LEN - 1)] = ep->rx_frame;
+			f->refs++;
+		}
+		if (f->refs == 0)
+		{
+			// keep the buffer for the next frame
+			r->not_forwarded++;
+			return;
+		}
+		r->routed++;
+		ep->rx_frame = MAVLINK_ROUTER_NONE;
+	}
+
+	/**
+ * @brief Feed bytes received on an endpoint to the router
+ *
+ * @return number of good frames completed
+ */
+	MAVLINK_HELPER unsigned mavlink_router_input(mavlink_router_t *r, uint8_t src, const uint8_t *buf, size_t len)
+	{
+		mavlink_router_endpoint_t *ep = &r->endpoints[src];
+		unsigned frames = 0;
+		size_t i;
+
+		for (i = 0; i < len; i++)
+		{
+			uint8_t c = buf[i];
+			if (ep->status.parse_state <= MAVLINK_PARSE_STATE_IDLE)
+			{
+				// a frame can only start here
+				ep->rx_len = 0;
+				ep->rx_bad_crc = false;
+				if (ep->rx_frame == MAVLINK_ROUTER_NONE && r->free_head != MAVLINK_ROUTER_NONE)
+				{
+					ep->rx_frame = r->free_head;
+					r->free_head = r->frames[ep->rx_frame].next;
+				}
+			}
+			if (ep->rx_frame != MAVLINK_ROUTER_NONE && ep->rx_len < MAVLINK_MAX_PACKET_LEN)
+			{
+				r->frames[ep->rx_frame].data[ep->rx_len++] = c;
+			}
+
+			mavlink_frame_char_buffer(&ep->rxmsg, &ep->status, c, NULL, NULL);
+			switch (ep->status.msg_received)
+			{
+			case MAVLINK_FRAMING_INCOMPLETE:
+				break;
+			case MAVLINK_FRAMING_OK:
+				// a signed frame is reported as good once its signature is in, even after a bad CRC
+				if (ep->rx_bad_crc)
+				{
+					ep->rx_bad++;
+					break;
+				}
+				ep->rx_frames++;
+				frames++;
+				_mav_router_forward(r, src);
+				break;
+			case MAVLINK_FRAMING_BAD_CRC:
+				if (ep->status.parse_state == MAVLINK_PARSE_STATE_SIGNATURE_WAIT)
+				{
+					ep->rx_bad_crc = true;
+					break;
+				}
+				ep->rx_bad++;
+				break;
+			default:
+				ep->rx_bad++;
+				break;
+			}
+		}
+		return frames;
+	}
+
+	/**
+ * @brief Look at the oldest frame queued on an endpoint
+ *
+ * @return the frame, or NULL if nothing is queued
+ */
+	MAVLINK_HELPER const mavlink_router_frame_t *mavlink_router_peek(const mavlink_router_t *r, uint8_t dst)
+	{
+		const mavlink_router_endpoint_t *ep = &r->endpoints[dst];
+		if (ep->queue_head == ep->queue_tail)
+		{
+			return NULL;
+		}
+		return &r->frames[ep->queue[ep->queue_tail & (MAVLINK_ROUTER_QUEUE_LEN - 1)]];
+	}
+
+	/**
+ * @brief Release the frame returned by mavlink_router_peek() once it is written
+ */
+	MAVLINK_HELPER void mavlink_router_pop(mavlink_router_t *r, uint8_t dst)
+	{
+		mavlink_router_endpoint_t *ep = &r->endpoints[dst];
+		uint16_t idx = ep->queue[ep->queue_tail++ & (MAVLINK_ROUTER_QUEUE_LEN - 1)];
+		ep->tx_frames++;
+		if (--r->frames[idx].refs == 0)
+		{
+			_mav_router_free(r, idx);
+		}
+	}
+
+#ifdef MAVLINK_USE_CXX_NAMESPACE
+} // namespace mavlink
+#endif
+
+#endif // MAVLINK_USE_ROUTER
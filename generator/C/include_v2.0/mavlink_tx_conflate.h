@@ -0,0 +1,280 @@
+#pragma once
+
+/*
+  conflating transmit queue.
+
+  When a link cannot keep up, a queued ATTITUDE is worth nothing once a
+  newer ATTITUDE is waiting behind it. This queue keeps at most one
+  pending frame per (msgid, sysid, compid, target system, target
+  component). Queueing a frame whose key is already pending overwrites
+  the pending frame in place, so it keeps its position in the queue but
+  goes out with the newest contents.
+
+  Targets are read from the payload at the offsets in the message's
+  mavlink_msg_entry_t, so frames to different targets never replace
+  each other. Only messages for which MAVLINK_CONFLATE_MSG(msgid) is
+  true are conflated, by default those of MAVLINK_TX_CLASS_TELEMETRY.
+  Commands, handshakes and transfers keep every frame.
+
+  Frames live in a caller owned pool and are found through an open
+  addressed table of frame indexes with linear probing. Sent frames are
+  removed from the table by backward shift deletion, so the table never
+  fills up with tombstones and enqueue stays O(1).
+
+  Not thread safe. Enable with MAVLINK_USE_TX_CONFLATE.
+ */
+
+#ifdef MAVLINK_USE_TX_CONFLATE
+#define MAVLINK_HAVE_TX_CONFLATE
+
+#include <string.h>
+
+#ifndef MAVLINK_CONFLATE_MSG
+#define MAVLINK_CONFLATE_MSG(msgid) (mavlink_tx_class(msgid) == MAVLINK_TX_CLASS_TELEMETRY)
+#endif
+
+#define MAVLINK_CONFLATE_NONE 0xFFFF
+
+#ifdef MAVLINK_USE_CXX_NAMESPACE
+namespace mavlink
+{
+#endif
+
+	typedef struct __mavlink_conflate_frame
+	{
+		uint64_t key;                         // key + 1, 0 if the frame is not conflated
+		uint16_t next;                        // next frame in the queue or free list
+		uint16_t len;                         // bytes in data
+		uint8_t data[MAVLINK_MAX_PACKET_LEN]; // the frame as it goes on the wire
+	} mavlink_conflate_frame_t;
+
+	typedef struct __mavlink_conflate_queue
+	{
+		mavlink_conflate_frame_t *frames; // caller owned pool
+		uint16_t *table;                  // frame index + 1 per slot, 0 for empty
+		uint16_t table_mask;              // number of table slots - 1
+		uint16_t head;                    // oldest frame
+		uint16_t tail;                    // newest frame
+		uint16_t free_head;               // first unused frame
+		uint16_t depth;                   // frames queued now
+		uint32_t queued;                  // frames queued as new entries
+		uint32_t replaced;                // frames that overwrote a pending one
+		uint32_t dropped_full;            // frames not queued because the pool was full
+		uint32_t sent;                    // frames taken out of the queue
+	} mavlink_conflate_queue_t;
+
+	/**
+ * @brief Set up a conflating queue over caller owned storage
+ *
+ * @param frames      storage for pending frames
+ * @param num_frames  number of frames, less than MAVLINK_CONFLATE_NONE
+ * @param table       lookup table
+ * @param table_slots number of table slots, a power of 2 larger than
+ *                    num_frames. Twice num_frames keeps probes short
+ */
+	MAVLINK_HELPER void mavlink_conflate_init(mavlink_conflate_queue_t *q, mavlink_conflate_frame_t *frames,
+											  uint16_t num_frames, uint16_t *table, uint32_t table_slots)
+	{
+		uint16_t i;
+		memset(q, 0, sizeof(*q));
+		memset(table, 0, table_slots * sizeof(table[0]));
+		q->frames = frames;
+		q->table = table;
+		q->table_mask = (uint16_t)(table_slots - 1);
+		for (i = 0; i < num_frames; i++)
+		{
+			frames[i].next = i + 1 < num_frames ? i + 1 : MAVLINK_CONFLATE_NONE;
+		}
+		q->free_head = num_frames ? 0 : MAVLINK_CONFLATE_NONE;
+		q->head = MAVLINK_CONFLATE_NONE;
+		q->tail = MAVLINK_CONFLATE_NONE;
+	}
+
+	/*
+	  conflation key of a finalized message, plus one so that 0 is free.
+	  Targets beyond a trimmed payload are zero
+	 */
+	MAVLINK_HELPER uint64_t _mav_conflate_key(const mavlink_message_t *msg)
+	{
+		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msg->msgid);
+		uint64_t target_system = 0, target_component = 0;
+		if (e != NULL)
+		{
+			if ((e->flags & MAV_MSG_ENTRY_FLAG_HAVE_TARGET_SYSTEM) && e->target_system_ofs < msg->len)
+			{
+				target_system = _MAV_PAYLOAD(msg)[e->target_system_ofs];
+			}
+			if ((e->flags & MAV_MSG_ENTRY_FLAG_HAVE_TARGET_COMPONENT) && e->target_component_ofs < msg->len)
+			{
+				target_component = _MAV_PAYLOAD(msg)[e->target_component_ofs];
+			}
+		}
+		return 1 + ((uint64_t)msg->msgid |
+					(uint64_t)msg->sysid << 24 |
+					(uint64_t)msg->compid << 32 |
+					target_system << 40 |
+					target_component << 48);
+	}
+
+	MAVLINK_HELPER uint16_t _mav_conflate_slot(const mavlink_conflate_queue_t *q, uint64_t key)
+	{
+		uint32_t k = (uint32_t)(key ^ (key >> 32));
+		return (uint16_t)(((k * 0x9e3779b1U) >> 16) & q->table_mask);
+	}
+
+	/*
+	  remove a key from the table, moving later entries of its probe
+	  run back so lookups never need tombstones
+	 */
+	MAVLINK_HELPER void _mav_conflate_unlink(mavlink_conflate_queue_t *q, uint64_t key)
+	{
+		uint16_t i = _mav_conflate_slot(q, key), j;
+		while (q->frames[q->table[i] - 1].key != key)
+		{
+			i = (i + 1) & q->table_mask;
+		}
+		for (j = i;;)
+		{
+			uint16_t home;
+			j = (j + 1) & q->table_mask;
+			if (q->table[j] == 0)
+			{
+				break;
+			}
+			home = _mav_conflate_slot(q, q->frames[q->table[j] - 1].key);
+			// the entry at j may fill the hole at i if its home is not in (i, j]
+			if (((j - home) & q->table_mask) >= ((j - i) & q->table_mask))
+			{
+				q->table[i] = q->table[j];
+				i = j;
+			}
+		}
+		q->table[i] = 0;
+	}
+
+	/**
+ * @brief Queue a finalized message, replacing a pending one with the same key
+ *
+ * @return false if the message needed a new frame and the pool was full
+ */
+	MAVLINK_HELPER bool mavlink_conflate_enqueue(mavlink_conflate_queue_t *q, const mavlink_message_t *msg)
+	{
+		uint64_t key = 0;
+		uint16_t slot = 0, idx;
+		mavlink_conflate_frame_t *f;
+
+		if (MAVLINK_CONFLATE_MSG(msg->msgid))
+		{
+			key = _mav_conflate_key(msg);
+			slot = _mav_conflate_slot(q, key);
+			while (q->table[slot] != 0)
+			{
+				f = &q->frames[q->table[slot] - 1];
+				if (f->key == key)
+				{
+					f->len = mavlink_msg_to_send_buffer(f->data, msg);
+					q->replaced++;
+					return true;
+				}
+				slot = (slot + 1) & q->table_mask;
+			}
+		}
+
+		if (q->free_head == MAVLINK_CONFLATE_NONE)
+		{
+			q->dropped_full++;
+			return false;
+		}
+		idx = q->free_head;
+		f = &q->frames[idx];
+		q->free_head = f->next;
+
+		f->key = key;
+		f->next = MAVLINK_CONFLATE_NONE;
+		f->len = mavlink_msg_to_send_buffer(f->data, msg);
+		if (key != 0)
+		{
+			q->table[slot] = idx + 1;
+		}
+		if (q->tail == MAVLINK_CONFLATE_NONE)
+		{
+			q->head = idx;
+		}
+		else
+		{
+			q->frames[q->tail].next = idx;
+		}
+		q->tail = idx;
+		q->depth++;
+		q->queued++;
+		return true;
+	}
+
+	/**
+ * @brief Take the oldest pending frame
+ *
+ * @param buf receives the frame, MAVLINK_MAX_PACKET_LEN bytes
+ *
+ * @return length of the frame, 0 if the queue is empty
+ */
+	MAVLINK_HELPER uint16_t mavlink_conflate_dequeue(mavlink_conflate_queue_t *q, uint8_t *buf)
+	{
+		mavlink_conflate_frame_t *f;
+		uint16_t idx = q->head, len;
+		if (idx == MAVLINK_CONFLATE_NONE)
+		{
+			return 0;
+		}
+		f = &q->frames[idx];
+		if (f->key != 0)
+		{
+			_mav_conflate_unlink(q, f->key);
+		}
+		q->head = f->next;
+		if (q->head == MAVLINK_CONFLATE_NONE)
+		{
+			q->tail = MAVLINK_CONFLATE_NONE;
+		}
+		len = f->len;
+		memcpy(buf, f->data, len);
+		f->next = q->free_head;
+		q->free_head = idx;
+		q->depth--;
+		q->sent++;
+		return len;
+	}
+
+#ifdef MAVLINK_USE_CONVENIENCE_FUNCTIONS
+	/**
+ * @brief Send pending frames on a channel until a byte budget is used up
+ *
+ * The last frame may go over the budget.
+ *
+ * @return bytes sent
+ */
+	MAVLINK_HELPER uint32_t mavlink_conflate_pump(mavlink_conflate_queue_t *q, mavlink_channel_t chan,
+												  uint32_t budget_bytes)
+	{
+		uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+		uint32_t sent = 0;
+		while (sent < budget_bytes)
+		{
+			uint16_t len = mavlink_conflate_dequeue(q, buf);
+			if (len == 0)
+			{
+				break;
+			}
+			_MAVLINK_START_FRAME(chan, len);
+			_mavlink_send_uart(chan, (const char *)buf, len);
+			_MAVLINK_END_FRAME(chan, len);
+			sent += len;
+		}
+		return sent;
+	}
+#endif // MAVLINK_USE_CONVENIENCE_FUNCTIONS
+
+#ifdef MAVLINK_USE_CXX_NAMESPACE
+} // namespace mavlink
+#endif
+
+#endif // MAVLINK_USE_TX_CONFLATE
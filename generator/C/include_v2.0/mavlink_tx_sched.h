@@ -0,0 +1,374 @@
+#pragma once
+
+/*
+  transmit scheduler for slow links, sitting above the channel send path.
+
+  Finalized messages are queued by transmit class and the link writer
+  takes them out with mavlink_tx_sched_dequeue() or
+  mavlink_tx_sched_pump(). Classes share the link by deficit round
+  robin: each turn a class may send up to its quantum of bytes, so a
+  class with twice the quantum gets twice the bandwidth when all classes
+  are busy, and a class with nothing queued takes no turn at all.
+
+  The class of a message comes from MAVLINK_MESSAGE_TX_CLASSES, which
+  the generator writes from the policy table in mavgen_c.py. Messages
+  not listed are MAVLINK_TX_CLASS_TELEMETRY. Define your own
+  MAVLINK_MESSAGE_TX_CLASSES before including mavlink.h to change it.
+
+  A frame may be given a maximum age. Frames older than that when they
+  reach the head of their class are dropped, not sent.
+
+  Times are milliseconds from any clock, passed in by the caller.
+  Not thread safe, guard a scheduler with the channel's own lock.
+
+  mavlink_tx_class() is always available, the scheduler itself is
+  enabled with MAVLINK_USE_TX_SCHED.
+ */
+
+#include <string.h>
+
+#define MAVLINK_TX_CLASS_CONTROL 0   // heartbeat, commands, protocol handshakes
+#define MAVLINK_TX_CLASS_TELEMETRY 1 // everything not listed
+#define MAVLINK_TX_CLASS_BULK 2      // parameter, log and file transfers
+#define MAVLINK_TX_NUM_CLASSES 3
+
+#ifdef MAVLINK_USE_CXX_NAMESPACE
+namespace mavlink
+{
+#endif
+
+	/**
+ * @brief Get the transmit class of a message id
+ */
+	MAVLINK_HELPER uint8_t mavlink_tx_class(uint32_t msgid)
+	{
+#ifdef MAVLINK_MESSAGE_TX_CLASSES
+		static const struct
+		{
+			uint32_t msgid;
+			uint8_t tx_class;
+		} classes[] = MAVLINK_MESSAGE_TX_CLASSES;
+		uint32_t low = 0, high = sizeof(classes) / sizeof(classes[0]);
+		while (low < high)
+		{
+			uint32_t mid = (low + high) / 2;
+			if (msgid < classes[mid].msgid)
+			{
+				high = mid;
+			}
+			else if (msgid > classes[mid].msgid)
+			{
+				low = mid + 1;
+			}
+			else
+			{
+				return classes[mid].tx_class;
+			}
+		}
+#else
+		(void)msgid;
+#endif
+		return MAVLINK_TX_CLASS_TELEMETRY;
+	}
+
+#ifdef MAVLINK_USE_TX_SCHED
+#define MAVLINK_HAVE_TX_SCHED
+
+#define MAVLINK_TX_SCHED_NONE 0xFFFF
+
+	typedef struct __mavlink_tx_sched_frame
+	{
+		uint16_t next;                        // next frame of the class queue or free list
+		uint16_t len;                         // bytes in data
+		uint32_t enqueued_ms;                 // time the frame was queued
+		uint32_t max_age_ms;                  // drop instead of send when older, 0 for never
+		uint8_t data[MAVLINK_MAX_PACKET_LEN]; // the frame as it goes on the wire
+	} mavlink_tx_sched_frame_t;
+
+	typedef struct __mavlink_tx_class_stats
+	{
+		uint16_t depth;          // frames queued now
+		uint16_t depth_max;      // most frames ever queued
+		uint32_t queued_bytes;   // bytes queued now
+		uint32_t sent;           // frames handed to the link
+		uint64_t sent_bytes;     // bytes handed to the link
+		uint32_t dropped_stale;  // frames dropped for being older than their max age
+		uint32_t dropped_full;   // frames not queued or evicted because the pool was full
+		uint64_t latency_sum_ms; // sum of queueing delays of sent frames
+		uint32_t latency_max_ms; // longest queueing delay of a sent frame
+	} mavlink_tx_class_stats_t;
+
+	typedef struct __mavlink_tx_class
+	{
+		uint16_t head;       // oldest frame, MAVLINK_TX_SCHED_NONE if empty
+		uint16_t tail;       // newest frame
+		uint16_t quantum;    // bytes this class may send per round
+		int32_t deficit;     // bytes this class may still send this round
+		uint32_t max_age_ms; // max age of frames queued without one, 0 for never
+		mavlink_tx_class_stats_t stats;
+	} mavlink_tx_class_t;
+
+	typedef struct __mavlink_tx_sched
+	{
+		mavlink_tx_sched_frame_t *frames; // caller owned pool
+		uint16_t free_head;               // first unused frame
+		uint8_t current;                  // class whose turn it is
+		bool granted;                     // current class got its quantum for this turn
+		mavlink_tx_class_t classes[MAVLINK_TX_NUM_CLASSES];
+	} mavlink_tx_sched_t;
+
+	/**
+ * @brief Set up a scheduler over a caller owned frame pool
+ *
+ * Quanta default to 4:2:1 between control, telemetry and bulk, with no
+ * maximum age
+ *
+ * @param frames     storage for queued frames
+ * @param num_frames number of frames, less than MAVLINK_TX_SCHED_NONE
+ */
+	MAVLINK_HELPER void mavlink_tx_sched_init(mavlink_tx_sched_t *s, mavlink_tx_sched_frame_t *frames, uint16_t num_frames)
+	{
+		uint16_t i;
+		memset(s, 0, sizeof(*s));
+		s->frames = frames;
+		for (i = 0; i < num_frames; i++)
+		{
+			frames[i].next = i + 1 < num_frames ? i + 1 : MAVLINK_TX_SCHED_NONE;
+		}
+		s->free_head = num_frames ? 0 : MAVLINK_TX_SCHED_NONE;
+		for (i = 0; i < MAVLINK_TX_NUM_CLASSES; i++)
+		{
+			s->classes[i].head = MAVLINK_TX_SCHED_NONE;
+			s->classes[i].tail = MAVLINK_TX_SCHED_NONE;
+		}
+		s->classes[MAVLINK_TX_CLASS_CONTROL].quantum = 4 * MAVLINK_MAX_PACKET_LEN;
+		s->classes[MAVLINK_TX_CLASS_TELEMETRY].quantum = 2 * MAVLINK_MAX_PACKET_LEN;
+		s->classes[MAVLINK_TX_CLASS_BULK].quantum = MAVLINK_MAX_PACKET_LEN;
+	}
+
+	/**
+ * @brief Set the share of the link and default max age of a class
+ *
+ * @param quantum    bytes the class may send per round, at least 1
+ * @param max_age_ms max age of frames queued with 0, 0 for never
+ */
+	MAVLINK_HELPER void mavlink_tx_sched_config(mavlink_tx_sched_t *s, uint8_t tx_class,
+												uint16_t quantum, uint32_t max_age_ms)
+	{
+		mavlink_tx_class_t *c = &s->classes[tx_class];
+		c->quantum = quantum ? quantum : 1;
+		c->max_age_ms = max_age_ms;
+	}
+
+	/*
+	  take the head frame off a class queue, the caller frees or reuses it
+	 */
+	MAVLINK_HELPER mavlink_tx_sched_frame_t *_mav_tx_sched_pop(mavlink_tx_sched_t *s, mavlink_tx_class_t *c)
+	{
+		mavlink_tx_sched_frame_t *f = &s->frames[c->head];
+		c->head = f->next;
+		if (c->head == MAVLINK_TX_SCHED_NONE)
+		{
+			c->tail = MAVLINK_TX_SCHED_NONE;
+		}
+		c->stats.depth--;
+		c->stats.queued_bytes -= f->len;
+		return f;
+	}
+
+	MAVLINK_HELPER void _mav_tx_sched_free(mavlink_tx_sched_t *s, mavlink_tx_sched_frame_t *f)
+	{
+		f->next = s->free_head;
+		s->free_head = (uint16_t)(f - s->frames);
+	}
+
+	/*
+	  get a free frame for a class. When the pool is full the oldest frame
+	  of the lowest class below it is evicted, so bulk traffic can never
+	  lock control messages out of the pool
+	 */
+	MAVLINK_HELPER mavlink_tx_sched_frame_t *_mav_tx_sched_alloc(mavlink_tx_sched_t *s, uint8_t tx_class)
+	{
+		mavlink_tx_sched_frame_t *f;
+		uint8_t c;
+		if (s->free_head != MAVLINK_TX_SCHED_NONE)
+		{
+			f = &s->frames[s->free_head];
+			s->free_head = f->next;
+			return f;
+		}
+		for (c = MAVLINK_TX_NUM_CLASSES - 1; c > tx_class; c--)
+		{
+			if (s->classes[c].head != MAVLINK_TX_SCHED_NONE)
+			{
+				s->classes[c].stats.dropped_full++;
+				return _mav_tx_sched_pop(s, &s->classes[c]);
+			}
+		}
+		s->classes[tx_class].stats.dropped_full++;
+		return NULL;
+	}
+
+	/**
+ * @brief Queue a finalized frame given as wire bytes
+ *
+ * @param max_age_ms drop the frame if it is not sent within this time,
+ *                   0 for the class default
+ *
+ * @return false if the pool is full of frames of this class or above
+ */
+	MAVLINK_HELPER bool mavlink_tx_sched_enqueue_frame(mavlink_tx_sched_t *s, uint8_t tx_class,
+													   const uint8_t *buf, uint16_t len,
+													   uint32_t now_ms, uint32_t max_age_ms)
+	{
+		mavlink_tx_class_t *c = &s->classes[tx_class];
+		mavlink_tx_sched_frame_t *f = _mav_tx_sched_alloc(s, tx_class);
+		uint16_t idx;
+		if (f == NULL)
+		{
+			return false;
+		}
+		memcpy(f->data, buf, len);
+		f->len = len;
+		f->enqueued_ms = now_ms;
+		f->max_age_ms = max_age_ms ? max_age_ms : c->max_age_ms;
+		f->next = MAVLINK_TX_SCHED_NONE;
+		idx = (uint16_t)(f - s->frames);
+		if (c->tail == MAVLINK_TX_SCHED_NONE)
+		{
+			c->head = idx;
+		}
+		else
+		{
+			s->frames[c->tail].next = idx;
+		}
+		c->tail = idx;
+		c->stats.queued_bytes += len;
+		if (++c->stats.depth > c->stats.depth_max)
+		{
+			c->stats.depth_max = c->stats.depth;
+		}
+		return true;
+	}
+
+	/**
+ * @brief Queue a finalized message in the class of its msgid
+ *
+ * @param max_age_ms drop the frame if it is not sent within this time,
+ *                   0 for the class default
+ *
+ * @return false if the pool is full of frames of this class or above
+ */
+	MAVLINK_HELPER bool mavlink_tx_sched_enqueue(mavlink_tx_sched_t *s, const mavlink_message_t *msg,
+												 uint32_t now_ms, uint32_t max_age_ms)
+	{
+		uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+		uint16_t len = mavlink_msg_to_send_buffer(buf, msg);
+		return mavlink_tx_sched_enqueue_frame(s, mavlink_tx_class(msg->msgid), buf, len, now_ms, max_age_ms);
+	}
+
+	/*
+	  drop frames at the head of a class that are past their max age
+	 */
+	MAVLINK_HELPER void _mav_tx_sched_drop_stale(mavlink_tx_sched_t *s, mavlink_tx_class_t *c, uint32_t now_ms)
+	{
+		while (c->head != MAVLINK_TX_SCHED_NONE)
+		{
+			mavlink_tx_sched_frame_t *f = &s->frames[c->head];
+			if (f->max_age_ms == 0 || now_ms - f->enqueued_ms <= f->max_age_ms)
+			{
+				return;
+			}
+			_mav_tx_sched_free(s, _mav_tx_sched_pop(s, c));
+			c->stats.dropped_stale++;
+		}
+	}
+
+	/**
+ * @brief Take the next frame to send
+ *
+ * @param buf receives the frame, MAVLINK_MAX_PACKET_LEN bytes
+ *
+ * @return length of the frame, 0 if nothing is queued
+ */
+	MAVLINK_HELPER uint16_t mavlink_tx_sched_dequeue(mavlink_tx_sched_t *s, uint32_t now_ms, uint8_t *buf)
+	{
+		uint8_t empty = 0;
+		while (empty < MAVLINK_TX_NUM_CLASSES)
+		{
+			mavlink_tx_class_t *c = &s->classes[s->current];
+			_mav_tx_sched_drop_stale(s, c, now_ms);
+			if (c->head == MAVLINK_TX_SCHED_NONE)
+			{
+				// an idle class does not save up credit
+				c->deficit = 0;
+				empty++;
+			}
+			else
+			{
+				mavlink_tx_sched_frame_t *f = &s->frames[c->head];
+				empty = 0;
+				if (!s->granted)
+				{
+					c->deficit += c->quantum;
+					s->granted = true;
+				}
+				if (f->len <= c->deficit)
+				{
+					uint32_t latency = now_ms - f->enqueued_ms;
+					uint16_t len = f->len;
+					_mav_tx_sched_pop(s, c);
+					c->deficit -= len;
+					c->stats.sent++;
+					c->stats.sent_bytes += len;
+					c->stats.latency_sum_ms += latency;
+					if (latency > c->stats.latency_max_ms)
+					{
+						c->stats.latency_max_ms = latency;
+					}
+					memcpy(buf, f->data, len);
+					_mav_tx_sched_free(s, f);
+					return len;
+				}
+			}
+			s->current = (uint8_t)((s->current + 1) % MAVLINK_TX_NUM_CLASSES);
+			s->granted = false;
+		}
+		return 0;
+	}
+
+#ifdef MAVLINK_USE_CONVENIENCE_FUNCTIONS
+	/**
+ * @brief Send queued frames on a channel until a byte budget is used up
+ *
+ * Call this whenever the link can take more data, with the number of
+ * bytes it can take. The last frame may go over the budget.
+ *
+ * @return bytes sent
+ */
+	MAVLINK_HELPER uint32_t mavlink_tx_sched_pump(mavlink_tx_sched_t *s, mavlink_channel_t chan,
+												  uint32_t now_ms, uint32_t budget_bytes)
+	{
+		uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+		uint32_t sent = 0;
+		while (sent < budget_bytes)
+		{
+			uint16_t len = mavlink_tx_sched_dequeue(s, now_ms, buf);
+			if (len == 0)
+			{
+				break;
+			}
+			_MAVLINK_START_FRAME(chan, len);
+			_mavlink_send_uart(chan, (const char *)buf, len);
+			_MAVLINK_END_FRAME(chan, len);
+			sent += len;
+		}
+		return sent;
+	}
+#endif // MAVLINK_USE_CONVENIENCE_FUNCTIONS
+
+#endif // MAVLINK_USE_TX_SCHED
+
+#ifdef MAVLINK_USE_CXX_NAMESPACE
+} // namespace mavlink
+#endif
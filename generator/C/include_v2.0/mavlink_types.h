@@ -41,6 +41,25 @@ namespace mavlink
 #define MAVLINK_IV_EMPTY 0
 #define MAVLINK_IV_COMPLETE 1
 
+// cipher suites, agreed at key exchange. Only Speck128192 is built without TEST
+#define MAVLINK_CIPHER_SPECK128192 1
+#define MAVLINK_CIPHER_CHACHA20 2
+#define MAVLINK_CIPHER_TRIVIUM 3
+#define MAVLINK_CIPHER_RABBIT 4
+#define MAVLINK_CIPHER_SIMON6496 5
+#define MAVLINK_CIPHER_SIMON64128 6
+#define MAVLINK_CIPHER_SIMON128128 7
+#define MAVLINK_CIPHER_SIMON128192 8
+#define MAVLINK_CIPHER_SIMON128256 9
+#define MAVLINK_CIPHER_SPECK6496 10
+#define MAVLINK_CIPHER_SPECK64128 11
+#define MAVLINK_CIPHER_SPECK128128 12
+#define MAVLINK_CIPHER_SPECK128256 13
+
+#ifndef MAVLINK_DEFAULT_CIPHER
+#define MAVLINK_DEFAULT_CIPHER MAVLINK_CIPHER_SPECK128192
+#endif
+
 #define MAVLINK_DEVICE_CERTIFICATE 0
 #define MAVLINK_GCS_CERTIFICATE 1
 
@@ -174,6 +193,13 @@ namespace mavlink
         mavlink_field_info_t fields[MAVLINK_MAX_FIELDS]; // field information
     } mavlink_message_info_t;
 
+    // a message field resolved by name once, see mavlink_field_handle_resolve()
+    typedef struct __mavlink_field_handle
+    {
+        const mavlink_message_info_t *info; // message the field belongs to, NULL if unresolved
+        const mavlink_field_info_t *field;  // the field itself
+    } mavlink_field_handle_t;
+
 #define _MAV_PAYLOAD(msg) ((const char *)(&((msg)->payload64[0])))
 #define _MAV_PAYLOAD_NON_CONST(msg) ((char *)(&((msg)->payload64[0])))
 
@@ -219,7 +245,8 @@ namespace mavlink
         MAVLINK_PARSE_STATE_GOT_PAYLOAD,
         MAVLINK_PARSE_STATE_GOT_CRC1,
         MAVLINK_PARSE_STATE_GOT_BAD_CRC1,
-        MAVLINK_PARSE_STATE_SIGNATURE_WAIT
+        MAVLINK_PARSE_STATE_SIGNATURE_WAIT,
+        MAVLINK_PARSE_STATE_SKIP_FRAME
     } mavlink_parse_state_t; ///< The state machine for the comm parser
 
     typedef enum
@@ -252,13 +279,148 @@ namespace mavlink
         uint8_t signature_wait;                            ///< number of signature bytes left to receive
         struct __mavlink_signing *signing;                 ///< optional signing state
         struct __mavlink_signing_streams *signing_streams; ///< global record of stream timestamps
+        struct __mavlink_context *context;                 ///< owner of the keys used for this channel, NULL for the default context
+        struct __mavlink_rx_stats *stats;                  ///< optional 64 bit receive statistics, NULL to disable
+        struct __mavlink_rx_filter *filter;                ///< optional msgid filter, NULL to pass all frames
+        uint16_t skip_wait;                                ///< number of bytes left of a filtered frame
+#ifdef ENCRYPTION
+        uint8_t link;          ///< link of the channel in the peer key table, 0 unless set
+        uint64_t rx_key_cache; ///< last peer a payload was decrypted for, see _mav_peer_key_cached()
+        uint64_t tx_key_cache; ///< last peer a payload was encrypted for
+#endif
     } mavlink_status_t;
 
+    /*
+  per message scratch space for mavlink_msgs_to_iovec(), holding the
+  header and the CRC plus signature while the payload is sent in place
+ */
+    typedef struct __mavlink_iovec_scratch
+    {
+        uint8_t header[MAVLINK_NUM_HEADER_BYTES];
+        uint8_t trailer[MAVLINK_NUM_CHECKSUM_BYTES + MAVLINK_SIGNATURE_BLOCK_LEN];
+    } mavlink_iovec_scratch_t;
+
+#define MAVLINK_IOVEC_PER_MSG 3 // header, payload and trailer
+
+#ifndef MAVLINK_RX_STATS_MSG_SLOTS
+#define MAVLINK_RX_STATS_MSG_SLOTS 256 // must be a power of 2
+#endif
+#ifndef MAVLINK_RX_STATS_PEER_SLOTS
+#define MAVLINK_RX_STATS_PEER_SLOTS 64 // must be a power of 2
+#endif
+
+    /*
+  one entry of the per-msgid histogram in mavlink_rx_stats_t
+ */
+    typedef struct __mavlink_rx_stats_msg
+    {
+        uint32_t key;   ///< msgid + 1, 0 for an unused slot
+        uint64_t count; ///< good frames with this msgid
+        uint64_t bytes; ///< wire bytes of those frames
+    } mavlink_rx_stats_msg_t;
+
+    /*
+  sequence tracking for one (sysid, compid) in mavlink_rx_stats_t
+ */
+    typedef struct __mavlink_rx_stats_peer
+    {
+        uint32_t key;      ///< ((sysid << 8) | compid) + 1, 0 for an unused slot
+        uint8_t last_seq;  ///< sequence number of the last good frame
+        uint64_t frames;   ///< good frames from this peer
+        uint64_t seq_gaps; ///< frames missing from the sequence
+    } mavlink_rx_stats_peer_t;
+
+    /*
+  cumulative receive statistics for one channel. The counters never
+  wrap in practice and are not reset by the parser. Attach with
+  status->stats, set up with mavlink_rx_stats_init(). Messages or peers
+  that find the fixed size tables full are only counted in the untracked
+  counters
+ */
+    typedef struct __mavlink_rx_stats
+    {
+        uint64_t bytes;            ///< wire bytes of completed frames
+        uint64_t frames;           ///< good frames
+        uint64_t crc_errors;       ///< frames with a bad CRC
+        uint64_t signature_errors; ///< frames with a bad or missing signature
+        uint64_t parse_errors;     ///< header errors and buffer overruns
+        uint64_t seq_gaps;         ///< sum of the per peer sequence gaps
+        uint64_t untracked_msgs;   ///< good frames not in msgs[]
+        uint64_t untracked_peers;  ///< good frames not in peers[]
+        mavlink_rx_stats_msg_t msgs[MAVLINK_RX_STATS_MSG_SLOTS];
+        mavlink_rx_stats_peer_t peers[MAVLINK_RX_STATS_PEER_SLOTS];
+    } mavlink_rx_stats_t;
+
+#ifndef MAVLINK_RX_FILTER_SLOTS
+#define MAVLINK_RX_FILTER_SLOTS 32 // must be a power of 2
+#endif
+
+    /*
+  filter rule for one msgid in mavlink_rx_filter_t
+ */
+    typedef struct __mavlink_rx_filter_entry
+    {
+        uint32_t key;   ///< msgid + 1, 0 for an unused slot
+        uint16_t every; ///< pass one frame in every, 0 to drop them all
+        uint16_t count; ///< frames seen since the last one passed
+    } mavlink_rx_filter_entry_t;
+
+    /*
+  per channel msgid filter. It is checked as soon as the msgid of a
+  frame is parsed, and the rest of a rejected frame is skipped without
+  a CRC check, copy, decryption or handoff. Attach with status->filter,
+  set up with mavlink_rx_filter_init() and mavlink_rx_filter_set()
+ */
+    typedef struct __mavlink_rx_filter
+    {
+        bool pass_unlisted; ///< pass msgids that have no entry
+        uint64_t rejected;  ///< frames skipped by the filter
+        mavlink_rx_filter_entry_t entries[MAVLINK_RX_FILTER_SLOTS];
+    } mavlink_rx_filter_t;
+
     /*
   a callback function to allow for accepting unsigned packets
  */
     typedef bool (*mavlink_accept_unsigned_t)(const mavlink_status_t *status, uint32_t msgid);
 
+    /*
+  a callback function called by mavlink_frame_buffer() once per completed frame.
+  framing is one of MAVLINK_FRAMING_OK, MAVLINK_FRAMING_BAD_CRC or MAVLINK_FRAMING_BAD_SIGNATURE
+ */
+    typedef void (*mavlink_frame_callback_t)(void *arg, uint8_t framing, const mavlink_message_t *msg, const mavlink_status_t *status);
+
+#define MAVLINK_RX_RING_MAX_SLOTS 64
+#define MAVLINK_RX_RING_NO_SLOT 0xFF
+
+    /*
+      a receive ring of caller owned message slots. The parser writes each
+      frame straight into a free slot and hands the slot out as a
+      mavlink_message_view_t, which stays valid until mavlink_rx_ring_release()
+     */
+    typedef struct __mavlink_rx_ring
+    {
+        mavlink_message_t *slots; // caller owned array of num_slots messages
+        uint8_t num_slots;        // at most MAVLINK_RX_RING_MAX_SLOTS
+        uint8_t parse_slot;       // slot the parser is filling, or MAVLINK_RX_RING_NO_SLOT
+        uint64_t busy;            // bit per slot, set while parsing into it or handed out
+    } mavlink_rx_ring_t;
+
+    /*
+      read-only view of a received frame in a mavlink_rx_ring_t slot. The
+      header fields are in msg, which can also be passed to the
+      mavlink_msg_*_decode() functions. The payload is zero filled up to
+      the full length of the message
+     */
+    typedef struct __mavlink_message_view
+    {
+        const mavlink_message_t *msg; // the ring slot holding the frame
+        const uint8_t *payload;       // payload as received
+        uint8_t len;                  // payload length on the wire
+        const uint8_t *signature;     // signature block, NULL if the frame is unsigned
+        uint8_t framing;              // MAVLINK_FRAMING_OK, MAVLINK_FRAMING_BAD_CRC or MAVLINK_FRAMING_BAD_SIGNATURE
+        uint8_t slot;                 // index of the slot in the ring
+    } mavlink_message_view_t;
+
 /*
   flags controlling signing
  */
@@ -335,14 +497,135 @@ namespace mavlink
         uint8_t sign[64];
     } mavlink_device_certificate_t;
 
+    /*
+  a key agreed with a remote system. Several threads may send and parse
+  with a key at once, the state derived from it is built on first use
+  and published safely. Writing a new key, IV or cipher suite is not
+  synchronized with them, do it before traffic with the peer starts
+ */
     typedef struct key_s
     {
         uint8_t shared_key[24];
         uint8_t iv[16];
         int iv_set;
         int status;
+#ifdef ENCRYPTION
+        const struct __mavlink_cipher *cipher; // suite used with this key, NULL until it is first used
+        uint64_t round_keys[33]; // shared_key expanded for Speck128192
+        int round_keys_set;      // round_keys matches shared_key, clear after writing shared_key. Read with acquire
+#endif
     } key_status_t;
 
+#ifdef ENCRYPTION
+    /*
+      a cipher suite. Payloads are encrypted and decrypted in place by
+      xor_stream, with the shared key and IV of the remote key
+     */
+    typedef struct __mavlink_cipher
+    {
+        uint8_t id;                                                          // MAVLINK_CIPHER_*
+        const char *name;
+        void (*init)(key_status_t *key);                                     // suite chosen for the key, forget what another suite kept
+        void (*key_setup)(key_status_t *key);                                // shared_key or iv written
+        void (*xor_stream)(key_status_t *key, uint8_t *payload, uint8_t len); // encrypt or decrypt a payload
+    } mavlink_cipher_t;
+#endif
+
+#define MAVLINK_NUM_REMOTE_KEYS 256
+
+#ifdef ENCRYPTION
+#ifndef MAVLINK_PEER_KEY_SLOTS
+#define MAVLINK_PEER_KEY_SLOTS 256 // must be a power of 2
+#endif
+
+    /*
+  remote key used with a peer, one slot of the peer key table
+ */
+    typedef struct __mavlink_peer_key
+    {
+        uint32_t key; ///< ((link << 16) | (sysid << 8) | compid) + 1, 0 for an unused slot
+        uint8_t id;   ///< index of the remote key
+    } mavlink_peer_key_t;
+#endif
+
+#ifdef MAVLINK_USE_TX_BUFFER
+#ifndef MAVLINK_TX_BUFFER_SIZE
+#define MAVLINK_TX_BUFFER_SIZE 1024 // at least MAVLINK_MAX_PACKET_LEN, at most 65535
+#endif
+
+    /*
+  coalescing transmit buffer of one channel for the convenience send
+  functions. A trigger set to 0 is off, and with all triggers off every
+  frame is sent as soon as it is complete. See mavlink_tx_buffer_config()
+ */
+    typedef struct __mavlink_tx_buffer
+    {
+        uint16_t len;          ///< bytes waiting in buf
+        uint16_t frames;       ///< frames waiting in buf
+        uint16_t flush_bytes;  ///< flush once this many bytes are waiting
+        uint16_t flush_frames; ///< flush once this many frames are waiting
+        uint32_t flush_ms;     ///< flush once the oldest frame has waited this long
+        uint32_t first_ms;     ///< time the oldest waiting frame was queued
+        uint8_t buf[MAVLINK_TX_BUFFER_SIZE];
+    } mavlink_tx_buffer_t;
+#endif
+
+#ifdef MAVLINK_USE_RATE_LIMIT
+#ifndef MAVLINK_RATE_LIMIT_SLOTS
+#define MAVLINK_RATE_LIMIT_SLOTS 16 // power of 2, for all channels together
+#endif
+
+#define MAVLINK_RATE_LIMIT_DROP 0  // frames over the rate are dropped
+#define MAVLINK_RATE_LIMIT_DEFER 1 // the newest frame over the rate goes out when a token is free
+
+    /*
+      token bucket of one message id on one channel. Tokens are counted in
+      thousandths of a frame
+     */
+    typedef struct __mavlink_rate_limit
+    {
+        uint64_t key;         ///< (chan << 24 | msgid) + 1, 0 for a free slot
+        uint32_t rate_mhz;    ///< frames per 1000 seconds
+        uint32_t burst;       ///< most tokens that can be saved up
+        uint32_t tokens;      ///< tokens available
+        uint32_t tokens_frac; ///< millionths of a frame earned on top of tokens
+        uint32_t last_ms;     ///< time tokens were last added
+        uint32_t sent;        ///< frames let through
+        uint32_t dropped;     ///< frames dropped, including superseded deferred frames
+        uint32_t deferred;    ///< frames held back to go out later
+        uint8_t policy;       ///< MAVLINK_RATE_LIMIT_DROP or _DEFER
+        uint8_t pending;      ///< a deferred frame is waiting in payload
+        uint8_t min_length;   ///< of the deferred frame
+        uint8_t length;       ///< of the deferred frame
+        uint8_t crc_extra;    ///< of the deferred frame
+        uint8_t payload[MAVLINK_MAX_PAYLOAD_LEN];
+    } mavlink_rate_limit_t;
+#endif
+
+    /*
+      all the state of the library, so that independent contexts can be
+      used from different threads. The functions without a context argument
+      use the default context, see mavlink_get_default_context()
+     */
+    typedef struct __mavlink_context
+    {
+        mavlink_status_t status[MAVLINK_COMM_NUM_BUFFERS];   ///< channel status
+        mavlink_message_t buffer[MAVLINK_COMM_NUM_BUFFERS];  ///< channel parse buffers
+        key_status_t remote_keys[MAVLINK_NUM_REMOTE_KEYS];   ///< keys agreed with remote systems
+        mavlink_device_certificate_t certificate;            ///< certificate of this device
+        uint8_t certificate_loaded;                          ///< certificate has been read
+#ifdef ENCRYPTION
+        mavlink_peer_key_t peer_keys[MAVLINK_PEER_KEY_SLOTS]; ///< remote key of each peer, see mavlink_ctx_set_peer_key()
+        uint32_t peer_keys_generation;                        ///< bumped on every change of peer_keys
+#endif
+#ifdef MAVLINK_USE_TX_BUFFER
+        mavlink_tx_buffer_t tx_buffer[MAVLINK_COMM_NUM_BUFFERS]; ///< convenience send buffers
+#endif
+#ifdef MAVLINK_USE_RATE_LIMIT
+        mavlink_rate_limit_t rate_limit[MAVLINK_RATE_LIMIT_SLOTS]; ///< convenience send rate limits
+#endif
+    } mavlink_context_t;
+
 /*
   incompat_flags bits
  */
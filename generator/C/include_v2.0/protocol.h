@@ -39,22 +39,63 @@
 #define MAVLINK_HELPER
 
 /* decls in sync with those in mavlink_helpers.h */
+#ifndef MAVLINK_GET_DEFAULT_CONTEXT
+MAVLINK_HELPER mavlink_context_t *mavlink_get_default_context(void);
+#endif
+MAVLINK_HELPER void mavlink_context_init(mavlink_context_t *ctx);
+MAVLINK_HELPER mavlink_status_t *mavlink_ctx_get_channel_status(mavlink_context_t *ctx, uint8_t chan);
+MAVLINK_HELPER mavlink_message_t *mavlink_ctx_get_channel_buffer(mavlink_context_t *ctx, uint8_t chan);
 #ifndef MAVLINK_GET_CHANNEL_STATUS
 MAVLINK_HELPER mavlink_status_t *mavlink_get_channel_status(uint8_t chan);
 #endif
+MAVLINK_HELPER void mavlink_ctx_reset_channel_status(mavlink_context_t *ctx, uint8_t chan);
 MAVLINK_HELPER void mavlink_reset_channel_status(uint8_t chan);
 
+MAVLINK_HELPER mavlink_device_certificate_t *mavlink_ctx_get_device_certificate(mavlink_context_t *ctx);
 MAVLINK_HELPER mavlink_device_certificate_t *mavlink_get_device_certificate();
+MAVLINK_HELPER uint8_t mavlink_ctx_read_certificate(mavlink_context_t *ctx, const char *path_to_certificate);
 MAVLINK_HELPER uint8_t mavlink_read_certificate(const char *path_to_certificate);
+MAVLINK_HELPER key_status_t *mavlink_ctx_get_remote_key(mavlink_context_t *ctx, int id);
 MAVLINK_HELPER key_status_t *mavlink_get_remote_key(int id);
+MAVLINK_HELPER void mavlink_ctx_set_remote_key(mavlink_context_t *ctx, int id, uint8_t *public_key);
 MAVLINK_HELPER void mavlink_set_remote_key(int id, uint8_t *public_key);
+MAVLINK_HELPER bool mavlink_ctx_is_set_remote_key(mavlink_context_t *ctx, int id);
 MAVLINK_HELPER bool mavlink_is_set_remote_key(int id);
+#ifdef ENCRYPTION
+MAVLINK_HELPER const mavlink_cipher_t *mavlink_get_cipher(uint8_t cipher_id);
+MAVLINK_HELPER bool mavlink_ctx_set_remote_key_cipher(mavlink_context_t *ctx, int id, uint8_t cipher_id);
+MAVLINK_HELPER bool mavlink_set_remote_key_cipher(int id, uint8_t cipher_id);
+MAVLINK_HELPER bool mavlink_ctx_set_peer_key(mavlink_context_t *ctx, uint8_t link, uint8_t sysid, uint8_t compid, int id);
+MAVLINK_HELPER bool mavlink_set_peer_key(uint8_t link, uint8_t sysid, uint8_t compid, int id);
+MAVLINK_HELPER void mavlink_ctx_clear_peer_keys(mavlink_context_t *ctx);
+MAVLINK_HELPER void mavlink_clear_peer_keys(void);
+#endif
+MAVLINK_HELPER unsigned int mavlink_ctx_check_remote_certificate(mavlink_context_t *ctx, float start, float end,
+																 uint8_t *remote_certificate, const unsigned char *sign);
 MAVLINK_HELPER unsigned int mavlink_check_remote_certificate(float start, float end, uint8_t *remote_certificate, const unsigned char *sign);
 
 MAVLINK_HELPER uint16_t mavlink_finalize_message_chan(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
 													  uint8_t chan, uint8_t min_length, uint8_t length, uint8_t crc_extra);
 MAVLINK_HELPER uint16_t mavlink_finalize_message(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
 												 uint8_t min_length, uint8_t length, uint8_t crc_extra);
+MAVLINK_HELPER uint16_t mavlink_ctx_finalize_message_chan(mavlink_context_t *ctx, mavlink_message_t *msg,
+														  uint8_t system_id, uint8_t component_id,
+														  uint8_t chan, uint8_t min_length, uint8_t length, uint8_t crc_extra);
+MAVLINK_HELPER uint16_t mavlink_finalize_message_reserved(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
+														  mavlink_status_t *status, uint8_t min_length, uint8_t length,
+														  uint8_t crc_extra, uint8_t seq, uint64_t timestamp);
+#ifdef MAVLINK_USE_CONCURRENT_FINALIZE
+MAVLINK_HELPER uint16_t mavlink_finalize_message_concurrent(mavlink_message_t *msg, uint8_t system_id, uint8_t component_id,
+															mavlink_status_t *status, uint8_t min_length, uint8_t length,
+															uint8_t crc_extra);
+#endif
+#if defined(MAVLINK_USE_CONCURRENT_FINALIZE) || defined(MAVLINK_USE_FRAME_RING)
+MAVLINK_HELPER void mavlink_signing_timestamp_advance(mavlink_signing_t *signing, uint64_t timestamp);
+#endif
+MAVLINK_HELPER uint8_t mavlink_wire_header_len(const mavlink_status_t *status);
+MAVLINK_HELPER uint16_t mavlink_finalize_wire(uint8_t *out, uint8_t system_id, uint8_t component_id,
+											  mavlink_status_t *status, uint32_t msgid,
+											  uint8_t min_length, uint8_t length, uint8_t crc_extra);
 #ifdef MAVLINK_USE_CONVENIENCE_FUNCTIONS
 MAVLINK_HELPER void _mav_finalize_message_chan_send(mavlink_channel_t chan, uint32_t msgid, const char *packet,
 													uint8_t min_length, uint8_t length, uint8_t crc_extra);
@@ -62,25 +103,66 @@ MAVLINK_HELPER void _mav_finalize_message_chan_send(mavlink_channel_t chan, uint
 MAVLINK_HELPER uint16_t mavlink_msg_to_send_buffer(uint8_t *buffer, const mavlink_message_t *msg);
 MAVLINK_HELPER void mavlink_start_checksum(mavlink_message_t *msg);
 MAVLINK_HELPER void mavlink_update_checksum(mavlink_message_t *msg, uint8_t c);
+#ifdef MAVLINK_USE_IOVEC
+#include <sys/uio.h>
+MAVLINK_HELPER unsigned mavlink_msgs_to_iovec(const mavlink_message_t *const *msgs, unsigned count,
+											  mavlink_iovec_scratch_t *scratch, struct iovec *iov, size_t *bytes);
+MAVLINK_HELPER ssize_t mavlink_writev(int fd, const mavlink_message_t *const *msgs, unsigned count);
+#endif
+MAVLINK_HELPER void mavlink_rx_stats_init(mavlink_rx_stats_t *stats);
+MAVLINK_HELPER const mavlink_rx_stats_msg_t *mavlink_rx_stats_find_msg(const mavlink_rx_stats_t *stats, uint32_t msgid);
+MAVLINK_HELPER const mavlink_rx_stats_peer_t *mavlink_rx_stats_find_peer(const mavlink_rx_stats_t *stats, uint8_t sysid, uint8_t compid);
+MAVLINK_HELPER void mavlink_rx_filter_init(mavlink_rx_filter_t *filter, bool pass_unlisted);
+MAVLINK_HELPER bool mavlink_rx_filter_set(mavlink_rx_filter_t *filter, uint32_t msgid, uint16_t every);
 MAVLINK_HELPER uint8_t mavlink_frame_char_buffer(mavlink_message_t *rxmsg,
 												 mavlink_status_t *status,
 												 uint8_t c,
 												 mavlink_message_t *r_message,
 												 mavlink_status_t *r_mavlink_status);
+MAVLINK_HELPER size_t mavlink_frame_buffer(mavlink_message_t *rxmsg, mavlink_status_t *status,
+										   const uint8_t *buf, size_t len,
+										   mavlink_frame_callback_t callback, void *arg);
+MAVLINK_HELPER void mavlink_rx_ring_init(mavlink_rx_ring_t *ring, mavlink_message_t *slots, uint8_t num_slots);
+MAVLINK_HELPER uint8_t mavlink_frame_char_view(mavlink_rx_ring_t *ring, mavlink_status_t *status,
+											   uint8_t c, mavlink_message_view_t *view);
+MAVLINK_HELPER size_t mavlink_frame_buffer_view(mavlink_rx_ring_t *ring, mavlink_status_t *status,
+												const uint8_t *buf, size_t len, mavlink_message_view_t *view);
+MAVLINK_HELPER void mavlink_rx_ring_release(mavlink_rx_ring_t *ring, const mavlink_message_view_t *view);
 MAVLINK_HELPER uint8_t mavlink_frame_char(uint8_t chan, uint8_t c, mavlink_message_t *r_message, mavlink_status_t *r_mavlink_status);
 MAVLINK_HELPER uint8_t mavlink_parse_char(uint8_t chan, uint8_t c, mavlink_message_t *r_message, mavlink_status_t *r_mavlink_status);
+MAVLINK_HELPER uint8_t mavlink_ctx_frame_char(mavlink_context_t *ctx, uint8_t chan, uint8_t c,
+											  mavlink_message_t *r_message, mavlink_status_t *r_mavlink_status);
+MAVLINK_HELPER uint8_t mavlink_ctx_parse_char(mavlink_context_t *ctx, uint8_t chan, uint8_t c,
+											  mavlink_message_t *r_message, mavlink_status_t *r_mavlink_status);
 MAVLINK_HELPER uint8_t put_bitfield_n_by_index(int32_t b, uint8_t bits, uint8_t packet_index, uint8_t bit_index,
 											   uint8_t *r_bit_index, uint8_t *buffer);
 MAVLINK_HELPER const mavlink_msg_entry_t *mavlink_get_msg_entry(uint32_t msgid);
 #ifdef MAVLINK_USE_CONVENIENCE_FUNCTIONS
 MAVLINK_HELPER void _mavlink_send_uart(mavlink_channel_t chan, const char *buf, uint16_t len);
 MAVLINK_HELPER void _mavlink_resend_uart(mavlink_channel_t chan, const mavlink_message_t *msg);
+#ifdef MAVLINK_USE_TX_BUFFER
+MAVLINK_HELPER void mavlink_tx_buffer_config(mavlink_channel_t chan, uint16_t flush_bytes,
+											 uint16_t flush_frames, uint32_t flush_ms);
+MAVLINK_HELPER void mavlink_tx_flush(mavlink_channel_t chan);
+MAVLINK_HELPER void mavlink_tx_poll(mavlink_channel_t chan);
+#endif
+#ifdef MAVLINK_USE_RATE_LIMIT
+MAVLINK_HELPER bool mavlink_rate_limit_set(mavlink_channel_t chan, uint32_t msgid, uint32_t rate_mhz,
+										   uint16_t burst, uint8_t policy);
+MAVLINK_HELPER const mavlink_rate_limit_t *mavlink_rate_limit_get(mavlink_channel_t chan, uint32_t msgid);
+MAVLINK_HELPER void mavlink_rate_limit_poll(mavlink_channel_t chan);
+#endif
 #endif
 
 #else
 
 #define MAVLINK_HELPER static inline
 #include "mavlink_helpers.h"
+#include "mavlink_channel_registry.h"
+#include "mavlink_frame_ring.h"
+#include "mavlink_tx_sched.h"
+#include "mavlink_tx_conflate.h"
+#include "mavlink_router.h"
 
 #endif // MAVLINK_SEPARATE_HELPERS
 
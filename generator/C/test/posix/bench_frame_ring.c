@@ -0,0 +1,221 @@
+/*
+  benchmark of the lock-free frame ring against a mutex around
+  finalize and send, with several producer threads and one link writer.
+
+  Each run sends the same number of frames in total, the writer checks
+  that the sequence numbers on the "wire" have no holes and, for signed
+  runs, that the signing timestamps go up frame by frame
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define MAVLINK_USE_FRAME_RING
+#include <mavlink.h>
+
+#define NUM_SLOTS 256
+#define FRAMES_PER_RUN 2000000U
+#define MAX_PRODUCERS 8
+
+static const mavlink_msg_entry_t *entry;
+static mavlink_signing_t signing;
+
+/*
+  the mutex approach: every producer takes the lock, finalizes with the
+  channel status and copies the frame into a ring that the writer empties
+  under the same lock
+ */
+static pthread_mutex_t tx_lock = PTHREAD_MUTEX_INITIALIZER;
+static mavlink_status_t mutex_status;
+static mavlink_frame_slot_t mutex_slots[NUM_SLOTS];
+static uint32_t mutex_head, mutex_tail;
+
+/*
+  the lock-free approach
+ */
+static mavlink_status_t ring_status;
+static mavlink_frame_slot_t ring_slots[NUM_SLOTS];
+static mavlink_frame_ring_t ring;
+
+struct producer {
+	pthread_t thread;
+	unsigned frames;
+	bool spsc;
+};
+
+static void make_msg(mavlink_message_t *msg, unsigned i)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->msgid = entry->msgid;
+	memcpy(_MAV_PAYLOAD_NON_CONST(msg), &i, sizeof(i));
+	_MAV_PAYLOAD_NON_CONST(msg)[entry->max_msg_len - 1] = 1;
+}
+
+static void *mutex_producer(void *arg)
+{
+	struct producer *p = (struct producer *)arg;
+	mavlink_message_t msg;
+	unsigned i = 0;
+
+	while (i < p->frames) {
+		make_msg(&msg, i);
+		pthread_mutex_lock(&tx_lock);
+		if (mutex_head - mutex_tail == NUM_SLOTS) {
+			pthread_mutex_unlock(&tx_lock);
+			sched_yield();
+			continue;
+		}
+		mavlink_frame_slot_t *slot = &mutex_slots[mutex_head++ % NUM_SLOTS];
+		mavlink_finalize_message_buffer(&msg, 1, 1, &mutex_status, entry->min_msg_len, entry->max_msg_len, entry->crc_extra);
+		slot->len = mavlink_msg_to_send_buffer(slot->data, &msg);
+		pthread_mutex_unlock(&tx_lock);
+		i++;
+	}
+	return NULL;
+}
+
+static void *ring_producer(void *arg)
+{
+	struct producer *p = (struct producer *)arg;
+	mavlink_message_t msg;
+	unsigned i = 0;
+
+	while (i < p->frames) {
+		make_msg(&msg, i);
+		if (!mavlink_frame_ring_send(&ring, p->spsc, &msg, 1, 1, entry->min_msg_len, entry->max_msg_len, entry->crc_extra)) {
+			sched_yield();
+			continue;
+		}
+		i++;
+	}
+	return NULL;
+}
+
+/*
+  the link writer. Stands in for write() by summing the frame bytes,
+  and checks the sequence numbers and signing timestamps
+ */
+static unsigned write_frame(const uint8_t *data, uint16_t len, uint8_t *next_seq, uint64_t *last_ts, uint64_t *sum)
+{
+	unsigned errors = data[4] != *next_seq;
+	*next_seq = data[4] + 1;
+	if (data[2] & MAVLINK_IFLAG_SIGNED) {
+		uint64_t ts = 0;
+		memcpy(&ts, &data[len - MAVLINK_SIGNATURE_BLOCK_LEN + 1], 6);
+		errors += ts <= *last_ts;
+		*last_ts = ts;
+	}
+	*sum += len;
+	return errors;
+}
+
+static unsigned mutex_writer(unsigned total, uint64_t *sum)
+{
+	uint8_t seq = 0, frame[MAVLINK_MAX_PACKET_LEN];
+	uint64_t ts = 0;
+	unsigned n = 0, errors = 0;
+
+	while (n < total) {
+		uint16_t len;
+		pthread_mutex_lock(&tx_lock);
+		if (mutex_tail == mutex_head) {
+			pthread_mutex_unlock(&tx_lock);
+			sched_yield();
+			continue;
+		}
+		mavlink_frame_slot_t *slot = &mutex_slots[mutex_tail++ % NUM_SLOTS];
+		len = slot->len;
+		memcpy(frame, slot->data, len);
+		pthread_mutex_unlock(&tx_lock);
+		errors += write_frame(frame, len, &seq, &ts, sum);
+		n++;
+	}
+	return errors;
+}
+
+static unsigned ring_writer(unsigned total, uint64_t *sum)
+{
+	uint8_t seq = 0;
+	uint64_t ts = 0;
+	unsigned n = 0, errors = 0;
+
+	while (n < total) {
+		const mavlink_frame_slot_t *slot = mavlink_frame_ring_peek(&ring);
+		if (slot == NULL) {
+			sched_yield();
+			continue;
+		}
+		errors += write_frame(slot->data, slot->len, &seq, &ts, sum);
+		mavlink_frame_ring_pop(&ring);
+		n++;
+	}
+	return errors;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static unsigned run(const char *name, unsigned num_producers, bool use_ring, bool spsc, bool sign)
+{
+	struct producer producers[MAX_PRODUCERS];
+	unsigned per_producer = FRAMES_PER_RUN / num_producers;
+	unsigned total = per_producer * num_producers, errors, i;
+	uint64_t sum = 0;
+	double t0, t;
+
+	memset(&mutex_status, 0, sizeof(mutex_status));
+	memset(&ring_status, 0, sizeof(ring_status));
+	memset(&signing, 0, sizeof(signing));
+	signing.flags = MAVLINK_SIGNING_FLAG_SIGN_OUTGOING;
+	signing.timestamp = 1;
+	if (sign) {
+		mutex_status.signing = &signing;
+		ring_status.signing = &signing;
+	}
+	mutex_head = mutex_tail = 0;
+	mavlink_frame_ring_init(&ring, ring_slots, NUM_SLOTS, &ring_status);
+
+	t0 = now();
+	for (i = 0; i < num_producers; i++) {
+		producers[i].frames = per_producer;
+		producers[i].spsc = spsc;
+		pthread_create(&producers[i].thread, NULL, use_ring ? ring_producer : mutex_producer, &producers[i]);
+	}
+	errors = use_ring ? ring_writer(total, &sum) : mutex_writer(total, &sum);
+	for (i = 0; i < num_producers; i++) {
+		pthread_join(producers[i].thread, NULL);
+	}
+	t = now() - t0;
+
+	printf("%-6s %-8s %u producer(s): %8.0f kframes/s, %6.1f MB/s%s\n", name, sign ? "signed" : "unsigned",
+	       num_producers, total / t / 1000.0, sum / t / 1.0e6, errors ? " SEQUENCE ERRORS" : "");
+	return errors;
+}
+
+int main(void)
+{
+	static const mavlink_msg_entry_t entries[] = MAVLINK_MESSAGE_CRCS;
+	unsigned n, sign, errors = 0;
+
+	entry = &entries[0];
+
+	for (sign = 0; sign < 2; sign++) {
+		for (n = 1; n <= MAX_PRODUCERS; n *= 2) {
+			errors += run("mutex", n, false, false, sign);
+			if (n == 1) {
+				errors += run("spsc", n, true, true, sign);
+			}
+			errors += run("mpsc", n, true, false, sign);
+		}
+	}
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+/*
+  benchmark of the frame router with 16 vehicles and 16 ground stations
+  on their own endpoints, all on one thread.
+
+  Each vehicle sends HEARTBEAT, ATTITUDE and GLOBAL_POSITION_INT, which
+  fan out to every other endpoint, and each ground station sends
+  COMMAND_LONG to one vehicle. Every round feeds one frame from each
+  endpoint and then empties all endpoint queues, standing in for
+  write() by summing the frame bytes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#define MAVLINK_USE_ROUTER
+#include <mavlink.h>
+
+#define NUM_VEHICLES 16
+#define NUM_ENDPOINTS (2 * NUM_VEHICLES)
+#define FRAMES_PER_ENDPOINT 1024
+#define ROUNDS 200000U
+
+static mavlink_router_t router;
+static mavlink_router_endpoint_t endpoints[NUM_ENDPOINTS];
+static mavlink_router_frame_t frames[4 * NUM_ENDPOINTS];
+
+struct input {
+	uint8_t bytes[FRAMES_PER_ENDPOINT * MAVLINK_MAX_PACKET_LEN];
+	uint32_t offset[FRAMES_PER_ENDPOINT + 1];
+};
+static struct input inputs[NUM_ENDPOINTS];
+
+/*
+  frames each endpoint sends. Signed runs have the router forward
+  signatures like on a real link
+ */
+static void make_inputs(bool sign)
+{
+	mavlink_signing_t signing;
+	unsigned ep, i;
+
+	memset(&signing, 0, sizeof(signing));
+	signing.flags = MAVLINK_SIGNING_FLAG_SIGN_OUTGOING;
+	for (ep = 0; ep < NUM_ENDPOINTS; ep++) {
+		struct input *in = &inputs[ep];
+		mavlink_status_t status;
+		memset(&status, 0, sizeof(status));
+		status.signing = sign ? &signing : NULL;
+		for (i = 0; i < FRAMES_PER_ENDPOINT; i++) {
+			uint8_t *out = &in->bytes[in->offset[i]];
+			uint16_t len;
+			if (ep < NUM_VEHICLES) {
+				switch (i % 3) {
+				case 0:
+					len = mavlink_msg_heartbeat_pack_to_wire(ep + 1, 1, &status, out, 2, 3, 0x81, 4, 4);
+					break;
+				case 1:
+					len = mavlink_msg_attitude_pack_to_wire(ep + 1, 1, &status, out, i, 0.1f, 0.2f, 0.3f, 0, 0, 0);
+					break;
+				default:
+					len = mavlink_msg_global_position_int_pack_to_wire(ep + 1, 1, &status, out, i, 1, 2, 3, 4, 5, 6, 7, 8);
+					break;
+				}
+			} else {
+				len = mavlink_msg_command_long_pack_to_wire(200 + ep, 190, &status, out, (i + ep) % NUM_VEHICLES + 1, 1,
+									    400, 0, 1, 0, 0, 0, 0, 0, 0);
+			}
+			in->offset[i + 1] = in->offset[i] + len;
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static unsigned run(bool sign)
+{
+	uint64_t in_frames = 0, out_frames = 0, out_bytes = 0;
+	unsigned round, ep, errors = 0;
+	double t0, t;
+
+	make_inputs(sign);
+	mavlink_router_init(&router, endpoints, NUM_ENDPOINTS, frames, sizeof(frames) / sizeof(frames[0]));
+
+	// one heartbeat from everyone so the routes are known before timing
+	for (ep = 0; ep < NUM_ENDPOINTS; ep++) {
+		uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+		mavlink_status_t status;
+		memset(&status, 0, sizeof(status));
+		mavlink_router_input(&router, ep, buf,
+				     ep < NUM_VEHICLES ? mavlink_msg_heartbeat_pack_to_wire(ep + 1, 1, &status, buf, 2, 3, 0, 0, 4)
+						       : mavlink_msg_heartbeat_pack_to_wire(200 + ep, 190, &status, buf, 6, 8, 0, 0, 4));
+	}
+	for (ep = 0; ep < NUM_ENDPOINTS; ep++) {
+		while (mavlink_router_peek(&router, ep) != NULL) {
+			mavlink_router_pop(&router, ep);
+		}
+	}
+
+	t0 = now();
+	for (round = 0; round < ROUNDS; round++) {
+		unsigned i = round % FRAMES_PER_ENDPOINT;
+		for (ep = 0; ep < NUM_ENDPOINTS; ep++) {
+			const struct input *in = &inputs[ep];
+			in_frames += mavlink_router_input(&router, ep, &in->bytes[in->offset[i]], in->offset[i + 1] - in->offset[i]);
+		}
+		for (ep = 0; ep < NUM_ENDPOINTS; ep++) {
+			const mavlink_router_frame_t *f;
+			while ((f = mavlink_router_peek(&router, ep)) != NULL) {
+				out_bytes += f->len;
+				out_frames++;
+				mavlink_router_pop(&router, ep);
+			}
+		}
+	}
+	t = now() - t0;
+
+	// vehicles reach all 31 others, commands one vehicle
+	if (in_frames != (uint64_t)ROUNDS * NUM_ENDPOINTS ||
+	    out_frames != (uint64_t)ROUNDS * (NUM_VEHICLES * (NUM_ENDPOINTS - 1) + NUM_VEHICLES)) {
+		errors++;
+	}
+
+	printf("%-8s %8.0f kframes/s in, %8.0f kframes/s out, %6.1f MB/s out, %5.0f ns/frame%s\n",
+	       sign ? "signed" : "unsigned", in_frames / t / 1000.0, out_frames / t / 1000.0, out_bytes / t / 1.0e6,
+	       t * 1.0e9 / in_frames, errors ? " ROUTING ERRORS" : "");
+	return errors;
+}
+
+int main(void)
+{
+	unsigned errors = 0;
+	errors += run(false);
+	errors += run(true);
+	return errors ? 1 : 0;
+}
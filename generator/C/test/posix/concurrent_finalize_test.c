@@ -0,0 +1,214 @@
+/*
+  finalize signed frames for one channel from several threads at once
+  with mavlink_finalize_message_concurrent().
+
+  Checks that every sequence number was handed out equally often, that
+  no signing timestamp was handed out twice, that the timestamps each
+  thread got go up, and that all frames pass the CRC and signature
+  checks of the parser when sent in timestamp order.
+
+  Built with ENCRYPTION the threads also race to build the round keys
+  of the remote key on first use, and the parser must get every payload
+  back
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#define MAVLINK_USE_CONCURRENT_FINALIZE
+#include <mavlink.h>
+
+#define NUM_THREADS 4
+#define FRAMES_PER_THREAD 4096U
+#define NUM_FRAMES (NUM_THREADS * FRAMES_PER_THREAD)
+#define FIRST_TIMESTAMP 1000U
+
+static const mavlink_msg_entry_t msg_entries[] = MAVLINK_MESSAGE_CRCS;
+static const mavlink_msg_entry_t *entry;
+static mavlink_signing_t signing;
+static mavlink_status_t tx_status;
+static mavlink_message_t frames[NUM_THREADS][FRAMES_PER_THREAD];
+static const mavlink_message_t *by_timestamp[NUM_FRAMES];
+static unsigned error_count;
+
+/*
+  the longest message of the dialect that is not sent in clear with
+  ENCRYPTION, so the payload covers as many bytes as possible
+ */
+static const mavlink_msg_entry_t *pick_entry(void)
+{
+	const mavlink_msg_entry_t *best = &msg_entries[0];
+	unsigned i;
+	for (i=0; i<sizeof(msg_entries)/sizeof(msg_entries[0]); i++) {
+		const mavlink_msg_entry_t *e = &msg_entries[i];
+		if (e->msgid != 0 && e->msgid != 10000 && e->msgid != 10010 &&
+		    (best->msgid == 0 || e->max_msg_len > best->max_msg_len)) {
+			best = e;
+		}
+	}
+	return best;
+}
+
+static void make_payload(char *payload, unsigned thread, unsigned i)
+{
+	unsigned j;
+	for (j=0; j<entry->max_msg_len; j++) {
+		// a non zero last byte keeps the payload from being trimmed
+		payload[j] = j + 1 == entry->max_msg_len ? 1 : (char)(thread * 31 + i + j * 7);
+	}
+}
+
+static uint64_t frame_timestamp(const mavlink_message_t *msg)
+{
+	uint64_t t = 0;
+	int i;
+	for (i=6; i>=1; i--) {
+		t = (t << 8) | msg->signature[i];
+	}
+	return t;
+}
+
+static void *finalize_thread(void *arg)
+{
+	unsigned thread = (unsigned)(uintptr_t)arg;
+	unsigned i;
+	for (i=0; i<FRAMES_PER_THREAD; i++) {
+		mavlink_message_t *msg = &frames[thread][i];
+		memset(msg, 0, sizeof(*msg));
+		msg->msgid = entry->msgid;
+		make_payload(_MAV_PAYLOAD_NON_CONST(msg), thread, i);
+		mavlink_finalize_message_concurrent(msg, 11, 10, &tx_status, entry->min_msg_len,
+						    entry->max_msg_len, entry->crc_extra);
+	}
+	return NULL;
+}
+
+/*
+  feed the frames to the parser of a channel that checks signatures, in
+  timestamp order as a link writer has to send them
+ */
+static void parse_frames(void)
+{
+	static mavlink_signing_t rx_signing;
+	static mavlink_signing_streams_t rx_streams;
+	mavlink_status_t *rx_status = mavlink_get_channel_status(MAVLINK_COMM_1);
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+	char payload[MAVLINK_MAX_PAYLOAD_LEN];
+	mavlink_message_t rxmsg;
+	mavlink_status_t status;
+	unsigned i, received = 0;
+
+	memcpy(rx_signing.secret_key, signing.secret_key, sizeof(rx_signing.secret_key));
+	rx_status->signing = &rx_signing;
+	rx_status->signing_streams = &rx_streams;
+	for (i=0; i<NUM_FRAMES; i++) {
+		unsigned n = (unsigned)(by_timestamp[i] - &frames[0][0]);
+		uint16_t len = mavlink_msg_to_send_buffer(buf, by_timestamp[i]);
+		uint16_t j;
+		make_payload(payload, n / FRAMES_PER_THREAD, n % FRAMES_PER_THREAD);
+		for (j=0; j<len; j++) {
+			if (mavlink_frame_char(MAVLINK_COMM_1, buf[j], &rxmsg, &status) != MAVLINK_FRAMING_OK) {
+				continue;
+			}
+#ifdef ENCRYPTION
+			/*
+			  the parser only decrypts unsigned frames, decrypt with the
+			  one shot Speck128192, the default suite, which builds its
+			  own round keys rather than the ones the threads published
+			*/
+			{
+				key_status_t *key = mavlink_get_remote_key(0);
+				Speck128192(key->iv, key->shared_key, (uint8_t *)_MAV_PAYLOAD_NON_CONST(&rxmsg), rxmsg.len);
+			}
+#endif
+			if (rxmsg.len != entry->max_msg_len || memcmp(_MAV_PAYLOAD(&rxmsg), payload, rxmsg.len) != 0) {
+				printf("Payload of frame %u of thread %u came back wrong\n", n % FRAMES_PER_THREAD,
+				       n / FRAMES_PER_THREAD);
+				error_count++;
+			}
+			received++;
+		}
+	}
+	rx_status->signing = NULL;
+	rx_status->signing_streams = NULL;
+	if (received != NUM_FRAMES) {
+		printf("Parser accepted %u of %u frames\n", received, NUM_FRAMES);
+		error_count++;
+	}
+}
+
+int main(void)
+{
+	pthread_t threads[NUM_THREADS];
+	unsigned seq_counts[256];
+	unsigned t, i;
+
+	entry = pick_entry();
+	signing.flags = MAVLINK_SIGNING_FLAG_SIGN_OUTGOING;
+	signing.timestamp = FIRST_TIMESTAMP;
+	memset(signing.secret_key, 42, sizeof(signing.secret_key));
+	tx_status.signing = &signing;
+#ifdef ENCRYPTION
+	for (i=0; i<sizeof(mavlink_get_remote_key(0)->shared_key); i++) {
+		mavlink_get_remote_key(0)->shared_key[i] = (uint8_t)(i * 5 + 1);
+	}
+	for (i=0; i<sizeof(mavlink_get_remote_key(0)->iv); i++) {
+		mavlink_get_remote_key(0)->iv[i] = (uint8_t)(0x80 + i);
+	}
+#endif
+
+	for (t=0; t<NUM_THREADS; t++) {
+		pthread_create(&threads[t], NULL, finalize_thread, (void *)(uintptr_t)t);
+	}
+	for (t=0; t<NUM_THREADS; t++) {
+		pthread_join(threads[t], NULL);
+	}
+
+	memset(seq_counts, 0, sizeof(seq_counts));
+	for (t=0; t<NUM_THREADS; t++) {
+		uint64_t last = 0;
+		for (i=0; i<FRAMES_PER_THREAD; i++) {
+			const mavlink_message_t *msg = &frames[t][i];
+			uint64_t ts = frame_timestamp(msg);
+			seq_counts[msg->seq]++;
+			if (ts <= last && i != 0) {
+				printf("Thread %u timestamp %llu after %llu\n", t,
+				       (unsigned long long)ts, (unsigned long long)last);
+				error_count++;
+			}
+			last = ts;
+			if (ts < FIRST_TIMESTAMP || ts >= FIRST_TIMESTAMP + NUM_FRAMES ||
+			    by_timestamp[ts - FIRST_TIMESTAMP] != NULL) {
+				printf("Timestamp %llu out of range or handed out twice\n", (unsigned long long)ts);
+				error_count++;
+				continue;
+			}
+			by_timestamp[ts - FIRST_TIMESTAMP] = msg;
+		}
+	}
+	// NUM_FRAMES is a multiple of 256, so the sequence wrapped evenly
+	for (i=0; i<256; i++) {
+		if (seq_counts[i] != NUM_FRAMES / 256) {
+			printf("Sequence number %u used %u times\n", i, seq_counts[i]);
+			error_count++;
+		}
+	}
+	if (signing.timestamp != FIRST_TIMESTAMP + NUM_FRAMES || tx_status.current_tx_seq != (uint8_t)NUM_FRAMES) {
+		printf("Counters ended at timestamp %llu and sequence %u\n",
+		       (unsigned long long)signing.timestamp, (unsigned)tx_status.current_tx_seq);
+		error_count++;
+	}
+	if (error_count == 0) {
+		parse_frames();
+	}
+
+	if (error_count != 0) {
+		printf("Error count %u\n", error_count);
+		exit(1);
+	}
+	printf("No errors detected\n");
+	return 0;
+}
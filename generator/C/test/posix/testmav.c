@@ -10,6 +10,14 @@
 
 #define MAVLINK_USE_CONVENIENCE_FUNCTIONS
 #define MAVLINK_USE_MESSAGE_INFO
+#define MAVLINK_USE_CHANNEL_REGISTRY
+#define MAVLINK_USE_IOVEC
+#define MAVLINK_USE_TX_BUFFER
+#define MAVLINK_USE_FRAME_RING
+#define MAVLINK_USE_TX_SCHED
+#define MAVLINK_USE_TX_CONFLATE
+#define MAVLINK_USE_RATE_LIMIT
+#define MAVLINK_USE_ROUTER
 #define MAVLINK_COMM_NUM_BUFFERS 2
 
 // this trick allows us to make mavlink_message_t as small as possible
@@ -25,6 +33,10 @@ static void comm_send_ch(mavlink_channel_t chan, uint8_t c);
 
 static mavlink_message_t last_msg;
 
+// rate limits run on a clock the tests move by hand
+static uint32_t test_time_ms;
+#define MAVLINK_RATE_LIMIT_TIME_MS() test_time_ms
+
 #include <mavlink.h>
 #include <testsuite.h>
 
@@ -168,11 +180,1245 @@ static void comm_send_ch(mavlink_channel_t chan, uint8_t c)
 	}
 }
 
+#if defined(MAVLINK_HAVE_FRAME_BUFFER) || defined(MAVLINK_HAVE_RX_RING) || \
+    defined(MAVLINK_HAVE_CHANNEL_REGISTRY) || defined(MAVLINK_HAVE_CONTEXT) || \
+    defined(MAVLINK_HAVE_RX_FILTER) || defined(MAVLINK_HAVE_IOVEC)
+/*
+  every message in the dialect, finalized for one channel, each frame
+  followed by two bytes of line noise. See build_frame_stream()
+ */
+static const mavlink_msg_entry_t stream_entries[] = MAVLINK_MESSAGE_CRCS;
+#define STREAM_NUM_ENTRIES (sizeof(stream_entries)/sizeof(stream_entries[0]))
+static uint8_t stream[STREAM_NUM_ENTRIES * (MAVLINK_MAX_PACKET_LEN + 2)];
+static uint32_t msgids[STREAM_NUM_ENTRIES];
+static size_t stream_len;
+
+/*
+  fill stream and msgids, with every third MAVLink1 capable message sent
+  as MAVLink1. The finalized messages are also copied to sent unless it
+  is NULL
+ */
+static void build_frame_stream(mavlink_message_t *sent)
+{
+	mavlink_status_t tx_status;
+	mavlink_message_t msg;
+	unsigned i, j;
+
+	memset(&tx_status, 0, sizeof(tx_status));
+	stream_len = 0;
+	for (i=0; i<STREAM_NUM_ENTRIES; i++) {
+		const mavlink_msg_entry_t *e = &stream_entries[i];
+		memset(&msg, 0, sizeof(msg));
+		for (j=0; j<e->max_msg_len; j++) {
+			_MAV_PAYLOAD_NON_CONST(&msg)[j] = (char)(i + j*7);
+		}
+		msg.msgid = e->msgid;
+		if (e->msgid < 256 && i % 3 == 0) {
+			tx_status.flags |= MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+		} else {
+			tx_status.flags &= ~MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+		}
+		mavlink_finalize_message_buffer(&msg, 11, 10, &tx_status, e->min_msg_len,
+						e->max_msg_len, e->crc_extra);
+		stream_len += mavlink_msg_to_send_buffer(&stream[stream_len], &msg);
+		if (sent != NULL) {
+			sent[i] = msg;
+		}
+		stream[stream_len++] = 0x55;
+		stream[stream_len++] = 0;
+		msgids[i] = e->msgid;
+	}
+}
+#endif
+
+#if defined(MAVLINK_HAVE_FRAME_BUFFER) || defined(MAVLINK_HAVE_CHANNEL_REGISTRY) || \
+    defined(MAVLINK_HAVE_RX_FILTER)
+static unsigned frame_buffer_count;
+
+static void frame_buffer_callback(void *arg, uint8_t framing, const mavlink_message_t *msg, const mavlink_status_t *status)
+{
+	const uint32_t *expected = (const uint32_t *)arg;
+	(void)status;
+	if (framing != MAVLINK_FRAMING_OK || msg->msgid != expected[frame_buffer_count]) {
+		printf("Bulk framing error at frame %u (msgid=%u framing=%u)\n",
+		       frame_buffer_count, (unsigned)msg->msgid, (unsigned)framing);
+		error_count++;
+	}
+	frame_buffer_count++;
+}
+#endif
+
+#ifdef MAVLINK_HAVE_FRAME_BUFFER
+/*
+  feed the stream to mavlink_frame_buffer() in chunks of different sizes
+  so that frames get split between calls
+ */
+static void test_frame_buffer(void)
+{
+	const unsigned num_entries = STREAM_NUM_ENTRIES;
+	const size_t chunk_sizes[] = { 1, 3, 17, 64, 1000, sizeof(stream) };
+	mavlink_status_t rx_status;
+	mavlink_message_t rxmsg;
+	unsigned i, j;
+
+	build_frame_stream(NULL);
+
+	for (i=0; i<sizeof(chunk_sizes)/sizeof(chunk_sizes[0]); i++) {
+		static mavlink_rx_stats_t stats;
+		const mavlink_rx_stats_peer_t *peer;
+		size_t ofs, frames = 0;
+		memset(&rx_status, 0, sizeof(rx_status));
+		mavlink_rx_stats_init(&stats);
+		rx_status.stats = &stats;
+		frame_buffer_count = 0;
+		for (ofs=0; ofs<stream_len; ofs += chunk_sizes[i]) {
+			size_t n = stream_len - ofs < chunk_sizes[i] ? stream_len - ofs : chunk_sizes[i];
+			frames += mavlink_frame_buffer(&rxmsg, &rx_status, &stream[ofs], n, frame_buffer_callback, msgids);
+		}
+		if (frames != num_entries || frame_buffer_count != num_entries) {
+			printf("Bulk framing with %u byte chunks got %u of %u frames\n",
+			       (unsigned)chunk_sizes[i], (unsigned)frames, num_entries);
+			error_count++;
+		}
+		// every frame is followed by two bytes of noise, and the sequence has no holes
+		peer = mavlink_rx_stats_find_peer(&stats, 11, 10);
+		if (stats.frames != num_entries || stats.bytes != stream_len - 2*num_entries ||
+		    stats.crc_errors != 0 || stats.seq_gaps != 0 ||
+		    peer == NULL || peer->frames != num_entries) {
+			printf("Bad receive statistics with %u byte chunks\n", (unsigned)chunk_sizes[i]);
+			error_count++;
+		}
+		for (j=0; j<num_entries; j++) {
+			const mavlink_rx_stats_msg_t *m = mavlink_rx_stats_find_msg(&stats, msgids[j]);
+			if (m == NULL || m->count != 1) {
+				printf("Bad histogram entry for msgid %u\n", (unsigned)msgids[j]);
+				error_count++;
+			}
+		}
+	}
+}
+#endif
+
+#ifdef MAVLINK_HAVE_RX_RING
+/*
+  parse the stream into a small ring, holding on to views until it fills
+  up and then releasing them out of order
+ */
+static void test_rx_ring(void)
+{
+	static mavlink_message_t slots[4];
+	static const unsigned release_order[] = { 1, 0, 3, 2 };
+	mavlink_rx_ring_t ring;
+	mavlink_message_view_t view, views[4];
+	mavlink_status_t rx_status;
+	unsigned i, held = 0, received = 0;
+	size_t ofs = 0;
+
+	build_frame_stream(NULL);
+	mavlink_rx_ring_init(&ring, slots, 4);
+	memset(&rx_status, 0, sizeof(rx_status));
+	while (ofs < stream_len) {
+		size_t n = mavlink_frame_buffer_view(&ring, &rx_status, &stream[ofs], stream_len - ofs, &view);
+		if (n == 0) {
+			for (i=0; i<held; i++) {
+				mavlink_rx_ring_release(&ring, &views[release_order[i]]);
+			}
+			held = 0;
+			continue;
+		}
+		ofs += n;
+		if (view.framing != MAVLINK_FRAMING_INCOMPLETE) {
+			const mavlink_message_view_t *v = &view;
+			if (v->framing != MAVLINK_FRAMING_OK || v->msg->msgid != msgids[received] ||
+			    v->payload != (const uint8_t *)_MAV_PAYLOAD(v->msg) || v->len != v->msg->len) {
+				printf("Ring framing error at frame %u\n", received);
+				error_count++;
+			}
+			received++;
+			views[held++] = view;
+		}
+	}
+	if (received != STREAM_NUM_ENTRIES) {
+		printf("Ring framing got %u of %u frames\n", received, (unsigned)STREAM_NUM_ENTRIES);
+		error_count++;
+	}
+}
+#endif
+
+#ifdef MAVLINK_HAVE_CHANNEL_REGISTRY
+/*
+  interleave the stream over many registry channels, 64 bytes at a time,
+  after closing and reopening every second channel
+ */
+static void test_channel_registry(void)
+{
+	static mavlink_channel_handle_t handles[300];
+	const unsigned num_handles = sizeof(handles)/sizeof(handles[0]);
+	const unsigned num_entries = STREAM_NUM_ENTRIES;
+	mavlink_channel_registry_t reg;
+	unsigned i, j;
+	size_t ofs;
+
+	build_frame_stream(NULL);
+	mavlink_channel_registry_init(&reg);
+	for (i=0; i<num_handles; i++) {
+		handles[i] = mavlink_channel_open(&reg, &handles[i]);
+		if (handles[i] < MAVLINK_COMM_NUM_BUFFERS || mavlink_channel_get_user_data(&reg, handles[i]) != &handles[i]) {
+			printf("Bad channel handle %u\n", (unsigned)handles[i]);
+			error_count++;
+		}
+	}
+	for (i=0; i<num_handles; i += 2) {
+		mavlink_channel_close(&reg, handles[i]);
+	}
+	for (i=0; i<num_handles; i += 2) {
+		handles[i] = mavlink_channel_open(&reg, NULL);
+	}
+	if (reg.count != num_handles || reg.num_slots != num_handles ||
+	    mavlink_channel_get_status(&reg, 1) != mavlink_get_channel_status(1)) {
+		printf("Channel registry did not reuse closed channels\n");
+		error_count++;
+	}
+	for (j=0; j<4; j++) {
+		frame_buffer_count = 0;
+		for (ofs=0; ofs<stream_len; ofs += 64) {
+			for (i=j; i<num_handles; i += 4) {
+				size_t n = stream_len - ofs < 64 ? stream_len - ofs : 64;
+				if (i == j) {
+					mavlink_channel_frame_buffer(&reg, handles[i], &stream[ofs], n, frame_buffer_callback, msgids);
+				} else {
+					mavlink_channel_frame_buffer(&reg, handles[i], &stream[ofs], n, NULL, NULL);
+				}
+			}
+		}
+		if (frame_buffer_count != num_entries ||
+		    mavlink_channel_get_status(&reg, handles[num_handles - 4 + j])->packet_rx_success_count != num_entries) {
+			printf("Channel registry framing got %u of %u frames\n", frame_buffer_count, num_entries);
+			error_count++;
+		}
+	}
+	mavlink_channel_registry_free(&reg);
+}
+#endif
+
+#ifdef MAVLINK_HAVE_CONTEXT
+/*
+  two contexts parsing the stream on the same channel number side by
+  side, without touching the default context
+ */
+static void test_context_parse(void)
+{
+	static mavlink_context_t ctx[2];
+	unsigned counts[2] = { 0, 0 };
+	uint16_t default_count = mavlink_get_channel_status(MAVLINK_COMM_1)->packet_rx_success_count;
+	const unsigned num_entries = STREAM_NUM_ENTRIES;
+	mavlink_message_t rxmsg;
+	unsigned j;
+	size_t ofs;
+
+	build_frame_stream(NULL);
+	mavlink_context_init(&ctx[0]);
+	mavlink_context_init(&ctx[1]);
+	for (ofs=0; ofs<stream_len; ofs++) {
+		for (j=0; j<2; j++) {
+			if (mavlink_ctx_parse_char(&ctx[j], MAVLINK_COMM_1, stream[ofs], &rxmsg, NULL)) {
+				if (rxmsg.msgid != msgids[counts[j]]) {
+					printf("Context %u got msgid %u at frame %u\n", j, (unsigned)rxmsg.msgid, counts[j]);
+					error_count++;
+				}
+				counts[j]++;
+			}
+		}
+	}
+	if (counts[0] != num_entries || counts[1] != num_entries ||
+	    mavlink_get_channel_status(MAVLINK_COMM_1)->packet_rx_success_count != default_count) {
+		printf("Context parsing got %u and %u of %u frames\n", counts[0], counts[1], num_entries);
+		error_count++;
+	}
+}
+#endif
+
+#ifdef MAVLINK_HAVE_RX_FILTER
+/*
+  pass one msgid always and another every second time, over three
+  copies of the stream fed in chunks of different sizes
+ */
+static void test_rx_filter(void)
+{
+	const size_t filter_chunks[] = { 1, 17, sizeof(stream) };
+	const unsigned num_entries = STREAM_NUM_ENTRIES;
+	mavlink_rx_filter_t filter;
+	mavlink_status_t rx_status;
+	mavlink_message_t rxmsg;
+	uint32_t expected[5];
+	unsigned i, j;
+
+	build_frame_stream(NULL);
+	expected[0] = msgids[1];
+	expected[1] = msgids[2];
+	expected[2] = msgids[1];
+	expected[3] = msgids[1];
+	expected[4] = msgids[2];
+	for (i=0; i<sizeof(filter_chunks)/sizeof(filter_chunks[0]); i++) {
+		size_t ofs, frames = 0;
+		memset(&rx_status, 0, sizeof(rx_status));
+		mavlink_rx_filter_init(&filter, false);
+		mavlink_rx_filter_set(&filter, msgids[1], 1);
+		mavlink_rx_filter_set(&filter, msgids[2], 2);
+		rx_status.filter = &filter;
+		frame_buffer_count = 0;
+		for (j=0; j<3; j++) {
+			for (ofs=0; ofs<stream_len; ofs += filter_chunks[i]) {
+				size_t n = stream_len - ofs < filter_chunks[i] ? stream_len - ofs : filter_chunks[i];
+				frames += mavlink_frame_buffer(&rxmsg, &rx_status, &stream[ofs], n,
+							       frame_buffer_callback, expected);
+			}
+		}
+		if (frames != 5 || filter.rejected != 3*num_entries - 5) {
+			printf("Filtered framing with %u byte chunks passed %u frames, rejected %u\n",
+			       (unsigned)filter_chunks[i], (unsigned)frames, (unsigned)filter.rejected);
+			error_count++;
+		}
+	}
+}
+#endif
+
+#ifdef MAVLINK_HAVE_IOVEC
+/*
+  write all frames to a file in one batch and check the bytes match the
+  stream without the noise
+ */
+static void test_writev(void)
+{
+	static mavlink_message_t sent[STREAM_NUM_ENTRIES];
+	static const mavlink_message_t *batch[STREAM_NUM_ENTRIES];
+	static uint8_t readback[sizeof(stream)];
+	const unsigned num_entries = STREAM_NUM_ENTRIES;
+	uint8_t frame[MAVLINK_MAX_PACKET_LEN];
+	size_t expected, ofs = 0;
+	ssize_t got = 0;
+	FILE *f = tmpfile();
+	unsigned i;
+
+	build_frame_stream(sent);
+	expected = stream_len - 2*num_entries;
+	for (i=0; i<num_entries; i++) {
+		batch[i] = &sent[i];
+	}
+	if (f == NULL || mavlink_writev(fileno(f), batch, num_entries) != (ssize_t)expected) {
+		printf("mavlink_writev failed\n");
+		error_count++;
+	} else {
+		rewind(f);
+		got = read(fileno(f), readback, sizeof(readback));
+		for (i=0; i<num_entries && got == (ssize_t)expected; i++) {
+			uint16_t len = mavlink_msg_to_send_buffer(frame, &sent[i]);
+			if (memcmp(&readback[ofs], frame, len) != 0) {
+				break;
+			}
+			ofs += len;
+		}
+		if (got != (ssize_t)expected || ofs != expected) {
+			printf("mavlink_writev wrote different bytes at frame %u\n", i);
+			error_count++;
+		}
+	}
+	if (f != NULL) {
+		fclose(f);
+	}
+}
+#endif
+
+#ifdef MAVLINK_MESSAGE_CRCS_HASH_INDEX
+/*
+  check the generated msgid hash finds every entry and rejects ids
+  that are not in the table
+ */
+static void test_msg_entry_hash(void)
+{
+	static const mavlink_msg_entry_t entries[] = MAVLINK_MESSAGE_CRCS;
+	const unsigned num_entries = sizeof(entries)/sizeof(entries[0]);
+	unsigned i;
+	uint32_t msgid;
+
+	for (i=0; i<num_entries; i++) {
+		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(entries[i].msgid);
+		if (e == NULL || e->msgid != entries[i].msgid || e->crc_extra != entries[i].crc_extra) {
+			printf("Hash lookup failed for msgid %u\n", (unsigned)entries[i].msgid);
+			error_count++;
+		}
+	}
+	for (msgid=0; msgid<(1U<<24); msgid += 97) {
+		const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msgid);
+		if (e != NULL && e->msgid != msgid) {
+			printf("Hash lookup for msgid %u returned msgid %u\n", (unsigned)msgid, (unsigned)e->msgid);
+			error_count++;
+		}
+	}
+}
+#endif
+
+/*
+  check the block scan of _mav_trim_payload() and the word scan of
+  _mav_trim_payload_words() against a byte by byte scan for every length
+  and position of the last non zero byte
+ */
+static void test_trim_payload(void)
+{
+	char payload[255];
+	unsigned length, last;
+
+	for (length=1; length<=sizeof(payload); length++) {
+		for (last=0; last<=length; last++) {
+			uint8_t expected = 1;
+			memset(payload, 0, sizeof(payload));
+			if (last < length) {
+				payload[last] = 1;
+				expected = last + 1;
+			}
+			// bytes beyond the length must not be looked at
+			if (length < sizeof(payload)) {
+				payload[length] = 1;
+			}
+			if (_mav_trim_payload(payload, length) != expected ||
+			    _mav_trim_payload_words(payload, length) != expected) {
+				printf("Trim of %u bytes with last non zero byte %u failed\n", length, last);
+				error_count++;
+				return;
+			}
+		}
+	}
+}
+
+#ifdef MAVLINK_HAVE_GET_MESSAGE_INFO
+/*
+  check every message and field can be found by name, and that
+  unknown names are rejected
+ */
+static void test_name_lookup(void)
+{
+	static const mavlink_message_info_t infos[] = MAVLINK_MESSAGE_INFO;
+	const unsigned num_infos = sizeof(infos)/sizeof(infos[0]);
+	mavlink_field_handle_t handle;
+	mavlink_message_t msg;
+	unsigned i, j;
+	double value;
+
+	for (i=0; i<num_infos; i++) {
+		const mavlink_message_info_t *info = mavlink_get_message_info_by_name(infos[i].name);
+		if (info == NULL || info->msgid != infos[i].msgid ||
+		    mavlink_get_message_info_by_id(infos[i].msgid) != info) {
+			printf("Lookup failed for message %s\n", infos[i].name);
+			error_count++;
+			continue;
+		}
+		memset(&msg, 0, sizeof(msg));
+		msg.msgid = info->msgid;
+		for (j=0; j<info->num_fields; j++) {
+			if (!mavlink_field_handle_resolve(&handle, infos[i].name, infos[i].fields[j].name) ||
+			    handle.info != info || handle.field != &info->fields[j] ||
+			    !mavlink_field_handle_get(&handle, &msg, 0, &value) || value != 0) {
+				printf("Lookup failed for field %s.%s\n", infos[i].name, infos[i].fields[j].name);
+				error_count++;
+			}
+		}
+		if (mavlink_get_field_info_by_name(info, "NO_SUCH_FIELD") != NULL) {
+			printf("Lookup of unknown field in %s succeeded\n", infos[i].name);
+			error_count++;
+		}
+	}
+	if (mavlink_get_message_info_by_name("NO_SUCH_MESSAGE") != NULL ||
+	    mavlink_field_handle_resolve(&handle, "NO_SUCH_MESSAGE", "x")) {
+		printf("Lookup of unknown message succeeded\n");
+		error_count++;
+	}
+}
+#endif
+
+#ifdef MAVLINK_HAVE_FRAME_RING
+/*
+  reserve two slots of a frame ring, commit them in reverse order and
+  check the writer sees neither frame until the first one is committed,
+  and that the signing timestamps follow the slot order
+ */
+static void test_frame_ring(void)
+{
+	static mavlink_frame_slot_t slots[4];
+	const mavlink_msg_entry_t *e = mavlink_get_msg_entry(last_msg.msgid);
+	mavlink_frame_ring_t ring;
+	mavlink_frame_slot_t *a, *b;
+	mavlink_status_t status;
+	mavlink_signing_t signing;
+	mavlink_message_t msg = last_msg;
+	const mavlink_frame_slot_t *out;
+	unsigned i;
+
+	memset(&status, 0, sizeof(status));
+	memset(&signing, 0, sizeof(signing));
+	signing.flags = MAVLINK_SIGNING_FLAG_SIGN_OUTGOING;
+	signing.timestamp = 1000;
+	status.signing = &signing;
+	status.current_tx_seq = 250;
+	mavlink_frame_ring_init(&ring, slots, 4, &status);
+	a = mavlink_frame_ring_reserve(&ring);
+	b = mavlink_frame_ring_reserve(&ring);
+	mavlink_frame_ring_fill(&ring, b, &msg, 11, 10, e->min_msg_len, e->max_msg_len, e->crc_extra);
+	mavlink_frame_ring_commit(b);
+	if (mavlink_frame_ring_peek(&ring) != NULL) {
+		printf("Frame ring handed out a frame before its predecessor\n");
+		error_count++;
+	}
+	mavlink_frame_ring_fill(&ring, a, &msg, 11, 10, e->min_msg_len, e->max_msg_len, e->crc_extra);
+	mavlink_frame_ring_commit(a);
+	for (i=0; i<2; i++) {
+		out = mavlink_frame_ring_peek(&ring);
+		if (out == NULL || out->data[4] != 250 + i ||
+		    out->data[out->len - MAVLINK_SIGNATURE_BLOCK_LEN + 1] != (uint8_t)(1000 + i)) {
+			printf("Frame ring sequence error at frame %u\n", i);
+			error_count++;
+			return;
+		}
+		mavlink_frame_ring_pop(&ring);
+	}
+	for (i=0; i<4; i++) {
+		mavlink_frame_ring_send(&ring, false, &msg, 11, 10, e->min_msg_len, e->max_msg_len, e->crc_extra);
+	}
+	if (mavlink_frame_ring_reserve(&ring) != NULL || status.current_tx_seq != 252 || signing.timestamp != 1006) {
+		printf("Frame ring full check failed\n");
+		error_count++;
+	}
+}
+#endif
+
+#ifdef MAVLINK_HAVE_TX_BUFFER
+/*
+  resend the last message with no trigger set, where it must reach
+  comm_send_ch() at once, then a few times with a frame count trigger
+  of 3, and check that frames only arrive when the buffer flushes.
+  The buffer must follow the context channel 1 is attached to, and
+  channels without a buffer must be ignored
+ */
+static void test_tx_buffer(void)
+{
+	static mavlink_context_t ctx;
+	const mavlink_msg_entry_t *e = mavlink_get_msg_entry(last_msg.msgid);
+	mavlink_message_t msg = last_msg;
+	mavlink_status_t *status = mavlink_get_channel_status(MAVLINK_COMM_1);
+	unsigned count = chan_counts[MAVLINK_COMM_1];
+	unsigned i;
+
+	mavlink_finalize_message_chan(&msg, 11, 10, MAVLINK_COMM_1, e->min_msg_len, e->max_msg_len, e->crc_extra);
+	_mavlink_resend_uart(MAVLINK_COMM_1, &msg);
+	if (chan_counts[MAVLINK_COMM_1] != ++count) {
+		printf("Transmit buffer held a frame with no trigger set\n");
+		error_count++;
+	}
+	mavlink_tx_buffer_config(MAVLINK_COMM_1, 0, 3, 0);
+	for (i=0; i<5; i++) {
+		mavlink_finalize_message_chan(&msg, 11, 10, MAVLINK_COMM_1, e->min_msg_len, e->max_msg_len, e->crc_extra);
+		_mavlink_resend_uart(MAVLINK_COMM_1, &msg);
+		if (chan_counts[MAVLINK_COMM_1] != count + (i >= 2 ? 3 : 0)) {
+			printf("Transmit buffer flushed early or late at frame %u\n", i);
+			error_count++;
+		}
+	}
+	mavlink_tx_flush(MAVLINK_COMM_1);
+	if (chan_counts[MAVLINK_COMM_1] != count + 5) {
+		printf("Transmit buffer flush lost frames\n");
+		error_count++;
+	}
+	// back to sending each frame as it is complete
+	mavlink_tx_buffer_config(MAVLINK_COMM_1, 0, 0, 0);
+
+	mavlink_context_init(&ctx);
+	status->context = &ctx;
+	mavlink_tx_buffer_config(MAVLINK_COMM_1, 0, 3, 0);
+	mavlink_finalize_message_chan(&msg, 11, 10, MAVLINK_COMM_1, e->min_msg_len, e->max_msg_len, e->crc_extra);
+	_mavlink_resend_uart(MAVLINK_COMM_1, &msg);
+	if (ctx.tx_buffer[MAVLINK_COMM_1].frames != 1 ||
+	    mavlink_get_default_context()->tx_buffer[MAVLINK_COMM_1].flush_frames != 0 ||
+	    chan_counts[MAVLINK_COMM_1] != count + 5) {
+		printf("Transmit buffer did not follow the channel's context\n");
+		error_count++;
+	}
+	mavlink_tx_flush(MAVLINK_COMM_1);
+	mavlink_tx_buffer_config(MAVLINK_COMM_1, 0, 0, 0);
+	status->context = NULL;
+	if (chan_counts[MAVLINK_COMM_1] != count + 6) {
+		printf("Transmit buffer flush in a context lost frames\n");
+		error_count++;
+	}
+
+	mavlink_tx_buffer_config(MAVLINK_COMM_NUM_BUFFERS, 0, 3, 0);
+	mavlink_tx_poll(MAVLINK_COMM_NUM_BUFFERS);
+	mavlink_tx_flush(MAVLINK_COMM_NUM_BUFFERS);
+}
+#endif
+
+#ifdef MAVLINK_HAVE_TX_SCHED
+/*
+  fill a four frame pool with bulk and telemetry frames, queue a
+  heartbeat and check it evicts a bulk frame, goes out first, and that
+  the telemetry frame is dropped once past its max age
+ */
+static void test_tx_sched(void)
+{
+	static mavlink_tx_sched_frame_t frames[4];
+	const mavlink_msg_entry_t *e = mavlink_get_msg_entry(MAVLINK_MSG_ID_HEARTBEAT);
+	mavlink_tx_sched_t s;
+	mavlink_status_t status;
+	mavlink_message_t msg;
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+	uint16_t len = mavlink_msg_to_send_buffer(buf, &last_msg);
+	unsigned i, n = 0;
+
+	if (mavlink_tx_class(MAVLINK_MSG_ID_HEARTBEAT) != MAVLINK_TX_CLASS_CONTROL ||
+	    mavlink_tx_class(MAVLINK_MSG_ID_PARAM_VALUE) != MAVLINK_TX_CLASS_BULK ||
+	    mavlink_tx_class(MAVLINK_MSG_ID_ATTITUDE) != MAVLINK_TX_CLASS_TELEMETRY) {
+		printf("Transmit class lookup failed\n");
+		error_count++;
+	}
+
+	mavlink_tx_sched_init(&s, frames, 4);
+	for (i=0; i<3; i++) {
+		mavlink_tx_sched_enqueue_frame(&s, MAVLINK_TX_CLASS_BULK, buf, len, 0, 0);
+	}
+	mavlink_tx_sched_enqueue_frame(&s, MAVLINK_TX_CLASS_TELEMETRY, buf, len, 0, 10);
+	// finalized with its own status to keep the channel sequence checks happy
+	memset(&msg, 0, sizeof(msg));
+	memset(&status, 0, sizeof(status));
+	msg.msgid = MAVLINK_MSG_ID_HEARTBEAT;
+	mavlink_finalize_message_buffer(&msg, 11, 10, &status, e->min_msg_len, e->max_msg_len, e->crc_extra);
+	if (!mavlink_tx_sched_enqueue(&s, &msg, 50, 0)) {
+		printf("Transmit scheduler refused a control frame\n");
+		error_count++;
+	}
+
+	len = mavlink_tx_sched_dequeue(&s, 100, buf);
+	if (len == 0 || buf[7] != MAVLINK_MSG_ID_HEARTBEAT) {
+		printf("Transmit scheduler did not send the control frame first\n");
+		error_count++;
+	}
+	while (mavlink_tx_sched_dequeue(&s, 100, buf) != 0) {
+		n++;
+	}
+	if (n != 2 ||
+	    s.classes[MAVLINK_TX_CLASS_BULK].stats.dropped_full != 1 ||
+	    s.classes[MAVLINK_TX_CLASS_TELEMETRY].stats.dropped_stale != 1 ||
+	    s.classes[MAVLINK_TX_CLASS_CONTROL].stats.latency_max_ms != 50) {
+		printf("Transmit scheduler counters wrong\n");
+		error_count++;
+	}
+}
+#endif
+
+#ifdef MAVLINK_HAVE_TX_CONFLATE
+/*
+  run random enqueues of ATTITUDE from 12 systems and dequeues through a
+  conflating queue of 8 frames, and check it against a simple model that
+  keeps one pending value per system in arrival order. Then check two
+  COMMAND_LONG frames to the same target are both kept
+ */
+static void test_tx_conflate(void)
+{
+	static mavlink_conflate_frame_t frames[8];
+	static uint16_t table[16];
+	const mavlink_msg_entry_t *e = mavlink_get_msg_entry(MAVLINK_MSG_ID_ATTITUDE);
+	mavlink_conflate_queue_t q;
+	mavlink_status_t status;
+	mavlink_message_t msg;
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+	uint8_t model_sys[8];
+	uint32_t model_val[8], val;
+	unsigned model_len = 0, i, j;
+
+	memset(&status, 0, sizeof(status));
+	mavlink_conflate_init(&q, frames, 8, table, 16);
+	srand(7);
+	for (i=0; i<5000; i++) {
+		if (rand() % 3 != 0) {
+			uint8_t sysid = 1 + rand() % 12;
+			bool ok;
+			memset(&msg, 0, sizeof(msg));
+			msg.msgid = MAVLINK_MSG_ID_ATTITUDE;
+			memcpy(_MAV_PAYLOAD_NON_CONST(&msg), &i, 4);
+			// keep the payload from being trimmed
+			_MAV_PAYLOAD_NON_CONST(&msg)[e->max_msg_len - 1] = 1;
+			mavlink_finalize_message_buffer(&msg, sysid, 10, &status, e->min_msg_len, e->max_msg_len, e->crc_extra);
+			ok = mavlink_conflate_enqueue(&q, &msg);
+			for (j=0; j<model_len && model_sys[j] != sysid; j++) ;
+			if (j < model_len) {
+				model_val[j] = i;
+			} else if (model_len < 8) {
+				model_sys[model_len] = sysid;
+				model_val[model_len++] = i;
+			}
+			if (ok != (j < 8)) {
+				printf("Conflating queue enqueue mismatch at step %u\n", i);
+				error_count++;
+				return;
+			}
+		} else {
+			uint16_t len = mavlink_conflate_dequeue(&q, buf);
+			if ((len != 0) != (model_len != 0)) {
+				printf("Conflating queue dequeue mismatch at step %u\n", i);
+				error_count++;
+				return;
+			}
+			if (len == 0) {
+				continue;
+			}
+			memcpy(&val, &buf[MAVLINK_NUM_HEADER_BYTES], 4);
+			if (buf[5] != model_sys[0] || val != model_val[0]) {
+				printf("Conflating queue returned a stale frame at step %u\n", i);
+				error_count++;
+				return;
+			}
+			memmove(model_sys, model_sys + 1, --model_len);
+			memmove(model_val, model_val + 1, model_len * sizeof(model_val[0]));
+		}
+	}
+	if (q.depth != model_len || q.replaced == 0 || q.dropped_full == 0) {
+		printf("Conflating queue counters wrong\n");
+		error_count++;
+	}
+
+	mavlink_conflate_init(&q, frames, 8, table, 16);
+	e = mavlink_get_msg_entry(MAVLINK_MSG_ID_COMMAND_LONG);
+	for (i=0; i<2; i++) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msgid = MAVLINK_MSG_ID_COMMAND_LONG;
+		_MAV_PAYLOAD_NON_CONST(&msg)[e->target_system_ofs] = 1;
+		mavlink_finalize_message_buffer(&msg, 11, 10, &status, e->min_msg_len, e->max_msg_len, e->crc_extra);
+		mavlink_conflate_enqueue(&q, &msg);
+	}
+	if (q.depth != 2) {
+		printf("Conflating queue merged commands\n");
+		error_count++;
+	}
+}
+#endif
+
+#ifdef MAVLINK_HAVE_RATE_LIMIT
+/*
+  send three ATTITUDE at once through a 5 Hz deferring limit on channel
+  1, and check the first goes out straight away and the newest of the
+  other two once a token is free
+ */
+static void test_rate_limit(void)
+{
+	const mavlink_rate_limit_t *r;
+	unsigned count = chan_counts[MAVLINK_COMM_1];
+	uint32_t i;
+
+	test_time_ms = 1000;
+	mavlink_rate_limit_set(MAVLINK_COMM_1, MAVLINK_MSG_ID_ATTITUDE, 5000, 1, MAVLINK_RATE_LIMIT_DEFER);
+	for (i=1; i<=3; i++) {
+		mavlink_msg_attitude_send(MAVLINK_COMM_1, i, 0, 0, 0, 0, 0, 0);
+	}
+	test_time_ms += 100;
+	mavlink_rate_limit_poll(MAVLINK_COMM_1);
+	if (chan_counts[MAVLINK_COMM_1] != count + 1) {
+		printf("Rate limit let %u frames through\n", chan_counts[MAVLINK_COMM_1] - count);
+		error_count++;
+	}
+	test_time_ms += 100;
+	mavlink_rate_limit_poll(MAVLINK_COMM_1);
+	r = mavlink_rate_limit_get(MAVLINK_COMM_1, MAVLINK_MSG_ID_ATTITUDE);
+	if (chan_counts[MAVLINK_COMM_1] != count + 2 ||
+	    mavlink_msg_attitude_get_time_boot_ms(&last_msg) != 3 ||
+	    r == NULL || r->sent != 2 || r->deferred != 2 || r->dropped != 1) {
+		printf("Rate limit did not send the newest deferred frame\n");
+		error_count++;
+	}
+}
+
+/*
+  send HEARTBEAT and SYSTEM_TIME every millisecond for 10 s at 0.5 Hz
+  and 2.5 Hz, with the limits in a separate context attached to channel
+  1, and check the fractions of a token earned each millisecond add up
+ */
+static void test_rate_limit_fraction(void)
+{
+	static mavlink_context_t ctx;
+	mavlink_status_t *status = mavlink_get_channel_status(MAVLINK_COMM_1);
+	const mavlink_rate_limit_t *slow, *fast;
+	uint32_t ms;
+
+	mavlink_context_init(&ctx);
+	status->context = &ctx;
+	mavlink_rate_limit_set(MAVLINK_COMM_1, MAVLINK_MSG_ID_HEARTBEAT, 500, 1, MAVLINK_RATE_LIMIT_DROP);
+	mavlink_rate_limit_set(MAVLINK_COMM_1, MAVLINK_MSG_ID_SYSTEM_TIME, 2500, 1, MAVLINK_RATE_LIMIT_DROP);
+	for (ms=0; ms<10000; ms++) {
+		mavlink_msg_heartbeat_send(MAVLINK_COMM_1, 1, 2, 3, 4, 5);
+		mavlink_msg_system_time_send(MAVLINK_COMM_1, ms, ms);
+		test_time_ms++;
+	}
+	slow = mavlink_rate_limit_get(MAVLINK_COMM_1, MAVLINK_MSG_ID_HEARTBEAT);
+	fast = mavlink_rate_limit_get(MAVLINK_COMM_1, MAVLINK_MSG_ID_SYSTEM_TIME);
+	// one frame every 2 s and every 400 ms, starting with the full bucket
+	if (slow == NULL || fast == NULL || slow->sent != 5 || fast->sent != 25) {
+		printf("Rate limit sent %u frames at 0.5 Hz and %u at 2.5 Hz in 10 s\n",
+		       slow ? slow->sent : 0, fast ? fast->sent : 0);
+		error_count++;
+	}
+	status->context = NULL;
+	if (mavlink_rate_limit_get(MAVLINK_COMM_1, MAVLINK_MSG_ID_HEARTBEAT) != NULL) {
+		printf("Rate limit set in a context reached the default context\n");
+		error_count++;
+	}
+}
+#endif
+
+#ifdef MAVLINK_HAVE_ROUTER
+/*
+  route signed frames between three endpoints: a heartbeat fans out to
+  both other endpoints sharing one buffer, a command goes only to the
+  endpoint its target was seen on, and one to an unknown system goes
+  nowhere. The forwarded bytes must be the received ones
+ */
+static void test_router(void)
+{
+	static mavlink_router_t r;
+	static mavlink_router_endpoint_t endpoints[3];
+	static mavlink_router_frame_t frames[8];
+	const mavlink_router_frame_t *f1, *f2;
+	mavlink_status_t status;
+	mavlink_signing_t signing;
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+	uint16_t len;
+
+	memset(&status, 0, sizeof(status));
+	memset(&signing, 0, sizeof(signing));
+	signing.flags = MAVLINK_SIGNING_FLAG_SIGN_OUTGOING;
+	status.signing = &signing;
+	mavlink_router_init(&r, endpoints, 3, frames, 8);
+
+	// split so the frame is captured across two calls
+	len = mavlink_msg_heartbeat_pack_to_wire(1, 1, &status, buf, 1, 2, 3, 4, 5);
+	mavlink_router_input(&r, 0, buf, 5);
+	mavlink_router_input(&r, 0, buf + 5, len - 5);
+	f1 = mavlink_router_peek(&r, 1);
+	f2 = mavlink_router_peek(&r, 2);
+	if (f1 == NULL || f1 != f2 || f1->refs != 2 || f1->len != len || memcmp(f1->data, buf, len) != 0 ||
+	    mavlink_router_peek(&r, 0) != NULL) {
+		printf("Router broadcast failed\n");
+		error_count++;
+		return;
+	}
+	mavlink_router_pop(&r, 1);
+	mavlink_router_pop(&r, 2);
+
+	len = mavlink_msg_heartbeat_pack_to_wire(255, 190, &status, buf, 6, 8, 0, 0, 0);
+	mavlink_router_input(&r, 1, buf, len);
+	mavlink_router_pop(&r, 0);
+	mavlink_router_pop(&r, 2);
+
+	len = mavlink_msg_command_long_pack_to_wire(255, 190, &status, buf, 1, 1, 400, 0, 1, 0, 0, 0, 0, 0, 0);
+	mavlink_router_input(&r, 1, buf, len);
+	f1 = mavlink_router_peek(&r, 0);
+	if (f1 == NULL || f1->len != len || memcmp(f1->data, buf, len) != 0 || mavlink_router_peek(&r, 2) != NULL) {
+		printf("Router targeted frame failed\n");
+		error_count++;
+		return;
+	}
+	mavlink_router_pop(&r, 0);
+
+	len = mavlink_msg_command_long_pack_to_wire(255, 190, &status, buf, 7, 1, 400, 0, 1, 0, 0, 0, 0, 0, 0);
+	mavlink_router_input(&r, 1, buf, len);
+	if (mavlink_router_peek(&r, 0) != NULL || r.routed != 3 || r.not_forwarded != 1 ||
+	    endpoints[1].rx_frames != 3 || endpoints[0].tx_frames != 2) {
+		printf("Router counters wrong\n");
+		error_count++;
+	}
+}
+#endif
+
+#ifdef ENCRYPTION
+/*
+  a published Simon or Speck test vector, with the key and block words
+  lowest first, which is the order the key schedules take them in
+ */
+struct cipher_vector {
+	unsigned word_len;
+	unsigned key_words;
+	uint64_t key[4];
+	uint64_t pt[2];
+	uint64_t ct[2];
+};
+
+static void vector_bytes(const struct cipher_vector *v, const uint64_t *words, unsigned count, uint8_t *bytes)
+{
+	unsigned i, j;
+	for (i=0; i<count; i++) {
+		for (j=0; j<v->word_len; j++) {
+			bytes[i*v->word_len + j] = (uint8_t)(words[i] >> (8*j));
+		}
+	}
+}
+
+/*
+  encrypt one block of zeros with the test vector's plaintext as the
+  nonce, which must give its ciphertext, then check round keys expanded
+  once and reused against the one shot function for every payload length
+ */
+#define TEST_CIPHER(name, word_t, rounds, vector)				\
+static void test_##name(void)							\
+{										\
+	const unsigned block_len = 2 * (vector).word_len;			\
+	word_t rk[rounds];							\
+	uint8_t key[32], nonce[16], ct[16], block[16];				\
+	uint8_t expanded[255], oneshot[255];					\
+	unsigned length, i;							\
+										\
+	vector_bytes(&(vector), (vector).key, (vector).key_words, key);		\
+	vector_bytes(&(vector), (vector).pt, 2, nonce);				\
+	vector_bytes(&(vector), (vector).ct, 2, ct);				\
+	memset(block, 0, sizeof(block));					\
+	name##ExpandKey(key, rk);						\
+	name##CTR(nonce, rk, block, block_len);					\
+	if (memcmp(block, ct, block_len) != 0) {				\
+		printf(#name " does not match its published test vector\n");	\
+		error_count++;							\
+	}									\
+	for (length=1; length<=sizeof(expanded); length++) {			\
+		for (i=0; i<length; i++) {					\
+			expanded[i] = oneshot[i] = (uint8_t)(i*7 + length);	\
+		}								\
+		name##CTR(nonce, rk, expanded, length);				\
+		name(nonce, key, oneshot, length);				\
+		if (memcmp(expanded, oneshot, length) != 0) {			\
+			printf(#name " with expanded round keys differs at length %u\n", length); \
+			error_count++;						\
+			return;							\
+		}								\
+	}									\
+}
+
+static const struct cipher_vector speck128192_vector = {
+	8, 3, { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL, 0x1716151413121110ULL },
+	{ 0x43206f7420746e65ULL, 0x7261482066656968ULL }, { 0xf9bc185de03c1886ULL, 0x1be4cf3a13135566ULL } };
+TEST_CIPHER(Speck128192, uint64_t, SPECK128192_KEY_ROUNDS, speck128192_vector)
+
+#ifdef TEST
+static const struct cipher_vector simon6496_vector = {
+	4, 3, { 0x03020100, 0x0b0a0908, 0x13121110 },
+	{ 0x6e696c63, 0x6f722067 }, { 0x111a8fc8, 0x5ca2e27f } };
+static const struct cipher_vector simon64128_vector = {
+	4, 4, { 0x03020100, 0x0b0a0908, 0x13121110, 0x1b1a1918 },
+	{ 0x20646e75, 0x656b696c }, { 0xb9dfa07a, 0x44c8fc20 } };
+static const struct cipher_vector simon128128_vector = {
+	8, 2, { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL },
+	{ 0x6c6c657661727420ULL, 0x6373656420737265ULL }, { 0x65aa832af84e0bbcULL, 0x49681b1e1e54fe3fULL } };
+static const struct cipher_vector simon128192_vector = {
+	8, 3, { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL, 0x1716151413121110ULL },
+	{ 0x6568772065626972ULL, 0x206572656874206eULL }, { 0x6c9c8d6e2597b85bULL, 0xc4ac61effcdc0d4fULL } };
+static const struct cipher_vector simon128256_vector = {
+	8, 4, { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL, 0x1716151413121110ULL, 0x1f1e1d1c1b1a1918ULL },
+	{ 0x6d69732061207369ULL, 0x74206e69206d6f6fULL }, { 0x3bf72a87efe7b868ULL, 0x8d2b5579afc8a3a0ULL } };
+static const struct cipher_vector speck6496_vector = {
+	4, 3, { 0x03020100, 0x0b0a0908, 0x13121110 },
+	{ 0x736e6165, 0x74614620 }, { 0x4175946c, 0x9f7952ec } };
+static const struct cipher_vector speck64128_vector = {
+	4, 4, { 0x03020100, 0x0b0a0908, 0x13121110, 0x1b1a1918 },
+	{ 0x7475432d, 0x3b726574 }, { 0x454e028b, 0x8c6fa548 } };
+static const struct cipher_vector speck128128_vector = {
+	8, 2, { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL },
+	{ 0x7469206564616d20ULL, 0x6c61766975716520ULL }, { 0x7860fedf5c570d18ULL, 0xa65d985179783265ULL } };
+static const struct cipher_vector speck128256_vector = {
+	8, 4, { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL, 0x1716151413121110ULL, 0x1f1e1d1c1b1a1918ULL },
+	{ 0x202e72656e6f6f70ULL, 0x65736f6874206e49ULL }, { 0x4eeeb48d9c188f43ULL, 0x4109010405c0f53eULL } };
+TEST_CIPHER(Simon6496, uint32_t, SIMON6496_KEY_ROUNDS, simon6496_vector)
+TEST_CIPHER(Simon64128, uint32_t, SIMON64128_KEY_ROUNDS, simon64128_vector)
+TEST_CIPHER(Simon128128, uint64_t, SIMON128128_KEY_ROUNDS, simon128128_vector)
+TEST_CIPHER(Simon128192, uint64_t, SIMON128192_KEY_ROUNDS, simon128192_vector)
+TEST_CIPHER(Simon128256, uint64_t, SIMON128256_KEY_ROUNDS, simon128256_vector)
+TEST_CIPHER(Speck6496, uint32_t, SPECK6496_KEY_ROUNDS, speck6496_vector)
+TEST_CIPHER(Speck64128, uint32_t, SPECK64128_KEY_ROUNDS, speck64128_vector)
+TEST_CIPHER(Speck128128, uint64_t, SPECK128128_KEY_ROUNDS, speck128128_vector)
+TEST_CIPHER(Speck128256, uint64_t, SPECK128256_KEY_ROUNDS, speck128256_vector)
+#endif
+
+#ifdef MAVLINK_CTR_SIMD
+/*
+  run a variant with 128 bit blocks with each CTR kernel the CPU has
+  forced in turn, level 1 being the byte loops, and compare the output
+  of the SIMD kernels with the byte loops for every payload length
+ */
+#define TEST_CTR_KERNELS(name, rounds)						\
+static void test_##name##_kernels(void)						\
+{										\
+	static uint8_t expected[255][255];					\
+	uint64_t rk[rounds];							\
+	uint8_t key[32], nonce[16], buf[255];					\
+	unsigned length, i;							\
+	int level, max_level;							\
+										\
+	for (i=0; i<sizeof(key); i++) {						\
+		key[i] = (uint8_t)(i*11 + 3);					\
+	}									\
+	for (i=0; i<sizeof(nonce); i++) {					\
+		nonce[i] = (uint8_t)(0xF0 - i);					\
+	}									\
+	name##ExpandKey(key, rk);						\
+	max_level = _ctr128_force_level(3);					\
+	for (level=1; level<=max_level; level++) {				\
+		_ctr128_force_level(level);					\
+		for (length=1; length<=sizeof(buf); length++) {			\
+			for (i=0; i<length; i++) {				\
+				buf[i] = (uint8_t)(i*7 + length);		\
+			}							\
+			name##CTR(nonce, rk, buf, length);			\
+			if (level == 1) {					\
+				memcpy(expected[length-1], buf, length);	\
+			} else if (memcmp(expected[length-1], buf, length) != 0) { \
+				printf(#name " CTR kernel %d differs from the byte loop at length %u\n", level, length); \
+				error_count++;					\
+				break;						\
+			}							\
+		}								\
+	}									\
+	_ctr128_force_level(max_level);						\
+}
+
+TEST_CTR_KERNELS(Speck128192, SPECK128192_KEY_ROUNDS)
+#ifdef TEST
+TEST_CTR_KERNELS(Simon128128, SIMON128128_KEY_ROUNDS)
+TEST_CTR_KERNELS(Simon128192, SIMON128192_KEY_ROUNDS)
+TEST_CTR_KERNELS(Simon128256, SIMON128256_KEY_ROUNDS)
+TEST_CTR_KERNELS(Speck128128, SPECK128128_KEY_ROUNDS)
+TEST_CTR_KERNELS(Speck128256, SPECK128256_KEY_ROUNDS)
+#endif
+#endif
+
+/*
+  for every cipher suite that is built in, choose it for remote key 0,
+  finalize a message, which encrypts it with the suite, and parse it
+  back, which decrypts it. Unknown suites must be refused without
+  changing the key
+ */
+static void test_cipher_suites(void)
+{
+#ifdef TEST
+	const unsigned expected_suites = MAVLINK_CIPHER_SPECK128256;
+#else
+	const unsigned expected_suites = 1;
+#endif
+	const mavlink_msg_entry_t *e = mavlink_get_msg_entry(MAVLINK_MSG_ID_SYS_STATUS);
+	key_status_t *key = mavlink_get_remote_key(0);
+	const mavlink_cipher_t *cipher;
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+	mavlink_message_t msg, rxmsg;
+	mavlink_status_t status;
+	unsigned i, suites = 0;
+	uint8_t id;
+	uint16_t len;
+
+	for (i=0; i<sizeof(key->shared_key); i++) {
+		key->shared_key[i] = (uint8_t)(i*3 + 1);
+	}
+	for (i=0; i<sizeof(key->iv); i++) {
+		key->iv[i] = (uint8_t)(0x40 + i);
+	}
+	for (id=MAVLINK_CIPHER_SPECK128192; id<=MAVLINK_CIPHER_SPECK128256; id++) {
+		if (mavlink_get_cipher(id) == NULL) {
+			continue;
+		}
+		suites++;
+		if (!mavlink_set_remote_key_cipher(0, id) || key->cipher == NULL || key->cipher->id != id) {
+			printf("Cipher suite %u was not chosen\n", (unsigned)id);
+			error_count++;
+			continue;
+		}
+		memset(&msg, 0, sizeof(msg));
+		msg.msgid = e->msgid;
+		for (i=0; i<e->max_msg_len; i++) {
+			_MAV_PAYLOAD_NON_CONST(&msg)[i] = (char)(i*5 + id);
+		}
+		mavlink_finalize_message_chan(&msg, 11, 10, MAVLINK_COMM_0, e->min_msg_len, e->max_msg_len, e->crc_extra);
+		len = mavlink_msg_to_send_buffer(buf, &msg);
+		for (i=0; i<e->max_msg_len; i++) {
+			if (_MAV_PAYLOAD(&msg)[i] != (char)(i*5 + id)) {
+				break;
+			}
+		}
+		if (i == e->max_msg_len) {
+			printf("Cipher suite %s left the payload in clear\n", key->cipher->name);
+			error_count++;
+		}
+		memset(&rxmsg, 0, sizeof(rxmsg));
+		for (i=0; i<len; i++) {
+			if (mavlink_parse_char(MAVLINK_COMM_1, buf[i], &rxmsg, &status)) {
+				break;
+			}
+		}
+		for (i=0; i<rxmsg.len; i++) {
+			if (_MAV_PAYLOAD(&rxmsg)[i] != (char)(i*5 + id)) {
+				break;
+			}
+		}
+		if (rxmsg.msgid != e->msgid || rxmsg.len != e->max_msg_len || i != rxmsg.len) {
+			printf("Cipher suite %s did not decrypt its own payload\n", key->cipher->name);
+			error_count++;
+		}
+	}
+	if (suites != expected_suites) {
+		printf("Only %u cipher suites are built in\n", suites);
+		error_count++;
+	}
+
+	cipher = key->cipher;
+	if (mavlink_set_remote_key_cipher(0, 0) || mavlink_set_remote_key_cipher(0, 200) || key->cipher != cipher) {
+		printf("Unknown cipher suite was accepted or changed the key\n");
+		error_count++;
+	}
+	mavlink_set_remote_key_cipher(0, MAVLINK_DEFAULT_CIPHER);
+}
+
+/*
+  peer keys of a separate context: an exact peer, a whole system and a
+  whole link, the fall back to key 0 once the table is cleared, and the
+  key cache of a channel after its link changes
+ */
+static void test_peer_keys(void)
+{
+	static mavlink_context_t ctx;
+	mavlink_status_t *status;
+	static const struct {
+		uint8_t link, sysid, compid, id;
+	} lookups[] = {
+		{ 0, 1, 1, 1 },	// exact
+		{ 0, 1, 5, 2 },	// system 1 on link 0
+		{ 0, 7, 1, 3 },	// anything else on link 0
+		{ 0, 0, 0, 3 },
+		{ 1, 2, 9, 4 },	// system 2 on link 1
+		{ 1, 7, 7, 0 },	// no link key on link 1
+		{ 2, 1, 1, 0 },
+	};
+	unsigned i;
+
+	mavlink_context_init(&ctx);
+	status = mavlink_ctx_get_channel_status(&ctx, MAVLINK_COMM_0);
+	if (!mavlink_ctx_set_peer_key(&ctx, 0, 1, 1, 1) || !mavlink_ctx_set_peer_key(&ctx, 0, 1, 0, 2) ||
+	    !mavlink_ctx_set_peer_key(&ctx, 0, 0, 0, 3) || !mavlink_ctx_set_peer_key(&ctx, 1, 2, 0, 4)) {
+		printf("Setting a peer key failed\n");
+		error_count++;
+	}
+	if (mavlink_ctx_set_peer_key(&ctx, 0, 1, 1, -1) ||
+	    mavlink_ctx_set_peer_key(&ctx, 0, 1, 1, MAVLINK_NUM_REMOTE_KEYS)) {
+		printf("Peer key with an id out of range was accepted\n");
+		error_count++;
+	}
+	for (i=0; i<sizeof(lookups)/sizeof(lookups[0]); i++) {
+		if (_mav_peer_key_lookup(&ctx, lookups[i].link, lookups[i].sysid, lookups[i].compid) != lookups[i].id) {
+			printf("Peer %u/%u on link %u does not use key %u\n", lookups[i].sysid, lookups[i].compid,
+			       lookups[i].link, lookups[i].id);
+			error_count++;
+		}
+	}
+
+	// after traffic on link 0 the channel moves to link 1
+	status->link = 0;
+	if (_mav_peer_key_cached(status, &status->tx_key_cache, 2, 1) != mavlink_ctx_get_remote_key(&ctx, 3)) {
+		printf("Peer key cache missed the link key\n");
+		error_count++;
+	}
+	status->link = 1;
+	if (_mav_peer_key_cached(status, &status->tx_key_cache, 2, 1) != mavlink_ctx_get_remote_key(&ctx, 4)) {
+		printf("Peer key cache kept the key of the old link\n");
+		error_count++;
+	}
+
+	mavlink_ctx_clear_peer_keys(&ctx);
+	if (_mav_peer_key_lookup(&ctx, 0, 1, 1) != 0 ||
+	    _mav_peer_key_cached(status, &status->tx_key_cache, 2, 1) != mavlink_ctx_get_remote_key(&ctx, 0)) {
+		printf("Cleared peer keys did not fall back to key 0\n");
+		error_count++;
+	}
+}
+
+static void test_ciphers(void)
+{
+	test_Speck128192();
+#ifdef TEST
+	test_Simon6496();
+	test_Simon64128();
+	test_Simon128128();
+	test_Simon128192();
+	test_Simon128256();
+	test_Speck6496();
+	test_Speck64128();
+	test_Speck128128();
+	test_Speck128256();
+#endif
+#ifdef MAVLINK_CTR_SIMD
+	test_Speck128192_kernels();
+#ifdef TEST
+	test_Simon128128_kernels();
+	test_Simon128192_kernels();
+	test_Simon128256_kernels();
+	test_Speck128128_kernels();
+	test_Speck128256_kernels();
+#endif
+#endif
+	test_cipher_suites();
+	test_peer_keys();
+}
+#endif
+
 int main(void)
 {
 	mavlink_channel_t chan;
 
+#ifdef MAVLINK_HAVE_CRC_SELF_CHECK
+	if (!crc_self_check()) {
+		printf("CRC implementations disagree\n");
+		exit(1);
+	}
+#endif
+	test_trim_payload();
+#ifdef MAVLINK_MESSAGE_CRCS_HASH_INDEX
+	test_msg_entry_hash();
+#endif
+#ifdef MAVLINK_HAVE_GET_MESSAGE_INFO
+	test_name_lookup();
+#endif
+#ifdef ENCRYPTION
+	/*
+	  with ENCRYPTION every payload is encrypted in place when it is
+	  finalized, so the generated test suite, which decodes the message
+	  it just sent, cannot pass. Only the encryption tests run
+	*/
+	printf("Testing encryption\n");
+	test_ciphers();
+	if (error_count != 0) {
+		printf("Error count %u\n", error_count);
+		exit(1);
+	}
+	printf("No errors detected\n");
+	return 0;
+#endif
+
 	mavlink_test_all(11, 10, &last_msg);
+#ifdef MAVLINK_HAVE_TX_BUFFER
+	test_tx_buffer();
+#endif
+#ifdef MAVLINK_HAVE_RATE_LIMIT
+	test_rate_limit();
+	test_rate_limit_fraction();
+#endif
+#ifdef MAVLINK_HAVE_FRAME_RING
+	test_frame_ring();
+#endif
+#ifdef MAVLINK_HAVE_TX_SCHED
+	test_tx_sched();
+#endif
+#ifdef MAVLINK_HAVE_TX_CONFLATE
+	test_tx_conflate();
+#endif
+#ifdef MAVLINK_HAVE_ROUTER
+	test_router();
+#endif
 	for (chan=MAVLINK_COMM_0; chan<=MAVLINK_COMM_1; chan++) {
 		printf("Received %u messages on channel %u OK\n", 
 		       chan_counts[chan], (unsigned)chan);
@@ -233,7 +1479,31 @@ int main(void)
 	printf("No errors detected\n");
 #endif
 
-	
+#ifdef MAVLINK_HAVE_FRAME_BUFFER
+	printf("Testing bulk framing\n");
+	test_frame_buffer();
+#endif
+#ifdef MAVLINK_HAVE_RX_RING
+	test_rx_ring();
+#endif
+#ifdef MAVLINK_HAVE_CHANNEL_REGISTRY
+	test_channel_registry();
+#endif
+#ifdef MAVLINK_HAVE_CONTEXT
+	test_context_parse();
+#endif
+#ifdef MAVLINK_HAVE_RX_FILTER
+	test_rx_filter();
+#endif
+#ifdef MAVLINK_HAVE_IOVEC
+	test_writev();
+#endif
+	if (error_count != 0) {
+		printf("Error count %u\n", error_count);
+		exit(1);
+	}
+	printf("No errors detected\n");
+
 	return 0;
 }
 
@@ -0,0 +1,417 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+#include "message.hpp"
+
+namespace mavlink {
+
+/**
+ * Parses many byte streams (sockets, serial ports, files) on a pool of
+ * worker threads.
+ *
+ * Every link owns its own mavlink_status_t and mavlink_message_t and is
+ * handled by one worker at a time: a worker takes a link off the front of
+ * its run queue, reads one chunk, parses it with mavlink_frame_buffer() and
+ * puts the link back. A worker whose run queue is empty steals a whole link
+ * from the back of another worker's queue, so a link is never split between
+ * threads.
+ *
+ * A worker that has read nothing from as many links in a row as its run
+ * queue holds sleeps on idle_cv for a millisecond instead of spinning, so
+ * idle links cost little CPU and new data waits at most that long.
+ *
+ * Each link feeds one consumer queue. The frames of a chunk are appended to
+ * that queue before the link is handed back, so frames of one link come out
+ * in wire order. Frames of different links may interleave.
+ */
+class LinkDemux {
+public:
+	/**
+	 * Read up to len bytes of a link into buf.
+	 *
+	 * @returns number of bytes read, 0 if nothing is available right now,
+	 *          negative once the link is closed
+	 */
+	using ReadFn = std::function<ssize_t(uint8_t *buf, size_t len)>;
+
+	//! Completed frame, as handed out by mavlink_frame_buffer()
+	struct Frame {
+		size_t link;		//!< index returned by add_link()
+		uint8_t framing;	//!< MAVLINK_FRAMING_OK, _BAD_CRC or _BAD_SIGNATURE
+		mavlink_message_t msg;
+	};
+
+	//! Per link counters, updated by the worker that runs the link
+	struct LinkStats {
+		uint64_t bytes;
+		uint64_t frames;
+		uint64_t bad_frames;
+		bool open;
+	};
+
+	explicit LinkDemux(size_t num_consumers, size_t chunk_size = 4096) :
+		consumers(num_consumers), chunk_size(chunk_size),
+		running(false), open_links(0), next_queue(0)
+	{
+		for (auto &c : consumers)
+			c.reset(new Consumer());
+	}
+
+	~LinkDemux()
+	{
+		stop();
+	}
+
+	LinkDemux(const LinkDemux &) = delete;
+	LinkDemux &operator=(const LinkDemux &) = delete;
+
+	/**
+	 * Add a link. May be called before start() or while running.
+	 *
+	 * @param read     called from worker threads, never from two at once
+	 * @param consumer consumer queue for the frames of this link
+	 * @returns link index, as found in Frame::link
+	 */
+	size_t add_link(ReadFn read, size_t consumer)
+	{
+		assert(consumer < consumers.size());
+
+		std::unique_ptr<Link> link(new Link());
+		link->read = std::move(read);
+		link->consumer = consumer;
+		memset(&link->status, 0, sizeof(link->status));
+		memset(&link->rxmsg, 0, sizeof(link->rxmsg));
+
+		std::lock_guard<std::mutex> lock(links_mutex);
+		link->index = links.size();
+		links.emplace_back(std::move(link));
+		open_links++;
+
+		Link *l = links.back().get();
+		if (running) {
+			RunQueue &q = *queues[next_queue++ % queues.size()];
+			std::lock_guard<std::mutex> qlock(q.mutex);
+			q.links.push_back(l);
+			idle_cv.notify_one();
+		} else {
+			pending.push_back(l);
+		}
+
+		return l->index;
+	}
+
+	/**
+	 * Start the worker threads. Links added so far are spread over them
+	 * round robin.
+	 */
+	void start(size_t num_workers = std::thread::hardware_concurrency())
+	{
+		std::lock_guard<std::mutex> lock(links_mutex);
+		if (running)
+			return;
+
+		if (num_workers == 0)
+			num_workers = 1;
+
+		queues.clear();
+		for (size_t i = 0; i < num_workers; i++)
+			queues.emplace_back(new RunQueue());
+
+		for (auto l : pending)
+			queues[next_queue++ % num_workers]->links.push_back(l);
+		pending.clear();
+
+		running = true;
+		for (size_t i = 0; i < num_workers; i++)
+			workers.emplace_back(&LinkDemux::worker, this, i);
+	}
+
+	/**
+	 * Stop and join the worker threads. Open links keep their parser state
+	 * and continue on the next start().
+	 */
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(links_mutex);
+			if (!running)
+				return;
+			running = false;
+		}
+
+		idle_cv.notify_all();
+		for (auto &t : workers)
+			t.join();
+		workers.clear();
+
+		{
+			std::lock_guard<std::mutex> lock(links_mutex);
+			for (auto &q : queues)
+				for (auto l : q->links)
+					pending.push_back(l);
+			queues.clear();
+		}
+
+		// consumers take links_mutex inside their own lock, so never hold both here
+		wake_consumers();
+	}
+
+	/**
+	 * Wait until every link added so far has been closed.
+	 */
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(links_mutex);
+		closed_cv.wait(lock, [this] { return open_links == 0; });
+	}
+
+	/**
+	 * Take the oldest frame of a consumer queue.
+	 *
+	 * @param block wait for a frame until the engine is stopped or all links are closed
+	 * @returns false if no frame was taken
+	 */
+	bool pop(size_t consumer, Frame &frame, bool block = true)
+	{
+		Consumer &c = *consumers[consumer];
+		std::unique_lock<std::mutex> lock(c.mutex);
+		if (block)
+			c.cv.wait(lock, [&] { return !c.frames.empty() || finished(); });
+
+		if (c.frames.empty())
+			return false;
+
+		frame = c.frames.front();
+		c.frames.pop_front();
+		return true;
+	}
+
+	/**
+	 * Move all queued frames of a consumer to out, without waiting.
+	 *
+	 * @returns number of frames appended
+	 */
+	size_t pop_all(size_t consumer, std::vector<Frame> &out)
+	{
+		Consumer &c = *consumers[consumer];
+		std::lock_guard<std::mutex> lock(c.mutex);
+		size_t n = c.frames.size();
+		out.insert(out.end(), c.frames.begin(), c.frames.end());
+		c.frames.clear();
+		return n;
+	}
+
+	LinkStats link_stats(size_t index)
+	{
+		std::lock_guard<std::mutex> lock(links_mutex);
+		Link &l = *links.at(index);
+		return LinkStats{
+			l.bytes.load(std::memory_order_relaxed),
+			l.frames.load(std::memory_order_relaxed),
+			l.bad_frames.load(std::memory_order_relaxed),
+			!l.closed.load(std::memory_order_acquire)
+		};
+	}
+
+	size_t num_links()
+	{
+		std::lock_guard<std::mutex> lock(links_mutex);
+		return links.size();
+	}
+
+private:
+	struct Link {
+		ReadFn read;
+		size_t index;
+		size_t consumer;
+		mavlink_status_t status;
+		mavlink_message_t rxmsg;
+		std::atomic<uint64_t> bytes{0};
+		std::atomic<uint64_t> frames{0};
+		std::atomic<uint64_t> bad_frames{0};
+		std::atomic<bool> closed{false};
+	};
+
+	struct RunQueue {
+		std::mutex mutex;
+		std::deque<Link *> links;
+	};
+
+	struct Consumer {
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::deque<Frame> frames;
+	};
+
+	//! frames of one chunk, collected by the mavlink_frame_buffer() callback
+	struct Batch {
+		Link *link;
+		std::vector<Frame> frames;
+	};
+
+	std::vector<std::unique_ptr<Consumer>> consumers;
+	std::vector<std::unique_ptr<RunQueue>> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex links_mutex;		// guards links, pending, queues and open_links
+	std::condition_variable closed_cv;
+	std::deque<std::unique_ptr<Link>> links;
+	std::vector<Link *> pending;
+
+	std::mutex idle_mutex;
+	std::condition_variable idle_cv;
+
+	const size_t chunk_size;
+	std::atomic<bool> running;
+	size_t open_links;
+	size_t next_queue;
+
+	bool finished()
+	{
+		std::lock_guard<std::mutex> lock(links_mutex);
+		return !running || open_links == 0;
+	}
+
+	void wake_consumers()
+	{
+		for (auto &c : consumers) {
+			std::lock_guard<std::mutex> lock(c->mutex);
+			c->cv.notify_all();
+		}
+	}
+
+	static void on_frame(void *arg, uint8_t framing, const mavlink_message_t *msg, const mavlink_status_t *status)
+	{
+		Batch *b = static_cast<Batch *>(arg);
+		b->frames.push_back(Frame{b->link->index, framing, *msg});
+		(void)status;
+	}
+
+	/**
+	 * Take a link off the front of our own queue, or steal one from the
+	 * back of another worker's queue.
+	 */
+	Link *take(size_t self)
+	{
+		const size_t n = queues.size();
+		for (size_t i = 0; i < n; i++) {
+			RunQueue &q = *queues[(self + i) % n];
+			std::lock_guard<std::mutex> lock(q.mutex);
+			if (q.links.empty())
+				continue;
+
+			Link *l;
+			if (i == 0) {
+				l = q.links.front();
+				q.links.pop_front();
+			} else {
+				l = q.links.back();
+				q.links.pop_back();
+			}
+			return l;
+		}
+		return nullptr;
+	}
+
+	//! @returns number of links now in our queue
+	size_t give_back(size_t self, Link *l)
+	{
+		RunQueue &q = *queues[self];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.links.push_back(l);
+		return q.links.size();
+	}
+
+	void idle_wait()
+	{
+		std::unique_lock<std::mutex> lock(idle_mutex);
+		idle_cv.wait_for(lock, std::chrono::milliseconds(1));
+	}
+
+	void close_link(Link *l)
+	{
+		l->closed.store(true, std::memory_order_release);
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(links_mutex);
+			last = --open_links == 0;
+		}
+		if (last) {
+			closed_cv.notify_all();
+			wake_consumers();
+		}
+	}
+
+	void deliver(Batch &b)
+	{
+		Consumer &c = *consumers[b.link->consumer];
+		{
+			std::lock_guard<std::mutex> lock(c.mutex);
+			c.frames.insert(c.frames.end(), b.frames.begin(), b.frames.end());
+		}
+		c.cv.notify_one();
+	}
+
+	void worker(size_t self)
+	{
+		std::vector<uint8_t> buf(chunk_size);
+		Batch batch;
+		size_t empty_reads = 0;
+
+		while (running.load(std::memory_order_relaxed)) {
+			Link *l = take(self);
+			if (l == nullptr) {
+				idle_wait();
+				continue;
+			}
+
+			ssize_t n = l->read(buf.data(), buf.size());
+			if (n < 0) {
+				close_link(l);
+				continue;
+			}
+
+			if (n > 0) {
+				batch.link = l;
+				batch.frames.clear();
+				mavlink_frame_buffer(&l->rxmsg, &l->status, buf.data(), n, &LinkDemux::on_frame, &batch);
+
+				uint64_t bad = 0;
+				for (auto &f : batch.frames)
+					bad += f.framing != MAVLINK_FRAMING_OK;
+
+				l->bytes.fetch_add(n, std::memory_order_relaxed);
+				l->frames.fetch_add(batch.frames.size(), std::memory_order_relaxed);
+				l->bad_frames.fetch_add(bad, std::memory_order_relaxed);
+
+				// deliver before the link can run on another worker
+				if (!batch.frames.empty())
+					deliver(batch);
+			}
+
+			size_t queued = give_back(self, l);
+			if (n > 0) {
+				empty_reads = 0;
+			} else if (++empty_reads >= queued) {
+				// a full pass over our links read nothing
+				empty_reads = 0;
+				idle_wait();
+			}
+		}
+	}
+};
+
+} // namespace mavlink
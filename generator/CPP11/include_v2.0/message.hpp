@@ -23,7 +23,8 @@ namespace mavlink {
  *
  * @note user of MAVLink library should provide
  *       implementation for this function.
- *       Use mavlink::<dialect-name>::MESSAGE_ENTRIES array to make hash map.
+ *       Use mavlink::<dialect-name>::find_message_entry() to search
+ *       the generated MESSAGE_ENTRIES array.
  *
  * @returns nullptr  if message is unknown
  */
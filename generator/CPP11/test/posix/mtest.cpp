@@ -30,12 +30,68 @@ std::array<char, _N> to_char_array(const char (&a)[_N])
 
 #define TEST_INTEROP
 #include "gtestsuite.hpp"
+#include "link_demux.hpp"
 
 const mavlink::mavlink_msg_entry_t *mavlink::mavlink_get_msg_entry(uint32_t msgid)
 {
 	return nullptr;
 }
 
+TEST(link_demux, per_link_order)
+{
+	const size_t num_links = 12, num_frames = 500;
+	std::vector<std::vector<uint8_t>> streams(num_links);
+	std::vector<size_t> pos(num_links, 0);
+
+	// msgid 0 frames, with no message entries the CRC_EXTRA is 0
+	for (size_t l = 0; l < num_links; l++) {
+		for (uint32_t i = 0; i < num_frames; i++) {
+			mavlink::mavlink_message_t msg{};
+			uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+			uint32_t tag = (l << 16) | i;
+			memcpy(_MAV_PAYLOAD_NON_CONST(&msg), &tag, sizeof(tag));
+			_MAV_PAYLOAD_NON_CONST(&msg)[8] = 0x5a;
+			mavlink::mavlink_finalize_message(&msg, l + 1, 1, 9, 9, 0);
+			uint16_t n = mavlink::mavlink_msg_to_send_buffer(buf, &msg);
+			streams[l].insert(streams[l].end(), buf, buf + n);
+		}
+	}
+
+	mavlink::LinkDemux demux(3, 37);
+	for (size_t l = 0; l < num_links; l++) {
+		demux.add_link([&, l](uint8_t *buf, size_t len) -> ssize_t {
+			if (pos[l] == streams[l].size())
+				return -1;
+			size_t n = std::min(len, streams[l].size() - pos[l]);
+			memcpy(buf, &streams[l][pos[l]], n);
+			pos[l] += n;
+			return n;
+		}, l % 3);
+	}
+	demux.start(4);
+	demux.wait();
+
+	std::vector<uint32_t> next(num_links, 0);
+	for (size_t c = 0; c < 3; c++) {
+		mavlink::LinkDemux::Frame f;
+		while (demux.pop(c, f, false)) {
+			uint32_t tag;
+			ASSERT_EQ(f.framing, mavlink::MAVLINK_FRAMING_OK);
+			ASSERT_EQ(f.link % 3, c);
+			memcpy(&tag, _MAV_PAYLOAD(&f.msg), sizeof(tag));
+			EXPECT_EQ(tag >> 16, f.link);
+			EXPECT_EQ(tag & 0xffff, next[f.link]++);
+		}
+	}
+
+	demux.stop();
+	for (size_t l = 0; l < num_links; l++) {
+		EXPECT_EQ(next[l], num_frames);
+		EXPECT_EQ(demux.link_stats(l).frames, num_frames);
+		EXPECT_FALSE(demux.link_stats(l).open);
+	}
+}
+
 void mavlink::print_msg(mavlink_message_t &m)
 {
 	std::cout << std::hex << std::setfill('0')
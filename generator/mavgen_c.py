@@ -109,8 +109,8 @@ extern "C" {
 
 #ifndef MAVLINK_MESSAGE_CRCS
 #define MAVLINK_MESSAGE_CRCS {${message_crcs_array}}
-#endif
-
+${message_crcs_hash}#endif
+${message_tx_classes}
 #include "../protocol.h"
 
 #define MAVLINK_ENABLED_${basename_upper}
@@ -154,7 +154,7 @@ ${{include_list:#include "../${base}/${base}.h"
 #if MAVLINK_THIS_XML_IDX == MAVLINK_PRIMARY_XML_IDX
 # define MAVLINK_MESSAGE_INFO {${message_info_array}}
 # define MAVLINK_MESSAGE_NAMES {${message_name_array}}
-# if MAVLINK_COMMAND_24BIT
+${message_name_hash}# if MAVLINK_COMMAND_24BIT
 #  include "../mavlink_get_info.h"
 # endif
 #endif
@@ -278,6 +278,40 @@ ${{array_fields:    mav_array_memcpy(packet.${name}, ${name}, sizeof(${type})*${
     return mavlink_finalize_message_chan(msg, system_id, component_id, chan, MAVLINK_MSG_ID_${name}_MIN_LEN, MAVLINK_MSG_ID_${name}_LEN, MAVLINK_MSG_ID_${name}_CRC);
 }
 
+/**
+ * @brief Pack a ${name_lower} message straight into a wire buffer
+ * @param system_id ID of this system
+ * @param component_id ID of this component (e.g. 200 for IMU)
+ * @param status Status of the channel the frame will be sent on
+ * @param out Buffer for the frame, at least MAVLINK_MAX_PACKET_LEN bytes
+${{arg_fields: * @param ${name} ${units} ${description}
+}}
+ * @return length of the frame in bytes, 0 if it can't be sent on this channel
+ */
+#ifdef MAVLINK_HAVE_FINALIZE_WIRE
+static inline uint16_t mavlink_msg_${name_lower}_pack_to_wire(uint8_t system_id, uint8_t component_id, mavlink_status_t *status,
+                               uint8_t *out,
+                                   ${{arg_fields:${array_const}${type} ${array_prefix}${name},}})
+{
+    char *buf = (char *)out + mavlink_wire_header_len(status);
+#if MAVLINK_NEED_BYTE_SWAP || !MAVLINK_ALIGNED_FIELDS
+${{scalar_fields:    _mav_put_${type}(buf, ${wire_offset}, ${putname});
+}}
+${{array_fields:    _mav_put_${type}_array(buf, ${wire_offset}, ${name}, ${array_length});
+}}
+#else
+    mavlink_${name_lower}_t packet;
+${{scalar_fields:    packet.${name} = ${putname};
+}}
+${{array_fields:    mav_array_memcpy(packet.${name}, ${name}, sizeof(${type})*${array_length});
+}}
+        memcpy(buf, &packet, MAVLINK_MSG_ID_${name}_LEN);
+#endif
+
+    return mavlink_finalize_wire(out, system_id, component_id, status, MAVLINK_MSG_ID_${name}, MAVLINK_MSG_ID_${name}_MIN_LEN, MAVLINK_MSG_ID_${name}_LEN, MAVLINK_MSG_ID_${name}_CRC);
+}
+#endif
+
 /**
  * @brief Encode a ${name_lower} struct
  *
@@ -483,6 +517,9 @@ static void mavlink_test_${name_lower}(uint8_t system_id, uint8_t component_id,
         MAVLINK_ASSERT(memcmp(&packet1, &packet2, sizeof(packet1)) == 0);
 
         memset(&packet2, 0, sizeof(packet2));
+#ifdef MAVLINK_HAVE_FINALIZE_WIRE
+    mavlink_status_t wire_status = *mavlink_get_channel_status(MAVLINK_COMM_0);
+#endif
     mavlink_msg_${name_lower}_pack_chan(system_id, component_id, MAVLINK_COMM_0, &msg ${{arg_fields:, packet1.${name} }});
     mavlink_msg_${name_lower}_decode(&msg, &packet2);
         MAVLINK_ASSERT(memcmp(&packet1, &packet2, sizeof(packet1)) == 0);
@@ -492,6 +529,15 @@ static void mavlink_test_${name_lower}(uint8_t system_id, uint8_t component_id,
         for (i=0; i<mavlink_msg_get_send_buffer_length(&msg); i++) {
             comm_send_ch(MAVLINK_COMM_0, buffer[i]);
         }
+#ifdef MAVLINK_HAVE_FINALIZE_WIRE
+        {
+        // the same frame packed straight into a wire buffer, up to the signature timestamp
+        uint8_t wire[MAVLINK_MAX_PACKET_LEN];
+        uint16_t signature_len = (msg.incompat_flags & MAVLINK_IFLAG_SIGNED) ? MAVLINK_SIGNATURE_BLOCK_LEN : 0;
+        MAVLINK_ASSERT(mavlink_msg_${name_lower}_pack_to_wire(system_id, component_id, &wire_status, wire ${{arg_fields:, packet1.${name} }}) == mavlink_msg_get_send_buffer_length(&msg));
+        MAVLINK_ASSERT(memcmp(buffer, wire, mavlink_msg_get_send_buffer_length(&msg) - signature_len) == 0);
+        }
+#endif
     mavlink_msg_${name_lower}_decode(last_msg, &packet2);
         MAVLINK_ASSERT(memcmp(&packet1, &packet2, sizeof(packet1)) == 0);
         
@@ -523,7 +569,7 @@ def copy_fixed_headers(directory, xml):
         "0.9": [ 'protocol.h', 'mavlink_helpers.h', 'mavlink_types.h', 'checksum.h' ],
         "1.0": [ 'protocol.h', 'mavlink_helpers.h', 'mavlink_types.h', 'checksum.h', 'mavlink_conversions.h' ],
         "2.0": [ 'protocol.h', 'mavlink_helpers.h', 'mavlink_types.h', 'checksum.h', 'mavlink_conversions.h',
-                 'mavlink_get_info.h', 'mavlink_sha256.h','fourq_random.h','fourq.h','light_crypto.h','common.h','sha512.h','utils.h','tiger.h','byte_order.h' ]
+                 'mavlink_get_info.h', 'mavlink_channel_registry.h', 'mavlink_frame_ring.h', 'mavlink_tx_sched.h', 'mavlink_tx_conflate.h', 'mavlink_router.h', 'mavlink_sha256.h','fourq_random.h','fourq.h','light_crypto.h','common.h','sha512.h','utils.h','tiger.h','byte_order.h' ]
         }
     basepath = os.path.dirname(os.path.realpath(__file__))
     srcpath = os.path.join(basepath, 'C/include_v%s' % xml.wire_protocol_version)
@@ -535,6 +581,131 @@ def copy_fixed_headers(directory, xml):
             continue
         shutil.copy(src, dest)
 
+class mav_perfect_hash(object):
+    '''collision free hash of a set of 24 bit message IDs
+
+    Hash and displace: the key is hashed into a bucket, each bucket has a
+    displacement, and (hash2(key) + displacement) picks a slot that no other
+    key uses. Lookups are two multiplies and two table reads.
+    '''
+    def __init__(self, keys, max_tries=1000):
+        self.keys = list(keys)
+        n = max(len(self.keys), 2)
+        slot_bits = 1
+        while (1 << slot_bits) < n:
+            slot_bits += 1
+        mul1, mul2 = 0x9e3779b1, 0x85ebca6b
+        while True:
+            bucket_bits = max(slot_bits - 2, 1)
+            for attempt in range(max_tries):
+                disp = self._place(slot_bits, bucket_bits, mul1, mul2)
+                if disp is not None:
+                    self.slot_bits, self.bucket_bits = slot_bits, bucket_bits
+                    self.mul1, self.mul2 = mul1, mul2
+                    self.disp = disp
+                    self.index = [0] * (1 << slot_bits)
+                    for i, k in enumerate(self.keys):
+                        self.index[self.slot(k)] = i
+                    return
+                mul1 = ((mul1 * 0x2c1b3c6d + 0x297a2d39) & 0xffffffff) | 1
+                mul2 = ((mul2 * 0x2c1b3c6d + 0x297a2d39) & 0xffffffff) | 1
+            slot_bits += 1
+
+    def _bucket(self, k, bucket_bits, mul1):
+        return ((k * mul1) & 0xffffffff) >> (32 - bucket_bits)
+
+    def _hash2(self, k, slot_bits, mul2):
+        return ((k * mul2) & 0xffffffff) >> (32 - slot_bits)
+
+    def _place(self, slot_bits, bucket_bits, mul1, mul2):
+        mask = (1 << slot_bits) - 1
+        buckets = {}
+        for k in self.keys:
+            buckets.setdefault(self._bucket(k, bucket_bits, mul1), []).append(k)
+        used = [False] * (1 << slot_bits)
+        disp = [0] * (1 << bucket_bits)
+        # place the biggest buckets first while the table is still empty
+        for b, bkeys in sorted(buckets.items(), key=lambda b_k: (-len(b_k[1]), b_k[0])):
+            h2 = [self._hash2(k, slot_bits, mul2) for k in bkeys]
+            for d in range(1 << slot_bits):
+                slots = set([(h + d) & mask for h in h2])
+                if len(slots) == len(bkeys) and not any(used[s] for s in slots):
+                    break
+            else:
+                return None
+            disp[b] = d
+            for s in slots:
+                used[s] = True
+        return disp
+
+    def slot(self, k):
+        mask = (1 << self.slot_bits) - 1
+        return (self._hash2(k, self.slot_bits, self.mul2) + self.disp[self._bucket(k, self.bucket_bits, self.mul1)]) & mask
+
+
+def mav_name_hash(name, seed=0):
+    '''FNV-1a hash of a message or field name, matches _mav_name_hash() in mavlink_get_info.h'''
+    h = 0x811c9dc5
+    for c in [seed & 0xff, (seed >> 8) & 0xff, (seed >> 16) & 0xff] + list(bytearray(name.encode('ascii'))):
+        h ^= c
+        h = (h * 0x01000193) & 0xffffffff
+    return h
+
+
+def mav_name_hash_defines(prefix, keys, entries, entry_format):
+    '''perfect hash defines for a name table, or nothing if two names share a FNV hash'''
+    if len(set(keys)) != len(keys):
+        return ''
+    h = mav_perfect_hash(keys)
+    index = [entries[i] for i in h.index]
+    return '''# define %s_MUL1 0x%08xU
+# define %s_MUL2 0x%08xU
+# define %s_BUCKET_BITS %u
+# define %s_SLOT_BITS %u
+# define %s_DISP {%s}
+# define %s_INDEX {%s}
+''' % (prefix, h.mul1, prefix, h.mul2, prefix, h.bucket_bits, prefix, h.slot_bits,
+       prefix, ', '.join(['%u' % d for d in h.disp]),
+       prefix, ', '.join([entry_format % e for e in index]))
+
+
+# transmit class of a message for mavlink_tx_sched.h, by message name.
+# Messages not listed here are MAVLINK_TX_CLASS_TELEMETRY (1)
+mav_tx_class_policy = {
+    # keepalive, commands and the handshakes of the mission and parameter protocols
+    'HEARTBEAT': 0,
+    'PING': 0,
+    'TIMESYNC': 0,
+    'SET_MODE': 0,
+    'COMMAND_LONG': 0,
+    'COMMAND_INT': 0,
+    'COMMAND_ACK': 0,
+    'COMMAND_CANCEL': 0,
+    'MISSION_COUNT': 0,
+    'MISSION_REQUEST': 0,
+    'MISSION_REQUEST_INT': 0,
+    'MISSION_ACK': 0,
+    'MISSION_ITEM_REACHED': 0,
+    'MISSION_CURRENT': 0,
+    'PARAM_SET': 0,
+    'STATUSTEXT': 0,
+    # bulk transfers, may wait behind everything else
+    'PARAM_VALUE': 2,
+    'PARAM_EXT_VALUE': 2,
+    'MISSION_ITEM': 2,
+    'MISSION_ITEM_INT': 2,
+    'LOG_ENTRY': 2,
+    'LOG_DATA': 2,
+    'FILE_TRANSFER_PROTOCOL': 2,
+    'DATA_TRANSMISSION_HANDSHAKE': 2,
+    'ENCAPSULATED_DATA': 2,
+    'SERIAL_CONTROL': 2,
+    'LOGGING_DATA': 2,
+    'LOGGING_DATA_ACKED': 2,
+    'REMOTE_LOG_DATA_BLOCK': 2,
+}
+
+
 class mav_include(object):
     def __init__(self, base):
         self.base = base
@@ -599,6 +770,33 @@ def generate_one(basename, xml):
             xml.message_crcs_array += '%u, ' % crc
     xml.message_crcs_array = xml.message_crcs_array[:-2]
 
+    # perfect hash over the message CRCs table, used by mavlink_get_msg_entry()
+    xml.message_crcs_hash = ''
+    if xml.command_24bit:
+        h = mav_perfect_hash(sorted(xml.message_crcs.keys()))
+        xml.message_crcs_hash = '''#define MAVLINK_MESSAGE_CRCS_HASH_MUL1 0x%08xU
+#define MAVLINK_MESSAGE_CRCS_HASH_MUL2 0x%08xU
+#define MAVLINK_MESSAGE_CRCS_HASH_BUCKET_BITS %u
+#define MAVLINK_MESSAGE_CRCS_HASH_SLOT_BITS %u
+#define MAVLINK_MESSAGE_CRCS_HASH_DISP {%s}
+#define MAVLINK_MESSAGE_CRCS_HASH_INDEX {%s}
+''' % (h.mul1, h.mul2, h.bucket_bits, h.slot_bits,
+       ', '.join(['%u' % d for d in h.disp]),
+       ', '.join(['%u' % i for i in h.index]))
+
+    # transmit classes that differ from the default, sorted by msgid for bisection
+    xml.message_tx_classes = ''
+    if xml.command_24bit:
+        classes = ['{%u, %u}' % (msgid, mav_tx_class_policy[xml.message_names[msgid]])
+                   for msgid in sorted(xml.message_names.keys())
+                   if mav_tx_class_policy.get(xml.message_names[msgid], 1) != 1]
+        if classes:
+            xml.message_tx_classes = '''
+#ifndef MAVLINK_MESSAGE_TX_CLASSES
+#define MAVLINK_MESSAGE_TX_CLASSES {%s}
+#endif
+''' % ', '.join(classes)
+
     # form message info array
     xml.message_info_array = ''
     if xml.command_24bit:
@@ -625,6 +823,29 @@ def generate_one(basename, xml):
         xml.message_name_array += '{ "%s", %u }, ' % (name, msgid)
     xml.message_name_array = xml.message_name_array[:-2]
 
+    # perfect hashes of message names and of (msgid, field name) over
+    # MAVLINK_MESSAGE_INFO, used by mavlink_get_info.h
+    xml.message_name_hash = ''
+    if xml.command_24bit:
+        msgs = getattr(xml, 'all_messages', {})
+        info_ids = sorted(xml.message_names.keys())
+        name_keys = [mav_name_hash(xml.message_names[msgid]) for msgid in info_ids]
+        xml.message_name_hash += mav_name_hash_defines('MAVLINK_MESSAGE_NAMES_HASH', name_keys,
+                                                       list(range(len(info_ids))), '%u')
+        field_keys = []
+        field_entries = []
+        for idx, msgid in enumerate(info_ids):
+            m = msgs.get(msgid, None)
+            if m is None:
+                field_keys = None
+                break
+            for fidx, f in enumerate(m.fields):
+                field_keys.append(mav_name_hash(f.name, msgid))
+                field_entries.append((idx << 8) | fidx)
+        if field_keys:
+            xml.message_name_hash += mav_name_hash_defines('MAVLINK_MESSAGE_FIELDS_HASH', field_keys,
+                                                           field_entries, '0x%xU')
+
     # add some extra field attributes for convenience with arrays
     for m in xml.message:
         m.msg_name = m.name
@@ -703,8 +924,14 @@ def generate_one(basename, xml):
 def generate(basename, xml_list):
     '''generate complete MAVLink C implemenation'''
 
+    # messages of all XML files by msgid, for the tables of merged dialects
+    all_messages = {}
+    for xml in xml_list:
+        for m in xml.message:
+            all_messages[m.id] = m
     for idx in range(len(xml_list)):
         xml = xml_list[idx]
         xml.xml_idx = idx
+        xml.all_messages = all_messages
         generate_one(basename, xml)
     copy_fixed_headers(basename, xml_list[0])
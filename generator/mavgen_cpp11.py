@@ -11,7 +11,7 @@ Released under GNU GPL version 3 or later
 from __future__ import print_function
 
 import sys, textwrap, os, time
-from . import mavparse, mavtemplate
+from . import mavparse, mavtemplate, mavgen_c
 import collections
 import struct
 
@@ -75,6 +75,31 @@ namespace ${basename} {
  */
 constexpr std::array<mavlink_msg_entry_t, ${message_entry_len}> MESSAGE_ENTRIES {{ ${message_entry_array} }};
 
+/**
+ * Perfect hash over MESSAGE_ENTRIES, see @p find_message_entry()
+ */
+constexpr uint32_t MESSAGE_ENTRIES_HASH_MUL1 = ${message_entry_hash_mul1};
+constexpr uint32_t MESSAGE_ENTRIES_HASH_MUL2 = ${message_entry_hash_mul2};
+constexpr unsigned MESSAGE_ENTRIES_HASH_BUCKET_BITS = ${message_entry_hash_bucket_bits};
+constexpr unsigned MESSAGE_ENTRIES_HASH_SLOT_BITS = ${message_entry_hash_slot_bits};
+constexpr std::array<uint16_t, ${message_entry_hash_disp_len}> MESSAGE_ENTRIES_HASH_DISP {{ ${message_entry_hash_disp} }};
+constexpr std::array<uint16_t, ${message_entry_hash_index_len}> MESSAGE_ENTRIES_HASH_INDEX {{ ${message_entry_hash_index} }};
+
+/**
+ * Find message entry for msgid in MESSAGE_ENTRIES.
+ *
+ * Constant time, may be used to implement @p mavlink_get_msg_entry().
+ *
+ * @returns nullptr  if message is unknown
+ */
+static inline const mavlink_msg_entry_t *find_message_entry(uint32_t msgid)
+{
+    const uint32_t bucket = uint32_t(msgid * MESSAGE_ENTRIES_HASH_MUL1) >> (32 - MESSAGE_ENTRIES_HASH_BUCKET_BITS);
+    const uint32_t slot = (uint32_t(msgid * MESSAGE_ENTRIES_HASH_MUL2) >> (32 - MESSAGE_ENTRIES_HASH_SLOT_BITS)) + MESSAGE_ENTRIES_HASH_DISP[bucket];
+    const mavlink_msg_entry_t *e = &MESSAGE_ENTRIES[MESSAGE_ENTRIES_HASH_INDEX[slot & ((1U << MESSAGE_ENTRIES_HASH_SLOT_BITS) - 1)]];
+    return e->msgid == msgid ? e : nullptr;
+}
+
 //! MAVLINK VERSION
 constexpr auto MAVLINK_VERSION = ${version};
 
@@ -275,7 +300,7 @@ def copy_fixed_headers(directory, xml):
     '''copy the fixed protocol headers to the target directory'''
     import shutil, filecmp
     hlist = {
-        "2.0": ['message.hpp', 'msgmap.hpp']
+        "2.0": ['message.hpp', 'msgmap.hpp', 'link_demux.hpp']
         }
     basepath = os.path.dirname(os.path.realpath(__file__))
     srcpath = os.path.join(basepath, 'CPP11/include_v%s' % xml.wire_protocol_version)
@@ -347,6 +372,17 @@ def generate_one(basename, xml):
             xml.message_target_component_ofs[msgid])
         for msgid in sorted(xml.message_crcs.keys())])
 
+    # perfect hash, indexes into the sorted entries above
+    h = mavgen_c.mav_perfect_hash(sorted(xml.message_crcs.keys()))
+    xml.message_entry_hash_mul1 = '0x%08xU' % h.mul1
+    xml.message_entry_hash_mul2 = '0x%08xU' % h.mul2
+    xml.message_entry_hash_bucket_bits = h.bucket_bits
+    xml.message_entry_hash_slot_bits = h.slot_bits
+    xml.message_entry_hash_disp_len = len(h.disp)
+    xml.message_entry_hash_disp = ', '.join(['%u' % d for d in h.disp])
+    xml.message_entry_hash_index_len = len(h.index)
+    xml.message_entry_hash_index = ', '.join(['%u' % i for i in h.index])
+
     # store types of fields with enum="" attr
     enum_types = collections.defaultdict(list)
 